@@ -12,7 +12,7 @@
 #include "nanovg_gl.h"
 
 #include "load_shader.h"
-#include "../tools/elfw-resources.h"
+#include "shaders-embedded.h"
 #include "perf.h"
 
 
@@ -207,10 +207,13 @@ namespace {
 
 int main(void)
 {
-    elfw::ResourceLoader loader("shaders.data");
+    // resolved at compile time
+    constexpr auto vsId = shaders::resourceId("shaders/basic.vert");
+    constexpr auto fsId = shaders::resourceId("shaders/basic.frag");
+    static_assert(vsId != shaders::Resource::Invalid && fsId != shaders::Resource::Invalid, "Missing shader");
 
-    auto vs = loader.get("shaders/basic.vert");
-    auto fs = loader.get("shaders/basic.frag");
+    auto vs = shaders::get(vsId);
+    auto fs = shaders::get(fsId);
 
 
     GLuint VertexArrayID;
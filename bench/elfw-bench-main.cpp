@@ -0,0 +1,258 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../elfw.h"
+#include "../elfw-recording.h"
+
+// Pipeline benchmark
+// ==================
+//
+// Builds a list of rows with a few dozen commands each, then resolves, diffs and
+// culls it while one row changes every frame. Built once per scalar type (see
+// CMakeLists.txt) so the memory and throughput of the geometry types can be
+// compared. With --pipelined the frames are run again through a Pipeline, whose
+// throughput should approach the slowest stage rather than the sum of both.
+// With --parallel-diff every frame is diffed again with the parallel diff.
+// --overlay slides a layer over the rows, so each frame damages many rows that
+// did not change (recorded, this is where elfw-replay --display-lists pays off).
+
+namespace {
+
+    using namespace elfw;
+    using Clock = std::chrono::steady_clock;
+
+    struct BenchOptions {
+        size_t rows, cmdsPerRow, frames;
+        // records the frames for elfw-replay if set
+        const char* recordFile;
+        // the frames in flight of the pipelined run, 0 skips it
+        size_t framesInFlight;
+        // the threshold of the parallel diff (ParallelDiffOptions), 0 skips it
+        size_t parallelThreshold;
+        bool overlay;
+    };
+
+
+    const char* scalarName() {
+        switch (scalarKind) {
+            case ScalarKind::Fixed: return "fixed 24.8";
+            case ScalarKind::Float: return "float";
+            case ScalarKind::Double: return "double";
+        }
+        return "?";
+    }
+
+
+    double msSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+
+    const int rowHeight = 40;
+
+    // A row of the list, `highlighted` changes the color of its background
+    Div row(const std::string& key, size_t idx, size_t cmdCount, bool highlighted) {
+        using namespace elfw::draw;
+        using namespace elfw::draw::cmds;
+
+        std::vector<Command> cmds;
+        cmds.push_back({frame::full<Scalar>, Rectangle{color::hex(highlighted ? 0xff3366aa : 0xff333333), stroke::none()}});
+        for (size_t i = 1; i < cmdCount; ++i) {
+            // a strip of small cells
+            const Scalar x = Scalar((double) i / cmdCount);
+            cmds.push_back({{rect::make<Scalar>(1, 1, -2, -2), rect::make<Scalar>(x, 0, Scalar(1.0 / cmdCount), 1)},
+                            Ellipse{color::hex(0xff555555), stroke::none()}});
+        }
+
+        // the commands of a div are resolved in its parent's rect, so they go
+        // into a child filling the row
+        return Div{
+                key.c_str(),
+                // rows are placed in pixels, relative coordinates would run out of
+                // precision with fixed point on long lists
+                {rect::make<Scalar>(0, (int) idx * rowHeight, 0, rowHeight), rect::make<Scalar>(0, 0, 1, 0)},
+                {Div{"cells", frame::full<Scalar>, {}, {cmds.begin(), cmds.end()}}},
+                {},
+        };
+    }
+
+
+    // A panel of a few cells, moved as a layer
+    Div overlay(size_t f) {
+        using namespace elfw::draw;
+        using namespace elfw::draw::cmds;
+
+        std::vector<Command> cmds = {{frame::full<Scalar>, Rectangle{color::hex(0xee202020), stroke::none()}}};
+        for (int i = 0; i < 8; ++i) {
+            cmds.push_back({frame::relative<Scalar>(Scalar(0.125 * i), 0, Scalar(0.125), 1),
+                            Ellipse{color::hex(0xff3366aa), stroke::none()}});
+        }
+        const int x = (int) (f * 8 % 800);
+        return layer(Div{
+                "overlay",
+                {rect::make<Scalar>(x, 80, 480, 320), rect::make<Scalar>(0, 0, 0, 0)},
+                {Div{"panel", frame::full<Scalar>, {}, {cmds.begin(), cmds.end()}}},
+                {},
+        });
+    }
+
+
+    Div list(const std::vector<std::string>& keys, const BenchOptions& o, size_t f) {
+        std::vector<Div> rows;
+        for (size_t i = 0; i < o.rows; ++i) {
+            rows.push_back(row(keys[i], i, o.cmdsPerRow, i == f % o.rows));
+        }
+        if (!o.overlay) {
+            return Div{"list", frame::full<Scalar>, rows, {}};
+        }
+        return Div{"root", frame::full<Scalar>, {Div{"list", frame::full<Scalar>, rows, {}}, overlay(f)}, {}};
+    }
+
+
+    template<typename T>
+    size_t bytesOf(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+
+
+    void run(const BenchOptions& o) {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < o.rows; ++i) {
+            keys.push_back("row-" + std::to_string(i));
+        }
+
+        const auto viewRect = rect::make<Scalar>(0, 0, 1280, 720);
+
+        std::vector<Div> views;
+        for (size_t f = 0; f < o.frames; ++f) {
+            views.push_back(list(keys, o, f));
+        }
+
+        Recorder recorder(o.recordFile != nullptr ? o.recordFile : "");
+
+        ViewTreeWithHashes trees[2];
+        resolveDiv(viewRect, views[0], trees[0]);
+        recorder.frame(views[0], viewRect, trees[0]);
+
+        double resolveMs = 0, diffMs = 0, cullMs = 0, parallelDiffMs = 0;
+        size_t patchCount = 0, culledCount = 0;
+
+        for (size_t f = 1; f < o.frames; ++f) {
+            auto& prev = trees[(f - 1) % 2];
+            auto& next = trees[f % 2];
+
+            auto start = Clock::now();
+            resolveDiv(viewRect, views[f], next);
+            resolveMs += msSince(start);
+            recorder.frame(views[f], viewRect, next);
+
+            std::vector<CommandPatch> patches;
+            std::vector<DivPatch> divPatches;
+            start = Clock::now();
+            diff(prev, next, patches, divPatches);
+            diffMs += msSince(start);
+
+            if (o.parallelThreshold > 0) {
+                std::vector<CommandPatch> parallelPatches;
+                std::vector<DivPatch> parallelDivPatches;
+                start = Clock::now();
+                diff(prev, next, parallelPatches, parallelDivPatches, ParallelDiffOptions{o.parallelThreshold, 0});
+                parallelDiffMs += msSince(start);
+            }
+
+            start = Clock::now();
+            auto culled = cullDrawCommands(next, patches, divPatches);
+            cullMs += msSince(start);
+
+            patchCount += patches.size();
+            culledCount += culled.drawCommands.size();
+        }
+
+        const auto& t = trees[0];
+        const size_t geometryBytes = t.drawCommands.size() * sizeof(Rect<Scalar>) + t.divs.size() * sizeof(Rect<Scalar>);
+        const size_t treeBytes = bytesOf(t.drawCommands) + bytesOf(t.divs);
+        const double frames = (double) (o.frames - 1);
+
+        printf("[Bench] scalar: %s\n", scalarName());
+        printf("[Bench] %zd divs, %zd commands\n", t.divs.size(), t.drawCommands.size());
+        printf("[Bench] sizeof: Frame=%zd Rect=%zd ResolvedCommand=%zd ResolvedDiv=%zd\n",
+               sizeof(Frame<Scalar>), sizeof(Rect<Scalar>), sizeof(draw::ResolvedCommand), sizeof(ResolvedDiv));
+        printf("[Bench] memory: geometry=%zd bytes, resolved tree=%zd bytes\n", geometryBytes, treeBytes);
+        printf("[Bench] per frame: resolve=%.3f ms diff=%.3f ms cull=%.3f ms (%.1f patches, %.1f culled commands)\n",
+               resolveMs / frames, diffMs / frames, cullMs / frames, patchCount / frames, culledCount / frames);
+        printf("[Bench] throughput: %.1f M commands/s resolved\n",
+               t.drawCommands.size() * frames / (resolveMs * 1000.0));
+        if (o.parallelThreshold > 0) {
+            printf("[Bench] parallel diff (threshold %zd, %u hardware threads): %.3f ms, %.2fx the serial diff\n",
+                   o.parallelThreshold, std::thread::hardware_concurrency(), parallelDiffMs / frames,
+                   diffMs / parallelDiffMs);
+        }
+
+        if (o.framesInFlight == 0) {
+            return;
+        }
+
+        // the front stage resolves the next frames while the back stage diffs and
+        // culls on this thread
+        const auto start = Clock::now();
+        Pipeline pipeline(PipelineConfig{o.framesInFlight}, [&](size_t frame, ViewTreeWithHashes& tree) {
+            if (frame >= o.frames) {
+                return false;
+            }
+            resolveDiv(viewRect, views[frame], tree);
+            return true;
+        });
+        size_t consumed = 0;
+        while (pipeline.consumeBlocking([&](const PipelineFrame&) { ++consumed; })) {}
+        const double pipelinedMs = msSince(start);
+
+        const double serialMs = (resolveMs + diffMs + cullMs) / frames;
+        const double slowestMs = numbers::max(resolveMs, diffMs + cullMs) / frames;
+        // the stages only overlap with more than one hardware thread
+        printf("[Bench] pipelined (%zd in flight, %u hardware threads): %.1f frames/s, serial sum: %.1f frames/s, "
+               "slowest stage: %.1f frames/s\n",
+               o.framesInFlight, std::thread::hardware_concurrency(), consumed * 1000.0 / pipelinedMs,
+               1000.0 / serialMs, 1000.0 / slowestMs);
+    }
+
+}
+
+
+int main(int argc, char* argv[]) {
+    BenchOptions o = {500, 32, 50, nullptr, 0, 0, false};
+
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--rows") == 0 && hasValue) {
+            o.rows = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--cmds") == 0 && hasValue) {
+            o.cmdsPerRow = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            o.frames = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--record") == 0 && hasValue) {
+            o.recordFile = argv[++i];
+        } else if (strcmp(argv[i], "--pipelined") == 0 && hasValue) {
+            o.framesInFlight = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--parallel-diff") == 0 && hasValue) {
+            o.parallelThreshold = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--overlay") == 0) {
+            o.overlay = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--rows N] [--cmds N] [--frames N] [--record FILE] [--pipelined FRAMES] "
+                            "[--parallel-diff THRESHOLD] [--overlay]\n",
+                    argv[0]);
+            return -1;
+        }
+    }
+
+    if (o.rows == 0 || o.cmdsPerRow == 0 || o.frames < 2) {
+        fprintf(stderr, "Need at least one row, one command and two frames\n");
+        return -1;
+    }
+
+    run(o);
+    return 0;
+}
@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../elfw.h"
+#include "../elfw-patchwire.h"
+#include "../elfw-shmring.h"
+
+// Remote renderer benchmark
+// =========================
+//
+// Forks a renderer process that keeps a RetainedTree in sync with the UI
+// process through encoded patches on a shared memory ring. Every frame
+// recolors `--changes` cells (a Remove and an Add each, so 10k patches by
+// default) and the renderer reports the latency from sending a frame to
+// having applied it.
+
+namespace {
+
+    using namespace elfw;
+    using Clock = std::chrono::steady_clock;
+
+    struct RemoteOptions {
+        size_t rows, cmdsPerRow, changes, frames, ringBytes;
+        // 0 sends frames as fast as the ring takes them
+        double fps;
+        bool verify;
+    };
+
+
+    double msSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+
+    // Timings of a stage in ms
+    struct StageTimes {
+        const char* name;
+        std::vector<double> samples;
+
+        void print() {
+            if (samples.empty()) {
+                return;
+            }
+            std::sort(samples.begin(), samples.end());
+            auto at = [&](double p) { return samples[(size_t) (p * (samples.size() - 1))]; };
+            double sum = 0;
+            for (auto s : samples) { sum += s; }
+
+            printf("[Remote] %-10s mean=%8.3f min=%8.3f p50=%8.3f p90=%8.3f p99=%8.3f max=%8.3f ms\n",
+                   name, sum / samples.size(), samples.front(), at(0.5), at(0.9), at(0.99), samples.back());
+        }
+    };
+
+
+    const int rowHeight = 40;
+
+    // The first `changes` cells of the list flip their color every frame
+    Div row(const std::string& key, size_t idx, const RemoteOptions& o, size_t frame) {
+        using namespace elfw::draw;
+        using namespace elfw::draw::cmds;
+
+        std::vector<Command> cmds;
+        for (size_t i = 0; i < o.cmdsPerRow; ++i) {
+            const bool changing = idx * o.cmdsPerRow + i < o.changes;
+            const uint32_t c = changing && frame % 2 == 1 ? 0xff777777 : 0xff555555;
+            const Scalar x = Scalar((double) i / o.cmdsPerRow);
+            cmds.push_back({{rect::make<Scalar>(1, 1, -2, -2), rect::make<Scalar>(x, 0, Scalar(1.0 / o.cmdsPerRow), 1)},
+                            Ellipse{color::hex(c), stroke::none()}});
+        }
+
+        return Div{
+                key.c_str(),
+                {rect::make<Scalar>(0, (int) idx * rowHeight, 0, rowHeight), rect::make<Scalar>(0, 0, 1, 0)},
+                {Div{"cells", frame::full<Scalar>, {}, {cmds.begin(), cmds.end()}}},
+                {},
+        };
+    }
+
+    Div list(const std::vector<std::string>& keys, const RemoteOptions& o, size_t frame) {
+        std::vector<Div> rows;
+        for (size_t i = 0; i < o.rows; ++i) {
+            rows.push_back(row(keys[i], i, o, frame));
+        }
+        return Div{"list", frame::full<Scalar>, rows, {}};
+    }
+
+    // Both sides start from the same empty root, the first frame adds the whole list
+    Div emptyList() { return Div{"list", frame::full<Scalar>, {}, {}}; }
+
+    const auto viewRect = rect::make<Scalar>(0, 0, 1280, 720);
+
+
+    // Renderer
+    // ========
+
+    int renderer(int socket, const RemoteOptions& o) {
+        ShmRingReader ring;
+        if (!ring.open(socket)) {
+            fprintf(stderr, "[Remote] renderer cannot open the ring\n");
+            return -1;
+        }
+
+        RetainedTree tree(resolveDiv(viewRect, emptyList()));
+        PatchDecoder decoder;
+
+        StageTimes transport = {"transport"}, apply = {"apply"}, total = {"latency"};
+        std::vector<char> message;
+        size_t frames = 0, patches = 0, failures = 0;
+        Clock::time_point first;
+
+        while (ring.read(message)) {
+            const int64_t receivedNs = nowNs();
+            int64_t sentNs;
+            memcpy(&sentNs, message.data(), sizeof(sentNs));
+
+            const auto start = Clock::now();
+            if (decoder.decode(message.data() + sizeof(sentNs), message.size() - sizeof(sentNs)) != PatchDecoder::Ok ||
+                !tree.apply(decoder.target(), decoder.patches(), decoder.divPatches(), o.verify)) {
+                ++failures;
+            }
+            decoder.releaseKeys(tree);
+            const double applyMs = msSince(start);
+
+            // the first frame builds the tree, it is not part of the steady state
+            if (frames++ == 0) {
+                first = Clock::now();
+                continue;
+            }
+            transport.samples.push_back((receivedNs - sentNs) / 1e6);
+            apply.samples.push_back(applyMs);
+            total.samples.push_back((nowNs() - sentNs) / 1e6);
+            patches += decoder.patches().size() + decoder.divPatches().size();
+        }
+
+        const double elapsedMs = msSince(first);
+        printf("[Remote] renderer: %zd frames, %.1f patches per frame, %.2f M patches/s applied\n",
+               frames, patches / (double) (frames > 1 ? frames - 1 : 1), patches / (elapsedMs * 1000.0));
+        transport.print();
+        apply.print();
+        total.print();
+
+        if (failures > 0) {
+            fprintf(stderr, "[Remote] %zd frames failed to %s\n", failures, o.verify ? "decode, apply or verify" : "decode or apply");
+            return -2;
+        }
+        return 0;
+    }
+
+
+    // UI side
+    // =======
+
+    // Returns the exit status of the renderer
+    int producer(int socket, pid_t rendererPid, const RemoteOptions& o) {
+        ShmRingWriter ring;
+        if (!ring.create(socket, o.ringBytes)) {
+            fprintf(stderr, "[Remote] cannot create the ring\n");
+            exit(-1);
+        }
+
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < o.rows; ++i) {
+            keys.push_back("row-" + std::to_string(i));
+        }
+
+        ViewTreeWithHashes trees[2];
+        resolveDiv(viewRect, emptyList(), trees[0]);
+
+        StageTimes encode = {"encode"}, send = {"send"};
+        std::vector<char> out;
+        size_t bytes = 0, patchCount = 0;
+        Clock::time_point first;
+
+        for (size_t f = 1; f <= o.frames; ++f) {
+            auto& prev = trees[(f - 1) % 2];
+            auto& next = trees[f % 2];
+            resolveDiv(viewRect, list(keys, o, f), next);
+
+            std::vector<CommandPatch> patches;
+            std::vector<DivPatch> divPatches;
+            diff(prev, next, patches, divPatches);
+
+            if (o.fps > 0 && f > 1) {
+                std::this_thread::sleep_until(first + std::chrono::microseconds((int64_t) ((f - 1) * 1e6 / o.fps)));
+            }
+
+            auto start = Clock::now();
+            out.assign(sizeof(int64_t), 0);
+            encodePatches(next, patches, divPatches, out);
+            const double encodeMs = msSince(start);
+
+            const int64_t sentNs = nowNs();
+            memcpy(out.data(), &sentNs, sizeof(sentNs));
+            start = Clock::now();
+            if (!ring.write(out.data(), out.size())) {
+                if (!ring.readerGone()) {
+                    fprintf(stderr, "[Remote] a frame of %zd bytes does not fit in the ring (--ring)\n", out.size());
+                    exit(-1);
+                }
+                // reap the renderer before reporting
+                int status = 0;
+                waitpid(rendererPid, &status, 0);
+                fprintf(stderr, "[Remote] the renderer went away after %zd frames\n", f - 1);
+                return -1;
+            }
+
+            if (f == 1) {
+                first = Clock::now();
+                continue;
+            }
+            encode.samples.push_back(encodeMs);
+            send.samples.push_back(msSince(start));
+            bytes += out.size();
+            patchCount += patches.size() + divPatches.size();
+        }
+        const double elapsedMs = msSince(first);
+        ring.close();
+
+        // let the renderer print first
+        int status = 0;
+        waitpid(rendererPid, &status, 0);
+
+        const double frames = (double) std::max<size_t>(o.frames - 1, 1);
+        printf("[Remote] producer: %.1f patches per frame, %.1f KB per frame (%.1f bytes per patch)\n",
+               patchCount / frames, bytes / frames / 1024, bytes / (double) std::max<size_t>(patchCount, 1));
+        printf("[Remote] producer: %.1f frames/s, %.2f M patches/s, %.1f MB/s sent\n",
+               frames * 1000.0 / elapsedMs, patchCount / (elapsedMs * 1000.0), bytes / (elapsedMs * 1000.0));
+        encode.print();
+        send.print();
+
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+}
+
+
+int main(int argc, char* argv[]) {
+    RemoteOptions o = {400, 32, 5000, 200, 64 << 20, 0, false};
+
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--rows") == 0 && hasValue) {
+            o.rows = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--cmds") == 0 && hasValue) {
+            o.cmdsPerRow = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--changes") == 0 && hasValue) {
+            o.changes = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            o.frames = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--ring") == 0 && hasValue) {
+            o.ringBytes = (size_t) atol(argv[++i]) << 20;
+        } else if (strcmp(argv[i], "--fps") == 0 && hasValue) {
+            o.fps = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            o.verify = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--rows N] [--cmds N] [--changes N] [--frames N] [--ring MB] [--fps N] [--verify]\n",
+                    argv[0]);
+            return -1;
+        }
+    }
+
+    if (o.rows == 0 || o.cmdsPerRow == 0 || o.frames < 2 || o.ringBytes == 0) {
+        fprintf(stderr, "Need at least one row, one command, two frames and a ring\n");
+        return -1;
+    }
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        perror("socketpair");
+        return -1;
+    }
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        close(sockets[0]);
+        return renderer(sockets[1], o);
+    }
+
+    close(sockets[1]);
+    return producer(sockets[0], pid, o);
+}
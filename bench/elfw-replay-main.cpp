@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../elfw.h"
+#include "../elfw-raster.h"
+#include "../elfw-recording.h"
+
+// Headless replay
+// ===============
+//
+// Re-runs resolve, diff, cull and (with --raster) the CPU raster over every
+// frame of a recording as fast as possible and prints the timing distribution
+// of each stage. --raster-cache rasterizes through a RasterCache of that many MB,
+// --display-lists culls the static subtrees as frozen display lists.
+
+namespace {
+
+    using namespace elfw;
+    using Clock = std::chrono::steady_clock;
+
+    struct ReplayOptions {
+        const char* file;
+        size_t repeat;
+        bool raster;
+        // 0 rasterizes without a RasterCache
+        size_t rasterCacheBytes;
+        bool displayLists;
+        // 0 culls without pixel snapping
+        double devicePixelRatio;
+        int alignment;
+    };
+
+
+    double msSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+
+    // Timings of a stage in ms
+    struct StageTimes {
+        const char* name;
+        std::vector<double> samples;
+
+        void print() {
+            if (samples.empty()) {
+                return;
+            }
+            std::sort(samples.begin(), samples.end());
+            auto at = [&](double p) { return samples[(size_t) (p * (samples.size() - 1))]; };
+            double sum = 0;
+            for (auto s : samples) { sum += s; }
+
+            printf("[Replay] %-8s mean=%8.3f min=%8.3f p50=%8.3f p90=%8.3f p99=%8.3f max=%8.3f ms\n",
+                   name, sum / samples.size(), samples.front(), at(0.5), at(0.9), at(0.99), samples.back());
+        }
+    };
+
+
+    [[noreturn]] void fail(const char* msg, const char* file) {
+        fprintf(stderr, msg, file);
+        exit(-1);
+    }
+
+
+    void replay(const ReplayOptions& o) {
+        Recording rec;
+        switch (rec.open(o.file)) {
+            case Recording::Ok:
+                break;
+            case Recording::Truncated:
+                fprintf(stderr, "Recording '%s' is truncated, replaying the complete frames\n", o.file);
+                break;
+            case Recording::BadVersion:
+                fail("Unsupported recording version: '%s'\n", o.file);
+            case Recording::WrongScalar:
+                fail("Recording '%s' was made with a different scalar type\n", o.file);
+            case Recording::NotARecording:
+                fail("Cannot read recording: '%s'\n", o.file);
+        }
+
+        const auto& frames = rec.frames();
+        if (frames.empty()) {
+            fail("No frames in recording: '%s'\n", o.file);
+        }
+
+        size_t messages = 0;
+        for (const auto& f : frames) {
+            messages += f.messages.size();
+        }
+        printf("[Replay] %zd frames, %zd messages over %.1f ms\n", frames.size(), messages,
+               (frames.back().timestampNs - frames.front().timestampNs) / 1e6);
+
+        const double dpr = o.devicePixelRatio > 0 ? o.devicePixelRatio : 1.0;
+        const auto& viewRect = frames.front().viewRect;
+        Surface surface((int) std::ceil((double) rect::right(viewRect) * dpr),
+                        (int) std::ceil((double) rect::bottom(viewRect) * dpr));
+
+        RasterCache rasterCache(RasterCacheOptions{3, 8, o.rasterCacheBytes});
+        DisplayListCache displayLists(DisplayListOptions{3, 8, 1 << 18});
+        size_t culledCommands = 0, culledRefs = 0;
+
+        StageTimes resolveTimes = {"resolve"}, diffTimes = {"diff"}, cullTimes = {"cull"}, rasterTimes = {"raster"};
+        size_t hashMismatches = 0;
+
+        for (size_t r = 0; r < o.repeat; ++r) {
+            ViewTreeWithHashes trees[2];
+
+            for (size_t i = 0; i < frames.size(); ++i) {
+                const auto& frame = frames[i];
+                auto& next = trees[i % 2];
+                const auto& prev = trees[(i + 1) % 2];
+
+                auto start = Clock::now();
+                resolveDiv(frame.viewRect, frame.view, next);
+                resolveTimes.samples.push_back(msSince(start));
+
+                if (next.hashStore.divRecursive[0] != frame.rootHash) {
+                    ++hashMismatches;
+                }
+
+                // the first frame has nothing to diff against
+                if (i == 0) {
+                    continue;
+                }
+
+                std::vector<CommandPatch> patches;
+                std::vector<DivPatch> divPatches;
+                start = Clock::now();
+                diff(prev, next, patches, divPatches);
+                diffTimes.samples.push_back(msSince(start));
+
+                start = Clock::now();
+                CulledDrawCommands culled;
+                if (o.displayLists) {
+                    culled = o.devicePixelRatio > 0
+                             ? cullDrawCommands(next, patches, divPatches, DamageOptions{dpr, o.alignment}, displayLists)
+                             : cullDrawCommands(next, patches, divPatches, displayLists);
+                } else {
+                    culled = o.devicePixelRatio > 0
+                             ? cullDrawCommands(next, patches, divPatches, DamageOptions{dpr, o.alignment})
+                             : cullDrawCommands(next, patches, divPatches);
+                }
+                cullTimes.samples.push_back(msSince(start));
+                culledCommands += culled.drawCommands.size();
+                culledRefs += culled.displayListRefs.size();
+
+                if (o.raster) {
+                    start = Clock::now();
+                    if (o.rasterCacheBytes > 0) {
+                        rasterCache.rasterize(next, culled, dpr, surface);
+                    } else if (o.displayLists) {
+                        rasterize(culled, displayLists, dpr, surface);
+                    } else {
+                        rasterize(culled, dpr, surface);
+                    }
+                    rasterTimes.samples.push_back(msSince(start));
+                }
+            }
+        }
+
+        resolveTimes.print();
+        diffTimes.print();
+        cullTimes.print();
+        rasterTimes.print();
+        if (o.displayLists) {
+            const auto& s = displayLists.getStats();
+            printf("[Replay] display lists: %zd hits, %zd misses, %zd evictions, %zd commands kept, "
+                   "%zd commands and %zd list ranges culled\n",
+                   s.hits, s.misses, s.evictions, s.commands, culledCommands, culledRefs);
+        }
+        if (o.raster && o.rasterCacheBytes > 0) {
+            const auto& s = rasterCache.getStats();
+            printf("[Replay] raster cache: %zd hits, %zd misses, %zd evictions, %.1f MB used\n",
+                   s.hits, s.misses, s.evictions, s.bytes / (1024.0 * 1024.0));
+        }
+
+        if (hashMismatches > 0) {
+            // the replay did not produce the recorded trees
+            fprintf(stderr, "[Replay] %zd frames resolved to a different hash than recorded\n", hashMismatches);
+            exit(-2);
+        }
+    }
+
+}
+
+
+int main(int argc, char* argv[]) {
+    ReplayOptions o = {nullptr, 1, false, 0, false, 0, 1};
+
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--repeat") == 0 && hasValue) {
+            o.repeat = (size_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--raster") == 0) {
+            o.raster = true;
+        } else if (strcmp(argv[i], "--raster-cache") == 0 && hasValue) {
+            o.raster = true;
+            o.rasterCacheBytes = (size_t) atol(argv[++i]) << 20;
+        } else if (strcmp(argv[i], "--display-lists") == 0) {
+            o.displayLists = true;
+        } else if (strcmp(argv[i], "--dpr") == 0 && hasValue) {
+            o.devicePixelRatio = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--align") == 0 && hasValue) {
+            o.alignment = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && o.file == nullptr) {
+            o.file = argv[i];
+        } else {
+            o.file = nullptr;
+            break;
+        }
+    }
+
+    if (o.file == nullptr || o.repeat == 0 || o.alignment <= 0) {
+        fprintf(stderr, "Usage: %s RECORDING [--repeat N] [--raster] [--raster-cache MB] [--display-lists]\n"
+                        "       [--dpr RATIO] [--align PIXELS]\n", argv[0]);
+        return -1;
+    }
+
+    replay(o);
+    return 0;
+}
@@ -2,6 +2,7 @@
 
 
 #include <cassert>
+#include "elfw-fixed.h"
 
 namespace elfw {
 
@@ -12,6 +13,25 @@ namespace elfw {
         template <typename T> T max(T a, T b) { return (a > b) ? a : b; }
     }
 
+    // SCALAR
+    // ======
+
+    // The number type of all the geometry in the pipeline. Double by default,
+    // define ELFW_SCALAR_FLOAT or ELFW_SCALAR_FIXED (24.8, see elfw-fixed.h) to
+    // build the pipeline with a smaller type.
+    enum class ScalarKind { Double, Float, Fixed };
+
+#if defined(ELFW_SCALAR_FIXED)
+    using Scalar = Fixed;
+    constexpr ScalarKind scalarKind = ScalarKind::Fixed;
+#elif defined(ELFW_SCALAR_FLOAT)
+    using Scalar = float;
+    constexpr ScalarKind scalarKind = ScalarKind::Float;
+#else
+    using Scalar = double;
+    constexpr ScalarKind scalarKind = ScalarKind::Double;
+#endif
+
     // 2D VECTOR
     // =========
 
@@ -132,6 +152,11 @@ namespace elfw {
         return { v1.x - v2.x, v1.y - v2.y };
     }
 
+    template <typename T>
+    Vec2<T> operator+(const Vec2<T>& v1, const Vec2<T>& v2) {
+        return { v1.x + v2.x, v1.y + v2.y };
+    }
+
     // RECTANGLE OPERATIONS
     // ====================
 
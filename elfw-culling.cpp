@@ -1,5 +1,9 @@
 #include "elfw-culling.h"
+#include "elfw-layers.h"
 
+#include <cmath>
+#include <algorithm>
+#include <functional>
 #include <set>
 #include <vector>
 #include <mkz-algorithm.h>
@@ -27,11 +31,14 @@ namespace  {
                         cmdRects.emplace_back(*a.a.frame);
                         cmdRects.emplace_back(*a.b.frame);
                     },
-                    [&](const patch::UpdateProps<PatchT>& a) {
-                        // TODO: need this?
-//                            cmdRects.emplace_back(*a.a.frame);
-//                            cmdRects.emplace_back(*a.b.frame);
-                    }
+                    // repainted at both places (a backend that can move the
+                    // pixels can use the patch itself)
+                    [&](const patch::Move<PatchT>& a) {
+                        cmdRects.emplace_back(*a.a.frame);
+                        cmdRects.emplace_back(*a.b.frame);
+                    },
+                    // not reported by diff: a command to redraw in place (see imageRedraws)
+                    [&](const patch::UpdateProps<PatchT>& a) { cmdRects.emplace_back(*a.b.frame); }
             );
         }
 
@@ -99,6 +106,303 @@ namespace  {
         rectIndicesInCmdList.emplace_back(cmdListOut.size());
     }
 
+
+    // Pixel snapping
+    // ==============
+
+    // Snaps a rect outward to multiples of `alignment` device pixels
+    inline Rect<int> snapOutward(const Rect<Scalar>& r, const DamageOptions& o) {
+        const double a = o.alignment;
+        auto snapDown = [&](Scalar v) { return (int) (std::floor((double) v * o.devicePixelRatio / a) * a); };
+        auto snapUp = [&](Scalar v) { return (int) (std::ceil((double) v * o.devicePixelRatio / a) * a); };
+
+        const int x = snapDown(r.pos.x), y = snapDown(r.pos.y);
+        return {{x, y}, {snapUp(rect::right(r)) - x, snapUp(rect::bottom(r)) - y}};
+    }
+
+
+    // Fills the damageRects and changedRects of `c` from the patches and the
+    // `moved` layer rects
+    inline void getDamageRects(const std::vector<CommandPatch>& commandDiffs, const std::vector<Rect<Scalar>>& moved,
+                               const DamageOptions& options, CulledDrawCommands& c) {
+        std::vector<Rect<Scalar>> changedRects;
+        getChangedRectangles(commandDiffs, changedRects);
+        changedRects.insert(changedRects.end(), moved.begin(), moved.end());
+
+        // snapping can make separate rects overlap, so combine them again
+        for (auto& r : changedRects) {
+            c.damageRects.emplace_back(snapOutward(r, options));
+        }
+        combineOverlaps(c.damageRects);
+
+        for (auto& d : c.damageRects) {
+            const double toView = 1.0 / options.devicePixelRatio;
+            c.changedRects.emplace_back(Rect<Scalar>{
+                    {Scalar(d.pos.x * toView), Scalar(d.pos.y * toView)},
+                    {Scalar(d.size.x * toView), Scalar(d.size.y * toView)}
+            });
+        }
+    }
+
+
+    // Same as getDrawCommandsFor, but with integer rects
+    inline void getDrawCommandsForDamage(const draw::ResolvedCommandList& cmdList,
+                                         const std::vector<Rect<int>>& damageRects,
+                                         const DamageOptions& options,
+                                         draw::ResolvedCommandList& cmdListOut,
+                                         std::vector<size_t>& rectIndicesInCmdList) {
+        rectIndicesInCmdList.clear();
+
+        // the pixels touched by each command
+        DamageOptions pixels = {options.devicePixelRatio, 1};
+        std::vector<Rect<int>> cmdRects;
+        cmdRects.reserve(cmdList.size());
+        for (auto& cmd : cmdList) {
+            cmdRects.emplace_back(snapOutward(cmd.frame, pixels));
+        }
+
+        for (auto& damage : damageRects) {
+            rectIndicesInCmdList.emplace_back(cmdListOut.size());
+            for (size_t i = 0; i < cmdList.size(); ++i) {
+                if (rect::intersects(cmdRects[i], damage)) {
+                    cmdListOut.emplace_back(cmdList[i]);
+                }
+            }
+        }
+
+        rectIndicesInCmdList.emplace_back(cmdListOut.size());
+    }
+
+
+    // Moved layers
+    // ============
+
+    // Finds the div of the patch in the tree: the patch points into it if it
+    // comes from diff, decoded patches are found by their path
+    const ResolvedDiv* findDiv(const ViewTreeWithHashes& tree, const patch::Base<ResolvedDiv>& b) {
+        const std::less<const ResolvedDiv*> before;
+        if (!tree.divs.empty() && !before(b.el, tree.divs.data()) && before(b.el, tree.divs.data() + tree.divs.size())) {
+            return b.el;
+        }
+        size_t idx = 0;
+        for (size_t i = 1; i < b.path.size(); ++i) {
+            const auto& div = tree.divs[idx];
+            if (b.path[i] < 0 || (size_t) b.path[i] >= div.children.size()) {
+                return nullptr;
+            }
+            idx = div.children.start + b.path[i];
+        }
+        return tree.divs.empty() ? nullptr : &tree.divs[idx];
+    }
+
+
+    // Appends the old and new bounds of the children of the layers moved by
+    // the div patches. Their commands are not patched (see elfw-layers.h).
+    void getMovedLayerRects(const ViewTreeWithHashes& tree, const std::vector<DivPatch>& divPatches,
+                            std::vector<Rect<Scalar>>& rects) {
+        const auto& bounds = tree.hashStore.divBounds;
+        for (const auto& p : divPatches) {
+            if (!layerMoved(p)) {
+                continue;
+            }
+            p.match(
+                    [&](const patch::UpdateProps<ResolvedDiv>& u) {
+                        const ResolvedDiv* div = findDiv(tree, u.b);
+                        if (div == nullptr || div->children.size() == 0) {
+                            return;
+                        }
+
+                        Rect<Scalar> r = bounds[div->children.start];
+                        for (size_t c = div->children.start; c < div->children.start + div->children.size(); ++c) {
+                            r = rect::max(r, bounds[c]);
+                        }
+                        rects.push_back(r);
+                        // the children moved along with the origin
+                        if (u.a.el != nullptr) {
+                            rects.push_back(Rect<Scalar>{r.pos + (u.a.el->layerOrigin - u.b.el->layerOrigin), r.size});
+                        }
+                    },
+                    [](const patch::Add<ResolvedDiv>&) {},
+                    [](const patch::Remove<ResolvedDiv>&) {},
+                    [](const patch::Reorder<ResolvedDiv>&) {},
+                    [](const patch::Move<ResolvedDiv>&) {}
+            );
+        }
+    }
+
+
+    // Display lists
+    // =============
+
+    template<typename T>
+    inline bool covers(const Rect<T>& outer, const Rect<T>& inner) {
+        return outer.pos.x <= inner.pos.x && outer.pos.y <= inner.pos.y &&
+               rect::right(inner) <= rect::right(outer) && rect::bottom(inner) <= rect::bottom(outer);
+    }
+
+
+    // Culls the commands of a frozen subtree that hit the rect as ranges of its
+    // display list, drawn before the next command culled (`at`)
+    template<typename R, typename Hits, typename Covers>
+    void getDisplayListRefs(const DisplayList& list, const Rect<Scalar>& bounds, const R& r, Hits&& hits,
+                            Covers&& covered, size_t at, std::vector<DisplayListRef>& refs) {
+        const auto& commands = list.commands;
+        if (covered(bounds, r)) {
+            refs.push_back(DisplayListRef{list.id, 0, commands.size(), bounds.pos, at});
+            return;
+        }
+
+        size_t run = 0;
+        for (size_t i = 0; i <= commands.size(); ++i) {
+            const bool hit = i < commands.size() &&
+                             hits(Rect<Scalar>{commands[i].frame.pos + bounds.pos, commands[i].frame.size}, r);
+            if (hit) {
+                continue;
+            }
+            if (i > run) {
+                refs.push_back(DisplayListRef{list.id, run, i - run, bounds.pos, at});
+            }
+            run = i + 1;
+        }
+    }
+
+
+    // Tree walk
+    // =========
+
+    // Like getDrawCommandsFor, but only visits the subtrees whose bounds hit the
+    // rect. `hits(frame, rect)` tests both the bounds and the commands. With
+    // display lists, the frozen subtrees are culled as DisplayListRefs
+    // (`covered(bounds, rect)` tests if the rect holds all of one).
+    template<typename RectSeq, typename Hits, typename Covers>
+    inline void getDrawCommandsInTree(const ViewTreeWithHashes& tree, const RectSeq& rects, Hits&& hits,
+                                      Covers&& covered, DisplayListCache* displayLists,
+                                      CulledDrawCommands& out) {
+        const auto& bounds = tree.hashStore.divBounds;
+        const auto& commandBounds = tree.hashStore.divCommandBounds;
+        assert(bounds.size() == tree.divs.size());
+        out.rectIndices.clear();
+        out.rectRefIndices.clear();
+        if (displayLists != nullptr) {
+            displayLists->beginFrame(tree);
+        }
+
+        // the frozen subtrees hit, by the index of their first command
+        using Frozen = std::pair<size_t, std::pair<size_t, const DisplayList*>>;
+        std::vector<size_t> stack, found;
+        std::vector<Frozen> frozen;
+        for (const auto& r : rects) {
+            out.rectIndices.emplace_back(out.drawCommands.size());
+            if (displayLists != nullptr) {
+                out.rectRefIndices.emplace_back(out.displayListRefs.size());
+            }
+            if (tree.divs.empty()) {
+                continue;
+            }
+
+            found.clear();
+            frozen.clear();
+            stack.assign(1, 0);
+            while (!stack.empty()) {
+                const size_t idx = stack.back();
+                stack.pop_back();
+                if (!hits(bounds[idx], r)) {
+                    continue;
+                }
+                if (displayLists != nullptr) {
+                    // the bounds of the commands can be much smaller than the div
+                    // bounds (which cover the rect each div is resolved in), so only
+                    // the subtrees whose commands are hit are looked up
+                    if (!hits(commandBounds[idx], r)) {
+                        continue;
+                    }
+                    if (const DisplayList* list = displayLists->frozen(tree, idx)) {
+                        // the commands of a frozen subtree start at the first of its div
+                        frozen.push_back({tree.divs[idx].drawCommands.start, {idx, list}});
+                        continue;
+                    }
+                }
+
+                const auto& div = tree.divs[idx];
+                const size_t cmdEnd = div.drawCommands.start + div.drawCommands.size();
+                for (size_t i = div.drawCommands.start; i < cmdEnd; ++i) {
+                    if (hits(tree.drawCommands[i].frame, r)) {
+                        found.push_back(i);
+                    }
+                }
+                for (size_t i = div.children.start; i < div.children.start + div.children.size(); ++i) {
+                    stack.push_back(i);
+                }
+            }
+
+            // keep the draw order of the command list, the commands of a frozen
+            // subtree are next to each other in it
+            std::sort(found.begin(), found.end());
+            std::sort(frozen.begin(), frozen.end(),
+                      [](const Frozen& a, const Frozen& b) { return a.first < b.first; });
+            size_t f = 0;
+            auto refsBefore = [&](size_t cmd) {
+                for (; f < frozen.size() && frozen[f].first < cmd; ++f) {
+                    const size_t idx = frozen[f].second.first;
+                    getDisplayListRefs(*frozen[f].second.second, bounds[idx], r, hits, covered,
+                                       out.drawCommands.size(), out.displayListRefs);
+                }
+            };
+            for (const auto i : found) {
+                refsBefore(i);
+                out.drawCommands.emplace_back(tree.drawCommands[i]);
+            }
+            refsBefore(tree.drawCommands.size());
+        }
+
+        out.rectIndices.emplace_back(out.drawCommands.size());
+        if (displayLists != nullptr) {
+            out.rectRefIndices.emplace_back(out.displayListRefs.size());
+        }
+    }
+
+
+
+    CulledDrawCommands cullInTree(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                                  const std::vector<DivPatch>& divPatches, DisplayListCache* displayLists) {
+        auto c = CulledDrawCommands{};
+        getChangedRectangles(commandDiffs, c.changedRects);
+        if (!divPatches.empty()) {
+            getMovedLayerRects(tree, divPatches, c.changedRects);
+            combineOverlaps(c.changedRects);
+        }
+        getDrawCommandsInTree(tree, c.changedRects,
+                              [](const Rect<Scalar>& frame, const Rect<Scalar>& r) { return rect::intersects(frame, r); },
+                              [](const Rect<Scalar>& bounds, const Rect<Scalar>& r) { return covers(r, bounds); },
+                              displayLists, c);
+        return c;
+    }
+
+
+    CulledDrawCommands cullInTree(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                                  const std::vector<DivPatch>& divPatches, const DamageOptions& options,
+                                  DisplayListCache* displayLists) {
+        assert(options.devicePixelRatio > 0 && options.alignment > 0);
+
+        std::vector<Rect<Scalar>> moved;
+        getMovedLayerRects(tree, divPatches, moved);
+
+        auto c = CulledDrawCommands{};
+        getDamageRects(commandDiffs, moved, options, c);
+
+        // the same pixel test as getDrawCommandsForDamage
+        const DamageOptions pixels = {options.devicePixelRatio, 1};
+        getDrawCommandsInTree(tree, c.damageRects,
+                              [&](const Rect<Scalar>& frame, const Rect<int>& damage) {
+                                  return rect::intersects(snapOutward(frame, pixels), damage);
+                              },
+                              [&](const Rect<Scalar>& bounds, const Rect<int>& damage) {
+                                  return covers(damage, snapOutward(bounds, pixels));
+                              },
+                              displayLists, c);
+        return c;
+    }
+
 }
 
 namespace elfw {
@@ -112,4 +416,58 @@ namespace elfw {
         return std::move(c);
     }
 
+
+    CulledDrawCommands
+    cullDrawCommands(const draw::ResolvedCommandList& drawCommands, const std::vector<CommandPatch>& commandDiffs,
+                     const DamageOptions& options) {
+        assert(options.devicePixelRatio > 0 && options.alignment > 0);
+
+        auto c = CulledDrawCommands{};
+        getDamageRects(commandDiffs, {}, options, c);
+        getDrawCommandsForDamage(drawCommands, c.damageRects, options, c.drawCommands, c.rectIndices);
+        return c;
+    }
+
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs) {
+        return cullDrawCommands(tree, commandDiffs, std::vector<DivPatch>{});
+    }
+
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const DamageOptions& options) {
+        return cullDrawCommands(tree, commandDiffs, std::vector<DivPatch>{}, options);
+    }
+
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const std::vector<DivPatch>& divPatches) {
+        return cullInTree(tree, commandDiffs, divPatches, nullptr);
+    }
+
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const std::vector<DivPatch>& divPatches, const DamageOptions& options) {
+        return cullInTree(tree, commandDiffs, divPatches, options, nullptr);
+    }
+
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const std::vector<DivPatch>& divPatches, DisplayListCache& displayLists) {
+        return cullInTree(tree, commandDiffs, divPatches, &displayLists);
+    }
+
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const std::vector<DivPatch>& divPatches, const DamageOptions& options,
+                     DisplayListCache& displayLists) {
+        return cullInTree(tree, commandDiffs, divPatches, options, &displayLists);
+    }
+
 }
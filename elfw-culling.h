@@ -4,12 +4,13 @@
 #include "elfw-base.h"
 #include "elfw-draw.h"
 #include "elfw-diffing.h"
+#include "elfw-displaylist.h"
 
 namespace elfw {
 
     struct CulledDrawCommands {
         // The changed rectangles
-        std::vector<elfw::Rect<double>> changedRects;
+        std::vector<elfw::Rect<elfw::Scalar>> changedRects;
         // The commands for each reactangle keyed by rectIndices
         elfw::draw::ResolvedCommandList drawCommands;
         // Start index in drawCommands for the commands to be redrawn in the rectangle
@@ -17,6 +18,24 @@ namespace elfw {
         // (each entry corresponds to the start index of the draw commands in
         // the drawCommands array)
         std::vector<size_t> rectIndices;
+        // The changed rectangles snapped outward to the device pixel grid (only
+        // filled when culling with DamageOptions, changedRects then holds the
+        // same rectangles in view coordinates)
+        std::vector<elfw::Rect<int>> damageRects;
+        // The ranges of frozen display lists culled instead of their commands
+        // (only when culling with a DisplayListCache), each drawn before the
+        // command at its `at` index. Keyed by rectRefIndices like drawCommands.
+        std::vector<DisplayListRef> displayListRefs;
+        std::vector<size_t> rectRefIndices;
+    };
+
+
+    // Settings for pixel snapped damage
+    struct DamageOptions {
+        // device pixels per view unit
+        double devicePixelRatio;
+        // the damage is snapped to multiples of this many device pixels (1 for plain pixel snapping)
+        int alignment;
     };
 
 
@@ -30,4 +49,56 @@ namespace elfw {
     CulledDrawCommands
     cullDrawCommands(const draw::ResolvedCommandList& drawCommands, const std::vector<CommandPatch>& commandDiffs);
 
+    // Same as above, but the damage is snapped to the device pixel grid and the
+    // commands are tested against it with integer rectangles
+    CulledDrawCommands
+    cullDrawCommands(const draw::ResolvedCommandList& drawCommands, const std::vector<CommandPatch>& commandDiffs,
+                     const DamageOptions& options);
+
+
+    // TREE CULLING
+    // ============
+    //
+    // Same results as above, but the commands are found by walking the tree and
+    // skipping every subtree whose recursive bounds (HashStore::divBounds) miss
+    // the changed rect, so a small change in a large tree only tests the
+    // commands near it.
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs);
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const DamageOptions& options);
+
+    // With the div patches of the same diff, the old and new bounds of the moved
+    // layers (see layerMoved()) are damaged too, as diff does not patch the
+    // commands inside them
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const std::vector<DivPatch>& divPatches);
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const std::vector<DivPatch>& divPatches, const DamageOptions& options);
+
+
+    // DISPLAY LIST CULLING
+    // ====================
+    //
+    // Same as the tree culling with div patches, but the subtrees hit that are
+    // frozen in `displayLists` (or become frozen now, see elfw-displaylist.h)
+    // are not walked: they are culled as a DisplayListRef to the whole list if
+    // the changed rect covers their bounds, or to the runs of their commands
+    // that hit it otherwise. Cull every frame with the same cache.
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const std::vector<DivPatch>& divPatches, DisplayListCache& displayLists);
+
+    CulledDrawCommands
+    cullDrawCommands(const ViewTreeWithHashes& tree, const std::vector<CommandPatch>& commandDiffs,
+                     const std::vector<DivPatch>& divPatches, const DamageOptions& options,
+                     DisplayListCache& displayLists);
+
 }
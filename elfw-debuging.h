@@ -13,19 +13,25 @@ namespace elfw {
     // ==========
 
     template<typename S>
-    S& operator<<(S& s, const Vec2<double>& v) {
+    S& operator<<(S& s, const Fixed& v) {
+        s << v.toDouble();
+        return s;
+    }
+
+    template<typename S, typename T>
+    S& operator<<(S& s, const Vec2<T>& v) {
         s << "{ " << v.x << ", " << v.y << " }";
         return s;
     }
 
-    template<typename S>
-    S& operator<<(S& s, const Rect<double>& v) {
+    template<typename S, typename T>
+    S& operator<<(S& s, const Rect<T>& v) {
         s << "{ pos=" << v.pos << ", size=" << v.size << " }";
         return s;
     }
 
-    template<typename S>
-    S& operator<<(S& s, const Frame<double>& frame) {
+    template<typename S, typename T>
+    S& operator<<(S& s, const Frame<T>& frame) {
         s << "{ abs=" << frame.absolute << ", rel=" << frame.relative << "}";
         return s;
     }
@@ -69,7 +75,10 @@ namespace elfw {
             c.cmd.match(
                     [&](const cmds::Rectangle& r) { s << r; },
                     [&](const cmds::RoundedRectangle& r) { s << r; },
-                    [&](const cmds::Ellipse& r) { s << r; }
+                    [&](const cmds::Ellipse& r) { s << r; },
+                    [&](const cmds::Text& r) { s << r; },
+                    [&](const cmds::Image& r) { s << r; },
+                    [&](const cmds::Path& r) { s << r; }
             );
             s << " }\n";
             return s;
@@ -81,7 +90,10 @@ namespace elfw {
             c.cmd.match(
                     [&](const cmds::Rectangle& r) { s << r; },
                     [&](const cmds::RoundedRectangle& r) { s << r; },
-                    [&](const cmds::Ellipse& r) { s << r; }
+                    [&](const cmds::Ellipse& r) { s << r; },
+                    [&](const cmds::Text& r) { s << r; },
+                    [&](const cmds::Image& r) { s << r; },
+                    [&](const cmds::Path& r) { s << r; }
             );
             s << " }\n";
             return s;
@@ -113,6 +125,27 @@ namespace elfw {
                 s << "{ Ellipse fill=" << r.fill << " stroke=" << r.stroke << "}";
                 return s;
             }
+
+            template<typename S>
+            S& operator<<(S& s, const Text& r) {
+                using elfw::draw::operator<<;
+                s << "{ Text '" << r.text << "' font=" << r.font << ", size=" << r.size << " color=" << r.color << "}";
+                return s;
+            }
+
+            template<typename S>
+            S& operator<<(S& s, const Image& r) {
+                using elfw::draw::operator<<;
+                s << "{ Image id=" << r.image << " placeholder=" << r.placeholder << "}";
+                return s;
+            }
+
+            template<typename S>
+            S& operator<<(S& s, const Path& r) {
+                using elfw::draw::operator<<;
+                s << "{ Path segments=" << r.path->segments.size() << " fill=" << r.fill << " stroke=" << r.stroke << "}";
+                return s;
+            }
         }
     }
 
@@ -212,7 +245,8 @@ namespace elfw {
                     [&](const patch::Remove<T>& p) { s << "[REMOVE] " << p.a; },
                     [&](const patch::Add<T>& p) { s << "[ADD] " << p.b; },
                     [&](const patch::Reorder<T>& p) { s << "[REORDER]\n    old=" << p.a << "\n    new=" << p.b; },
-                    [&](const patch::UpdateProps<T>& p) { s << "[UPDATE]\n    old=" << p.a << "\n    new=" << p.b; }
+                    [&](const patch::UpdateProps<T>& p) { s << "[UPDATE]\n    old=" << p.a << "\n    new=" << p.b; },
+                    [&](const patch::Move<T>& p) { s << "[MOVE]\n    old=" << p.a << "\n    new=" << p.b; }
             );
             return s;
         };
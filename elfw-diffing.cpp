@@ -1,6 +1,10 @@
 #include "elfw-diffing.h"
 
 #include <array>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <unordered_map>
 #include "elfw-orderedset.h"
 #include "elfw-hashing.h"
 
@@ -15,8 +19,18 @@ namespace {
     };
 
 
+    // Settings and shared state for forking subtree diffs
+    struct diff_parallel_state {
+        size_t threshold, maxTasks;
+        // the number of divs and draw commands in each subtree of the new tree
+        std::vector<size_t> subtreeSizes;
+        std::atomic<size_t>* activeTasks;
+    };
+
     struct diff_state_const {
-        const ViewTreeWithHashes& a, b;
+        const ViewTreeWithHashes &a, &b;
+        // nullptr when diffing serially
+        const diff_parallel_state* parallel;
     };
 
     struct diff_state {
@@ -46,14 +60,15 @@ namespace {
         Patches inA, inB, reordered, constant;
         ordered_set::diff(sets.first, sets.second, inA, inB, reordered, constant);
 
-        // TODO: check the reordered ones too
+        // the elements present in both trees (reordered ones may have changed inside too)
         fn(constant);
+        fn(reordered);
 
         auto appendPatches = [&](const containers::Patches& osPatches, auto fn) {
             const auto start = patches.size();
             patches.resize(patches.size() + osPatches.size());
             // append the patches
-            std::transform(osPatches.begin(), osPatches.end(), &patches[start],
+            std::transform(osPatches.begin(), osPatches.end(), patches.begin() + start,
                            [&](const containers::OrderedSetPatch& p) -> Patch<T> {
                                const auto& ae = seq.first[p.idxA];
                                const auto& be = seq.second[p.idxB];
@@ -85,6 +100,111 @@ namespace {
 // Child diffs
 // ===========
 
+    // Diffs a single child that is present in both trees
+    void diffConstantChild(
+            const diff_state_const& const_state,
+            const diff_state& state,
+            const containers::OrderedSetPatch& child,
+            std::vector<CommandPatch>& patches,
+            std::vector<DivPatch>& divPatches
+    ) {
+        const size_t idxA = child.idxA, idxB = child.idxB;
+        const size_t divIdxA = state.a.div.children.start + idxA;
+        const size_t divIdxB = state.b.div.children.start + idxB;
+        const auto& childA = const_state.a.divs[divIdxA];
+        const auto& childB = const_state.b.divs[divIdxB];
+
+        const auto path = std::make_pair(
+                patch::append_to_path(state.a.path, (int) idxA),
+                patch::append_to_path(state.b.path, (int) idxB)
+        );
+
+        // check if the properties changed
+        if (const_state.a.hashStore.divProps[divIdxA] !=
+            const_state.b.hashStore.divProps[divIdxB]) {
+            divPatches.emplace_back(patch::UpdateProps<ResolvedDiv>{
+                    patch::base(path.first, idxA, childA),
+                    patch::base(path.second, idxB, childB),
+            });
+        }
+
+        diff_state child_state = {
+                {childA, path.first},
+                {childB, path.second},
+        };
+
+        diff(const_state, child_state, patches, divPatches);
+    }
+
+
+    // Patches of a single child subtree when diffing in parallel
+    struct child_patches {
+        std::vector<CommandPatch> patches;
+        std::vector<DivPatch> divPatches;
+    };
+
+
+    // Tries to reserve a worker for a forked subtree diff
+    bool tryAcquireWorker(const diff_parallel_state& p) {
+        auto active = p.activeTasks->load(std::memory_order_relaxed);
+        while (active < p.maxTasks) {
+            if (p.activeTasks->compare_exchange_weak(active, active + 1, std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    // Diffs the constant children of a div. Children whose subtree (in the new
+    // tree) is larger than the threshold are diffed on their own task, each child
+    // writes into its own buffer and the buffers are appended in child order, so
+    // the result is the same as the serial diff.
+    template<typename Seq>
+    void diffConstantChildrenParallel(
+            const diff_state_const& const_state,
+            const diff_state& state,
+            const Seq& constantDivs,
+            std::vector<CommandPatch>& patches,
+            std::vector<DivPatch>& divPatches
+    ) {
+        const auto& p = *const_state.parallel;
+
+        std::vector<child_patches> buffers(constantDivs.size());
+        std::vector<std::future<void>> tasks;
+
+        for (size_t i = 0; i < constantDivs.size(); ++i) {
+            const auto& child = constantDivs[i];
+            auto& out = buffers[i];
+
+            const auto subtreeSize = p.subtreeSizes[state.b.div.children.start + child.idxB];
+            if (subtreeSize >= p.threshold && tryAcquireWorker(p)) {
+                // the paths of the parent state are locals of the caller, so the
+                // task keeps its own copy of them
+                tasks.emplace_back(std::async(std::launch::async,
+                        [&const_state, &out, &p, child, aDiv = &state.a.div, bDiv = &state.b.div,
+                                aPath = state.a.path, bPath = state.b.path]() {
+                            diff_state parent = {{*aDiv, aPath}, {*bDiv, bPath}};
+                            diffConstantChild(const_state, parent, child, out.patches, out.divPatches);
+                            p.activeTasks->fetch_sub(1, std::memory_order_acq_rel);
+                        }));
+            } else {
+                diffConstantChild(const_state, state, child, out.patches, out.divPatches);
+            }
+        }
+
+        for (auto& t : tasks) {
+            t.get();
+        }
+
+        // merge in child order
+        for (auto& b : buffers) {
+            patches.insert(patches.end(), b.patches.begin(), b.patches.end());
+            divPatches.insert(divPatches.end(), b.divPatches.begin(), b.divPatches.end());
+        }
+    }
+
+
     void diffChildren(
             const diff_state_const& const_state,
             diff_state& state,
@@ -104,31 +224,14 @@ namespace {
 
         diffAndPatch(os, childDivs, std::make_pair(state.a.path, state.b.path), divPatches,
                      [&](auto& constantDivs) {
-                         // check the children that stayed the same
-                         // TODO: check the reordered ones too
+                         // check the children present in both trees
+                         if (const_state.parallel != nullptr && constantDivs.size() > 1) {
+                             diffConstantChildrenParallel(const_state, state, constantDivs, patches, divPatches);
+                             return;
+                         }
+
                          for (auto& child : constantDivs) {
-                             const size_t idxA = child.idxA, idxB = child.idxB;
-
-                             const auto path = std::make_pair(
-                                     patch::append_to_path(state.a.path, (int) idxA),
-                                     patch::append_to_path(state.b.path, (int) idxB)
-                             );
-
-                             // check if the properties changed
-                             if (const_state.a.hashStore.divProps[idxA] !=
-                                 const_state.b.hashStore.divProps[idxB]) {
-                                 divPatches.emplace_back(patch::UpdateProps<ResolvedDiv>{
-                                         patch::base(path.first, idxA, childDivs.first[idxA]),
-                                         patch::base(path.second, idxB, childDivs.second[idxB]),
-                                 });
-                             }
-
-                             diff_state child_state = {
-                                     {childDivs.first[idxA],  path.first},
-                                     {childDivs.second[idxB], path.second},
-                             };
-
-                             diff(const_state, child_state, patches, divPatches);
+                             diffConstantChild(const_state, state, child, patches, divPatches);
                          }
 
                      });
@@ -138,6 +241,82 @@ namespace {
 // Draw command diffs
 // ==================
 
+    // Turns the removed and added commands of a div with the same contents into
+    // Move patches (the patches from `start` on are the patches of the div)
+    void pairMovedCommands(
+            const diff_state_const& const_state,
+            const diff_state& state,
+            size_t start,
+            std::vector<CommandPatch>& patches
+    ) {
+        using draw::ResolvedCommand;
+        const auto& contentsA = const_state.a.hashStore.drawContents;
+        const auto& contentsB = const_state.b.hashStore.drawContents;
+
+        // contents hash -> index of the Remove patch
+        std::unordered_multimap<Hash, size_t> removed;
+        size_t added = 0;
+        for (size_t i = start; i < patches.size(); ++i) {
+            patches[i].match(
+                    [&](const patch::Remove<ResolvedCommand>& r) {
+                        removed.emplace(contentsA[state.a.div.drawCommands.start + r.a.idx], i);
+                    },
+                    [&](const patch::Add<ResolvedCommand>&) { ++added; },
+                    [](const patch::Reorder<ResolvedCommand>&) {},
+                    [](const patch::UpdateProps<ResolvedCommand>&) {},
+                    [](const patch::Move<ResolvedCommand>&) {}
+            );
+        }
+        if (removed.empty() || added == 0) {
+            return;
+        }
+
+        std::vector<bool> paired(patches.size() - start, false);
+        for (size_t i = start; i < patches.size(); ++i) {
+            const patch::Base<ResolvedCommand>* b = nullptr;
+            patches[i].match(
+                    [&](const patch::Add<ResolvedCommand>& a) { b = &a.b; },
+                    [](const patch::Remove<ResolvedCommand>&) {},
+                    [](const patch::Reorder<ResolvedCommand>&) {},
+                    [](const patch::UpdateProps<ResolvedCommand>&) {},
+                    [](const patch::Move<ResolvedCommand>&) {}
+            );
+            if (b == nullptr) {
+                continue;
+            }
+
+            const auto r = removed.find(contentsB[state.b.div.drawCommands.start + b->idx]);
+            if (r == removed.end()) {
+                continue;
+            }
+            const auto& a = patches[r->second];
+            const patch::Base<ResolvedCommand>* from = nullptr;
+            a.match(
+                    [&](const patch::Remove<ResolvedCommand>& rm) { from = &rm.a; },
+                    [](const patch::Add<ResolvedCommand>&) {},
+                    [](const patch::Reorder<ResolvedCommand>&) {},
+                    [](const patch::UpdateProps<ResolvedCommand>&) {},
+                    [](const patch::Move<ResolvedCommand>&) {}
+            );
+            patches[r->second] = patch::Move<ResolvedCommand>{*from, *b};
+            paired[i - start] = true;
+            removed.erase(r);
+        }
+
+        // drop the Adds that became part of a Move
+        size_t out = start;
+        for (size_t i = start; i < patches.size(); ++i) {
+            if (!paired[i - start]) {
+                if (out != i) {
+                    patches[out] = std::move(patches[i]);
+                }
+                ++out;
+            }
+        }
+        patches.erase(patches.begin() + out, patches.end());
+    }
+
+
     void diffDrawCmds(
             const diff_state_const& const_state,
             diff_state& state,
@@ -161,7 +340,9 @@ namespace {
                 OrderedSet(OrderedSet::SkipHash, dh.second)
         );
 
+        const size_t start = patches.size();
         diffAndPatch(os, dc, std::make_pair(state.a.path, state.b.path), patches, [](auto) {});
+        pairMovedCommands(const_state, state, start, patches);
     }
 
 
@@ -180,23 +361,65 @@ namespace {
 
 }
 
+namespace {
+
+    // Counts the divs and draw commands in each subtree
+    size_t countSubtreeSizes(const std::vector<ResolvedDiv>& divs, size_t idx, std::vector<size_t>& sizes) {
+        const auto& div = divs[idx];
+        size_t size = 1 + div.drawCommands.size();
+        for (size_t i = div.children.start; i < div.children.start + div.children.size(); ++i) {
+            size += countSubtreeSizes(divs, i, sizes);
+        }
+        sizes[idx] = size;
+        return size;
+    }
+
+    void diffRoots(const diff_state_const& const_state,
+                   std::vector<CommandPatch>& patches,
+                   std::vector<DivPatch>& divPatches) {
+        diff_state state = {
+                {const_state.a.divs[0], {0}},
+                {const_state.b.divs[0], {0}},
+        };
+        diff(const_state, state, patches, divPatches);
+    }
+}
+
 namespace elfw {
 
 // Diffs two different divs
     void diff(const ViewTreeWithHashes& a, const ViewTreeWithHashes& b,
               std::vector<CommandPatch>& patches,
               std::vector<DivPatch>& divPatches) {
-        patch::DivPath ap = {0};
-        patch::DivPath bp = {0};
-
         diff_state_const const_state = {
-                a, b,
+                a, b, nullptr
         };
-        diff_state state = {
-                {a.divs[0], {0}},
-                {b.divs[0], {0}},
+        diffRoots(const_state, patches, divPatches);
+    }
+
+
+// Diffs two different divs, forking large child subtrees
+    void diff(const ViewTreeWithHashes& a, const ViewTreeWithHashes& b,
+              std::vector<CommandPatch>& patches,
+              std::vector<DivPatch>& divPatches,
+              const ParallelDiffOptions& options) {
+        if (options.threshold == 0 || b.divs.size() < 2) {
+            return diff(a, b, patches, divPatches);
+        }
+
+        std::atomic<size_t> activeTasks(0);
+        diff_parallel_state parallel = {
+                options.threshold,
+                options.maxTasks > 0 ? options.maxTasks : numbers::max<size_t>(1, std::thread::hardware_concurrency()),
+                std::vector<size_t>(b.divs.size()),
+                &activeTasks,
+        };
+        countSubtreeSizes(b.divs, 0, parallel.subtreeSizes);
+
+        diff_state_const const_state = {
+                a, b, &parallel
         };
-        return diff(const_state, state, patches, divPatches);
+        diffRoots(const_state, patches, divPatches);
     }
 
 }
@@ -22,7 +22,7 @@ namespace elfw {
         struct Base {
             DivPath path;
             const T* el;
-            const Rect<double>* frame;
+            const Rect<Scalar>* frame;
             size_t idx;
         };
 
@@ -46,13 +46,20 @@ namespace elfw {
         struct UpdateProps {
             Base<T> a, b;
         };
+        // The same contents at another frame (only reported for draw commands
+        // moved inside their div), so backends can move the pixels instead of
+        // drawing them again
+        template<typename T>
+        struct Move {
+            Base<T> a, b;
+        };
 
 
     }
 
     // Patch operations from diffing
     template<typename T>
-    using Patch = mkz::variant<patch::Add<T>, patch::Remove<T>, patch::Reorder<T>, patch::UpdateProps<T> >;
+    using Patch = mkz::variant<patch::Add<T>, patch::Remove<T>, patch::Reorder<T>, patch::UpdateProps<T>, patch::Move<T> >;
 
     // Instantiate the template class here
     using CommandPatch = Patch<draw::ResolvedCommand>;
@@ -66,4 +73,20 @@ namespace elfw {
               std::vector<CommandPatch>& patches,
               std::vector<DivPatch>& divPatches);
 
+
+    struct ParallelDiffOptions {
+        // Child subtrees with at least this many divs + draw commands (in the new
+        // tree) are diffed on a separate task. 0 disables forking.
+        std::size_t threshold;
+        // Maximum number of concurrently running tasks (0: hardware concurrency)
+        std::size_t maxTasks;
+    };
+
+    // Diffs two different divs, diffing large sibling subtrees in parallel.
+    // The patches are the same (and in the same order) as the serial diff.
+    void diff(const ViewTreeWithHashes& a, const ViewTreeWithHashes& b,
+              std::vector<CommandPatch>& patches,
+              std::vector<DivPatch>& divPatches,
+              const ParallelDiffOptions& options);
+
 }
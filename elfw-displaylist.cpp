@@ -0,0 +1,107 @@
+#include "elfw-displaylist.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace elfw {
+
+    void DisplayListCache::beginFrame(const ViewTreeWithHashes& tree) {
+        assert(tree.hashStore.divCommandRanges.size() == tree.divs.size());
+        ++frame;
+
+        lookedUp.assign(tree.divs.size(), false);
+        frozenDivs.resize(tree.divs.size());
+
+        // forget the subtrees that stopped counting
+        for (auto it = seen.begin(); it != seen.end();) {
+            if (it->second.lastFrame + options.stableFrames < frame) {
+                it = seen.erase(it);
+                continue;
+            }
+            ++it;
+        }
+    }
+
+
+    void DisplayListCache::evictTo(std::size_t commands) {
+        while (stats.commands > commands && !lru.empty()) {
+            const auto it = entries.find(lru.back());
+            // the lists culled in this frame are referenced until it is drawn
+            if (it->second.lastFrame == frame) {
+                return;
+            }
+            stats.commands -= it->second.list.commands.size();
+            ids.erase(it->second.list.id);
+            entries.erase(it);
+            lru.pop_back();
+            ++stats.evictions;
+        }
+    }
+
+
+    const DisplayList* DisplayListCache::frozen(const ViewTreeWithHashes& tree, size_t idx) {
+        // a div is hit by every damage rect over it
+        if (!lookedUp[idx]) {
+            lookedUp[idx] = true;
+            frozenDivs[idx] = lookUp(tree, idx);
+        }
+        return frozenDivs[idx];
+    }
+
+
+    const DisplayList* DisplayListCache::lookUp(const ViewTreeWithHashes& tree, size_t idx) {
+        const size_t count = tree.hashStore.divCommandRanges[idx];
+        if (count == 0 || count < options.minCommands || count == scatteredCommands) {
+            return nullptr;
+        }
+
+        // the recursive hash does not cover where the children of a layer are,
+        // the origin of the bounds does (the size is part of the key)
+        const auto& b = tree.hashStore.divBounds[idx];
+        std::hash<double> h;
+        const Hash key = combineHashes(combineHashes(tree.hashStore.divRecursive[idx], h((double) b.size.x)),
+                                       h((double) b.size.y));
+
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            it->second.lastFrame = frame;
+            ++stats.hits;
+            return &it->second.list;
+        }
+        ++stats.misses;
+
+        auto& s = seen[key];
+        s.frames = s.lastFrame + options.stableFrames >= frame ? s.frames + 1 : 1;
+        s.lastFrame = frame;
+        if (s.frames < options.stableFrames || count > options.budgetCommands) {
+            return nullptr;
+        }
+        // the lists culled in this frame are kept, so this one might not fit
+        evictTo(options.budgetCommands - count);
+        if (stats.commands + count > options.budgetCommands) {
+            return nullptr;
+        }
+        seen.erase(key);
+
+        DisplayList list = {nextId++, {}, rect::none<Scalar>};
+        const size_t first = tree.divs[idx].drawCommands.start;
+        list.commands.assign(tree.drawCommands.begin() + first, tree.drawCommands.begin() + first + count);
+        for (auto& c : list.commands) {
+            c.frame.pos = c.frame.pos - b.pos;
+            list.bounds = &c == &list.commands.front() ? c.frame : rect::max(list.bounds, c.frame);
+        }
+
+        lru.push_front(key);
+        ids.emplace(list.id, key);
+        stats.commands += count;
+        return &entries.emplace(key, Entry{std::move(list), lru.begin(), frame}).first->second.list;
+    }
+
+
+    const DisplayList* DisplayListCache::list(DisplayListId id) const {
+        const auto it = ids.find(id);
+        return it == ids.end() ? nullptr : &entries.at(it->second).list;
+    }
+
+}
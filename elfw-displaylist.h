@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "elfw-draw.h"
+#include "elfw-viewtree-resolve.h"
+
+namespace elfw {
+
+    // DISPLAY LISTS
+    // =============
+    //
+    // Frozen command ranges of static subtrees, so culling references them
+    // instead of walking and copying their commands every frame. A subtree hit
+    // by the damage in `stableFrames` frames while its recursive hash
+    // (HashStore::divRecursive) and the size of its bounds stayed the same is
+    // frozen into a DisplayList: its commands in draw order relative to the
+    // origin of its bounds, and their bounds. From then on cullDrawCommands with
+    // the cache culls a DisplayListRef (the id of the list and a range of its
+    // commands) instead. Like the raster cache only the subtrees culled are
+    // looked at, and the least recently used lists are dropped to stay in the
+    // command budget.
+    //
+    // The children of a layer are hashed relative to the layer (see
+    // elfw-layers.h), so the list of a moved layer is reused at the new origin.
+    //
+    // Only subtrees whose commands are next to each other in the command list
+    // are frozen (HashStore::divCommandRanges): resolveDiv lays them out depth
+    // first, RetainedTree::flatten does not.
+
+    using DisplayListId = std::uint32_t;
+
+    struct DisplayList {
+        DisplayListId id;
+        // the commands of the subtree in draw order, relative to the origin of
+        // its bounds
+        draw::ResolvedCommandList commands;
+        // the bounds of the commands
+        Rect<Scalar> bounds;
+    };
+
+
+    // The commands [offset, offset + count) of a display list drawn at `origin`,
+    // before the culled command at index `at` (see CulledDrawCommands)
+    struct DisplayListRef {
+        DisplayListId list;
+        std::size_t offset, count;
+        Vec2<Scalar> origin;
+        std::size_t at;
+    };
+
+
+    struct DisplayListOptions {
+        // a subtree is frozen when culled unchanged in this many frames (a
+        // subtree not culled for as many frames starts counting again)
+        std::size_t stableFrames;
+        // smaller subtrees are culled command by command
+        std::size_t minCommands;
+        // the most commands kept in lists (a subtree that does not fit next to
+        // the lists culled in the same frame is not frozen)
+        std::size_t budgetCommands;
+    };
+
+    struct DisplayListStats {
+        // hits: subtrees culled as a list, misses: subtrees large enough culled
+        // without one, evictions: lists dropped to stay in the budget
+        std::size_t hits, misses, evictions;
+        // the commands in the lists
+        std::size_t commands;
+    };
+
+
+    class DisplayListCache {
+    public:
+        explicit DisplayListCache(const DisplayListOptions& options) : options(options) {}
+
+        // Starts looking up the subtrees of the tree about to be culled (called
+        // by cullDrawCommands)
+        void beginFrame(const ViewTreeWithHashes& tree);
+
+        // The list of the subtree at the div, frozen now if it just became
+        // stable, or nullptr (called by cullDrawCommands for the divs the damage
+        // hits)
+        const DisplayList* frozen(const ViewTreeWithHashes& tree, std::size_t idx);
+
+        // The list with the id, or nullptr if it was dropped
+        const DisplayList* list(DisplayListId id) const;
+
+        const DisplayListStats& getStats() const { return stats; }
+
+    private:
+        struct Entry {
+            DisplayList list;
+            std::list<Hash>::iterator lru;
+            std::uint64_t lastFrame;
+        };
+
+        // The frames a subtree not frozen yet was culled in
+        struct Seen {
+            std::size_t frames;
+            std::uint64_t lastFrame;
+        };
+
+        // Finds or freezes the list of the subtree at the div
+        const DisplayList* lookUp(const ViewTreeWithHashes& tree, std::size_t idx);
+
+        // Drops the lists not culled in this frame until at most `commands` are kept
+        void evictTo(std::size_t commands);
+
+        DisplayListOptions options;
+        // keyed by the recursive hash and the size of the bounds
+        std::unordered_map<Hash, Entry> entries;
+        std::unordered_map<DisplayListId, Hash> ids;
+        // the keys of the entries, most recently used first
+        std::list<Hash> lru;
+        std::unordered_map<Hash, Seen> seen;
+        // the lists of the divs looked up in this frame
+        std::vector<bool> lookedUp;
+        std::vector<const DisplayList*> frozenDivs;
+        DisplayListId nextId = 1;
+        std::uint64_t frame = 0;
+        DisplayListStats stats = {0, 0, 0, 0};
+    };
+
+}
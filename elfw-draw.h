@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <memory>
 #include <vector>
 #include "mkzbase/variant.h"
 
@@ -16,6 +17,11 @@ namespace elfw {
             uint8_t a, r, g, b;
         };
 
+        // The fonts loaded with text::loadFont()
+        using FontId = uint32_t;
+        // The images of an ImageCache (see elfw-images.h)
+        using ImageId = uint32_t;
+
         namespace color {
             constexpr Color hex(uint32_t c) {
                 return {
@@ -62,6 +68,30 @@ namespace elfw {
                 stroke::Solid
         >;
 
+        // Paths
+        // =====
+
+        namespace path {
+            enum class Verb : uint8_t { Move, Line, Quad, Cubic, Close };
+
+            // Move and Line use points[0], Quad points[0..1] (control, end) and
+            // Cubic points[0..2] (controls, end)
+            struct Segment {
+                Verb verb;
+                Vec2<double> points[3];
+            };
+
+            // Immutable once built (see PathBuilder in elfw-paths.h), so commands
+            // can share it
+            struct Data {
+                std::vector<Segment> segments;
+                // of all the points (the control points included)
+                Rect<double> bounds;
+                // of the segments
+                std::size_t hash;
+            };
+        }
+
         // Draw commands
         // =============
 
@@ -82,19 +112,46 @@ namespace elfw {
                 Stroke stroke;
             };
 
+            // A single line label, its top left corner at the top left of the
+            // frame and clipped to the frame (see elfw-text.h). The string is not
+            // owned: use literals or text::intern().
+            struct Text {
+                const char* text;
+                FontId font;
+                double size;
+                Color color;
+            };
+
+            // An image scaled to the frame. The placeholder fills the frame until
+            // the image is decoded (see elfw-images.h).
+            struct Image {
+                ImageId image;
+                Color placeholder;
+            };
 
+            // A path drawn with the top left of its stroked bounds at the top left
+            // of the frame (see pathCommand() in elfw-paths.h). The fill uses the
+            // nonzero rule, the stroke is centered on the path.
+            struct Path {
+                std::shared_ptr<const path::Data> path;
+                Fill fill;
+                Stroke stroke;
+            };
 
         }
 
         using CommandOp = mkz::variant<
                 cmds::Rectangle,
                 cmds::RoundedRectangle,
-                cmds::Ellipse
+                cmds::Ellipse,
+                cmds::Text,
+                cmds::Image,
+                cmds::Path
         >;
 
         // Add a frame to all commands
         struct Command {
-            Frame<double> frame;
+            Frame<Scalar> frame;
             CommandOp cmd;
         };
 
@@ -117,6 +174,9 @@ namespace elfw {
 
                 bool constexpr operator()(const RoundedRectangle& r) const { return false; }
                 bool constexpr operator()(const Ellipse& r) const { return false; }
+                bool constexpr operator()(const Text& r) const { return false; }
+                bool constexpr operator()(const Image& r) const { return false; }
+                bool constexpr operator()(const Path& r) const { return false; }
             };
 
 
@@ -127,7 +187,7 @@ namespace elfw {
 
         struct ResolvedCommand {
             // The area touched by the command
-            Rect<double> frame;
+            Rect<Scalar> frame;
             // The area where the result of this command is opaque
             CommandOp cmd;
 
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+namespace elfw {
+
+    // FIXED POINT
+    // ===========
+
+    // A signed 24.8 fixed point number. All the arithmetic is done on the raw
+    // integers, so the results (and their hashes) are the same with every
+    // compiler and on every platform.
+    struct Fixed {
+        static constexpr int fractionBits = 8;
+        static constexpr int32_t one = 1 << fractionBits;
+
+        int32_t raw;
+
+        Fixed() = default;
+        constexpr Fixed(int v) : raw(v * one) {}
+        // rounds to the nearest step
+        constexpr Fixed(double v) : raw((int32_t) (v * one + (v < 0 ? -0.5 : 0.5))) {}
+
+        static constexpr Fixed fromRaw(int32_t raw) { return Fixed(RawTag{}, raw); }
+
+        constexpr double toDouble() const { return (double) raw / one; }
+        explicit constexpr operator double() const { return toDouble(); }
+
+    private:
+        struct RawTag {};
+        constexpr Fixed(RawTag, int32_t raw) : raw(raw) {}
+    };
+
+
+    namespace fixed {
+        // Divides by `one` rounding towards negative infinity (without relying on
+        // the implementation defined shift of negative numbers)
+        constexpr int32_t floorDiv(int64_t v) {
+            return (int32_t) ((v >= 0 ? v : v - (Fixed::one - 1)) / Fixed::one);
+        }
+    }
+
+
+    constexpr Fixed operator+(Fixed a, Fixed b) { return Fixed::fromRaw(a.raw + b.raw); }
+    constexpr Fixed operator-(Fixed a, Fixed b) { return Fixed::fromRaw(a.raw - b.raw); }
+    constexpr Fixed operator-(Fixed a) { return Fixed::fromRaw(-a.raw); }
+    constexpr Fixed operator*(Fixed a, Fixed b) { return Fixed::fromRaw(fixed::floorDiv((int64_t) a.raw * b.raw)); }
+
+    inline Fixed& operator+=(Fixed& a, Fixed b) { a.raw += b.raw; return a; }
+    inline Fixed& operator-=(Fixed& a, Fixed b) { a.raw -= b.raw; return a; }
+
+    constexpr bool operator==(Fixed a, Fixed b) { return a.raw == b.raw; }
+    constexpr bool operator!=(Fixed a, Fixed b) { return a.raw != b.raw; }
+    constexpr bool operator<(Fixed a, Fixed b) { return a.raw < b.raw; }
+    constexpr bool operator>(Fixed a, Fixed b) { return a.raw > b.raw; }
+    constexpr bool operator<=(Fixed a, Fixed b) { return a.raw <= b.raw; }
+    constexpr bool operator>=(Fixed a, Fixed b) { return a.raw >= b.raw; }
+
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "elfw-base.h"
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace elfw {
+
+    // FRAME BATCHES
+    // =============
+    //
+    // The frames of a command range in SoA form, so they can be resolved against
+    // the same parent rect several lanes at a time. The SIMD paths do the same
+    // multiply then add as frame::resolve (never a fused multiply-add), so the
+    // results are bit-identical to the scalar path (as long as the compiler does
+    // not contract the scalar path either, builds with -mfma need -ffp-contract=off).
+    // Only double and float have SIMD paths, Fixed is resolved one frame at a time.
+
+    template <typename T>
+    struct FrameBatch {
+        std::vector<T> absX, absY, absW, absH;
+        std::vector<T> relX, relY, relW, relH;
+
+        void clear() {
+            for (auto* v : lanes()) { v->clear(); }
+        }
+
+        void reserve(size_t n) {
+            for (auto* v : lanes()) { v->reserve(n); }
+        }
+
+        void push_back(const Frame<T>& f) {
+            absX.push_back(f.absolute.pos.x);
+            absY.push_back(f.absolute.pos.y);
+            absW.push_back(f.absolute.size.x);
+            absH.push_back(f.absolute.size.y);
+            relX.push_back(f.relative.pos.x);
+            relY.push_back(f.relative.pos.y);
+            relW.push_back(f.relative.size.x);
+            relH.push_back(f.relative.size.y);
+        }
+
+        size_t size() const { return absX.size(); }
+
+    private:
+        std::array<std::vector<T>*, 8> lanes() {
+            return {{&absX, &absY, &absW, &absH, &relX, &relY, &relW, &relH}};
+        }
+    };
+
+
+    namespace frame {
+
+        namespace detail {
+
+            // Resolves the frames in [begin, end) one at a time
+            template <typename T>
+            inline void resolveScalar(const FrameBatch<T>& b, size_t begin, size_t end,
+                                      const Rect<T>& viewRect, char* out, size_t stride) {
+                for (size_t i = begin; i < end; ++i) {
+                    const Frame<T> f = {{{b.absX[i], b.absY[i]}, {b.absW[i], b.absH[i]}},
+                                        {{b.relX[i], b.relY[i]}, {b.relW[i], b.relH[i]}}};
+                    *reinterpret_cast<Rect<T>*>(out + i * stride) = resolve(f, viewRect);
+                }
+            }
+
+            // Returns the index of the first frame not resolved
+            template <typename T>
+            inline size_t resolveLanes(const FrameBatch<T>&, size_t begin, size_t,
+                                       const Rect<T>&, char*, size_t) {
+                return begin;
+            }
+
+#if defined(__AVX__)
+            // 4 doubles per lane
+            template <>
+            inline size_t resolveLanes(const FrameBatch<double>& b, size_t begin, size_t end,
+                                       const Rect<double>& viewRect, char* out, size_t stride) {
+                const __m256d vx = _mm256_set1_pd(viewRect.pos.x), vy = _mm256_set1_pd(viewRect.pos.y);
+                const __m256d vw = _mm256_set1_pd(viewRect.size.x), vh = _mm256_set1_pd(viewRect.size.y);
+
+                size_t i = begin;
+                for (; i + 4 <= end; i += 4) {
+                    // same order of operations as frame::resolve
+                    __m256d x = _mm256_add_pd(_mm256_loadu_pd(&b.absX[i]), _mm256_mul_pd(_mm256_loadu_pd(&b.relX[i]), vw));
+                    __m256d y = _mm256_add_pd(_mm256_loadu_pd(&b.absY[i]), _mm256_mul_pd(_mm256_loadu_pd(&b.relY[i]), vh));
+                    __m256d w = _mm256_add_pd(_mm256_loadu_pd(&b.absW[i]), _mm256_mul_pd(_mm256_loadu_pd(&b.relW[i]), vw));
+                    __m256d h = _mm256_add_pd(_mm256_loadu_pd(&b.absH[i]), _mm256_mul_pd(_mm256_loadu_pd(&b.relH[i]), vh));
+                    x = _mm256_add_pd(x, vx);
+                    y = _mm256_add_pd(y, vy);
+
+                    // transpose to one {x, y, w, h} rect per register
+                    const __m256d xy01 = _mm256_unpacklo_pd(x, y), xy23 = _mm256_unpackhi_pd(x, y);
+                    const __m256d wh01 = _mm256_unpacklo_pd(w, h), wh23 = _mm256_unpackhi_pd(w, h);
+                    // xy01 = x0 y0 x2 y2, xy23 = x1 y1 x3 y3
+                    _mm256_storeu_pd(reinterpret_cast<double*>(out + (i + 0) * stride), _mm256_permute2f128_pd(xy01, wh01, 0x20));
+                    _mm256_storeu_pd(reinterpret_cast<double*>(out + (i + 1) * stride), _mm256_permute2f128_pd(xy23, wh23, 0x20));
+                    _mm256_storeu_pd(reinterpret_cast<double*>(out + (i + 2) * stride), _mm256_permute2f128_pd(xy01, wh01, 0x31));
+                    _mm256_storeu_pd(reinterpret_cast<double*>(out + (i + 3) * stride), _mm256_permute2f128_pd(xy23, wh23, 0x31));
+                }
+                return i;
+            }
+            // 8 floats per lane
+            template <>
+            inline size_t resolveLanes(const FrameBatch<float>& b, size_t begin, size_t end,
+                                       const Rect<float>& viewRect, char* out, size_t stride) {
+                const __m256 vx = _mm256_set1_ps(viewRect.pos.x), vy = _mm256_set1_ps(viewRect.pos.y);
+                const __m256 vw = _mm256_set1_ps(viewRect.size.x), vh = _mm256_set1_ps(viewRect.size.y);
+
+                size_t i = begin;
+                for (; i + 8 <= end; i += 8) {
+                    __m256 x = _mm256_add_ps(_mm256_loadu_ps(&b.absX[i]), _mm256_mul_ps(_mm256_loadu_ps(&b.relX[i]), vw));
+                    __m256 y = _mm256_add_ps(_mm256_loadu_ps(&b.absY[i]), _mm256_mul_ps(_mm256_loadu_ps(&b.relY[i]), vh));
+                    __m256 w = _mm256_add_ps(_mm256_loadu_ps(&b.absW[i]), _mm256_mul_ps(_mm256_loadu_ps(&b.relW[i]), vw));
+                    __m256 h = _mm256_add_ps(_mm256_loadu_ps(&b.absH[i]), _mm256_mul_ps(_mm256_loadu_ps(&b.relH[i]), vh));
+                    x = _mm256_add_ps(x, vx);
+                    y = _mm256_add_ps(y, vy);
+
+                    // 4x4 transpose in each 128 bit half: rect k in the low half, rect k + 4 in the high half
+                    const __m256 xy01 = _mm256_unpacklo_ps(x, y), xy23 = _mm256_unpackhi_ps(x, y);
+                    const __m256 wh01 = _mm256_unpacklo_ps(w, h), wh23 = _mm256_unpackhi_ps(w, h);
+                    const __m256 r[4] = {
+                            _mm256_shuffle_ps(xy01, wh01, _MM_SHUFFLE(1, 0, 1, 0)),
+                            _mm256_shuffle_ps(xy01, wh01, _MM_SHUFFLE(3, 2, 3, 2)),
+                            _mm256_shuffle_ps(xy23, wh23, _MM_SHUFFLE(1, 0, 1, 0)),
+                            _mm256_shuffle_ps(xy23, wh23, _MM_SHUFFLE(3, 2, 3, 2)),
+                    };
+                    for (size_t k = 0; k < 4; ++k) {
+                        _mm_storeu_ps(reinterpret_cast<float*>(out + (i + k) * stride), _mm256_castps256_ps128(r[k]));
+                        _mm_storeu_ps(reinterpret_cast<float*>(out + (i + k + 4) * stride), _mm256_extractf128_ps(r[k], 1));
+                    }
+                }
+                return i;
+            }
+#elif defined(__SSE2__) || defined(_M_X64)
+            // 2 doubles per lane
+            template <>
+            inline size_t resolveLanes(const FrameBatch<double>& b, size_t begin, size_t end,
+                                       const Rect<double>& viewRect, char* out, size_t stride) {
+                const __m128d vx = _mm_set1_pd(viewRect.pos.x), vy = _mm_set1_pd(viewRect.pos.y);
+                const __m128d vw = _mm_set1_pd(viewRect.size.x), vh = _mm_set1_pd(viewRect.size.y);
+
+                size_t i = begin;
+                for (; i + 2 <= end; i += 2) {
+                    __m128d x = _mm_add_pd(_mm_loadu_pd(&b.absX[i]), _mm_mul_pd(_mm_loadu_pd(&b.relX[i]), vw));
+                    __m128d y = _mm_add_pd(_mm_loadu_pd(&b.absY[i]), _mm_mul_pd(_mm_loadu_pd(&b.relY[i]), vh));
+                    __m128d w = _mm_add_pd(_mm_loadu_pd(&b.absW[i]), _mm_mul_pd(_mm_loadu_pd(&b.relW[i]), vw));
+                    __m128d h = _mm_add_pd(_mm_loadu_pd(&b.absH[i]), _mm_mul_pd(_mm_loadu_pd(&b.relH[i]), vh));
+                    x = _mm_add_pd(x, vx);
+                    y = _mm_add_pd(y, vy);
+
+                    auto* r0 = reinterpret_cast<double*>(out + (i + 0) * stride);
+                    auto* r1 = reinterpret_cast<double*>(out + (i + 1) * stride);
+                    _mm_storeu_pd(r0, _mm_unpacklo_pd(x, y));
+                    _mm_storeu_pd(r0 + 2, _mm_unpacklo_pd(w, h));
+                    _mm_storeu_pd(r1, _mm_unpackhi_pd(x, y));
+                    _mm_storeu_pd(r1 + 2, _mm_unpackhi_pd(w, h));
+                }
+                return i;
+            }
+
+            // 4 floats per lane
+            template <>
+            inline size_t resolveLanes(const FrameBatch<float>& b, size_t begin, size_t end,
+                                       const Rect<float>& viewRect, char* out, size_t stride) {
+                const __m128 vx = _mm_set1_ps(viewRect.pos.x), vy = _mm_set1_ps(viewRect.pos.y);
+                const __m128 vw = _mm_set1_ps(viewRect.size.x), vh = _mm_set1_ps(viewRect.size.y);
+
+                size_t i = begin;
+                for (; i + 4 <= end; i += 4) {
+                    __m128 x = _mm_add_ps(_mm_loadu_ps(&b.absX[i]), _mm_mul_ps(_mm_loadu_ps(&b.relX[i]), vw));
+                    __m128 y = _mm_add_ps(_mm_loadu_ps(&b.absY[i]), _mm_mul_ps(_mm_loadu_ps(&b.relY[i]), vh));
+                    __m128 w = _mm_add_ps(_mm_loadu_ps(&b.absW[i]), _mm_mul_ps(_mm_loadu_ps(&b.relW[i]), vw));
+                    __m128 h = _mm_add_ps(_mm_loadu_ps(&b.absH[i]), _mm_mul_ps(_mm_loadu_ps(&b.relH[i]), vh));
+                    x = _mm_add_ps(x, vx);
+                    y = _mm_add_ps(y, vy);
+
+                    // x, y, w, h become rects 0..3
+                    _MM_TRANSPOSE4_PS(x, y, w, h);
+                    _mm_storeu_ps(reinterpret_cast<float*>(out + (i + 0) * stride), x);
+                    _mm_storeu_ps(reinterpret_cast<float*>(out + (i + 1) * stride), y);
+                    _mm_storeu_ps(reinterpret_cast<float*>(out + (i + 2) * stride), w);
+                    _mm_storeu_ps(reinterpret_cast<float*>(out + (i + 3) * stride), h);
+                }
+                return i;
+            }
+#endif
+        }
+
+
+        // Resolves every frame of the batch against the same rect. The i-th result
+        // is written to `out + i * stride`, so it can go straight into the frame
+        // member of an array of structs.
+        template <typename T>
+        inline void resolve(const FrameBatch<T>& batch, const Rect<T>& viewRect, Rect<T>* out,
+                            size_t stride = sizeof(Rect<T>)) {
+            auto* bytes = reinterpret_cast<char*>(out);
+            const size_t end = batch.size();
+            const size_t done = detail::resolveLanes(batch, 0, end, viewRect, bytes, stride);
+            detail::resolveScalar(batch, done, end, viewRect, bytes, stride);
+
+#ifndef NDEBUG
+            // the same checks as the scalar path
+            for (size_t i = 0; i < done; ++i) {
+                const auto& r = *reinterpret_cast<const Rect<T>*>(bytes + i * stride);
+                assert(r.pos.x < r.pos.x + r.size.x);
+                assert(r.pos.y < r.pos.y + r.size.y);
+            }
+#endif
+        }
+    }
+
+}
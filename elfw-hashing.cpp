@@ -61,6 +61,15 @@ namespace {
         std::size_t seed;
     };
 
+    // Hashes the contents of a string (texts are equal if their characters are)
+    inline std::size_t hash_cstr(const char* s) {
+        std::size_t seed = 0;
+        for (; *s != '\0'; ++s) {
+            seed ^= (std::size_t) (unsigned char) *s + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+
     template<typename...Args>
     std::size_t build_hash(Args&& ... args) {
         return hash_builder{}.add(args...).get();
@@ -86,9 +95,10 @@ namespace {
         };\
     }
 
-MAKE_HASHABLE(elfw::Vec2<double>, t.x, t.y)
-MAKE_HASHABLE(elfw::Rect<double>, t.pos, t.size)
-MAKE_HASHABLE(elfw::Frame<double>, t.absolute, t.relative)
+MAKE_HASHABLE(elfw::Fixed, t.raw)
+MAKE_HASHABLE(elfw::Vec2<elfw::Scalar>, t.x, t.y)
+MAKE_HASHABLE(elfw::Rect<elfw::Scalar>, t.pos, t.size)
+MAKE_HASHABLE(elfw::Frame<elfw::Scalar>, t.absolute, t.relative)
 
 MAKE_HASHABLE(elfw::draw::Color, t.a, t.r, t.g, t.b)
 MAKE_HASHABLE(elfw::draw::stroke::Solid, t.width, t.color)
@@ -99,6 +109,9 @@ UNITY_HASH(std::nullptr_t)
 MAKE_HASHABLE(elfw::draw::cmds::Rectangle, t.fill, t.stroke)
 MAKE_HASHABLE(elfw::draw::cmds::RoundedRectangle, t.radius, t.fill, t.stroke)
 MAKE_HASHABLE(elfw::draw::cmds::Ellipse, t.fill, t.stroke)
+MAKE_HASHABLE(elfw::draw::cmds::Text, hash_cstr(t.text), t.font, t.size, t.color)
+MAKE_HASHABLE(elfw::draw::cmds::Image, t.image, t.placeholder)
+MAKE_HASHABLE(elfw::draw::cmds::Path, t.path->hash, t.fill, t.stroke)
 
 MAKE_HASHABLE(elfw::draw::Command, t.frame, t.cmd)
 
@@ -120,44 +133,112 @@ namespace {
             h.divProps.resize(n);
             h.divCommands.resize(n);
             h.divRecursive.resize(n);
+            h.divBounds.resize(n);
+            h.divCommandBounds.resize(n);
+            h.divCommandRanges.resize(n);
         }
     }
 
 
 
 
-    // Updates the draw command hashes for all commands
+    // Updates the draw command hashes for the commands in [start, end)
     void updateDrawCommandHashes(
             HashStore& hashes,
-            const std::vector<draw::ResolvedCommand>& c
+            const std::vector<draw::ResolvedCommand>& c,
+            size_t start, size_t end
     ) {
-        std::transform(c.begin(), c.end(), hashes.drawCommands.begin(),
+        std::transform(c.begin() + start, c.begin() + end, hashes.drawCommands.begin() + start,
                        [](auto&& c) { return build_hash(c.frame, c.cmd); }
         );
+        std::transform(c.begin() + start, c.begin() + end, hashes.drawContents.begin() + start,
+                       [](auto&& c) { return build_hash(c.frame.size, c.cmd); }
+        );
     }
 
-    // Updates the draw command hashes for all commands
+    // Updates the header and prop hashes for the divs in [start, end)
     void updateDivHeaderAndPropHashes(
             HashStore& hashes,
-            const std::vector<ResolvedDiv>& divList
+            const std::vector<ResolvedDiv>& divList,
+            const std::vector<Vec2<Scalar>>& layerOffsets,
+            size_t start, size_t end
     ) {
-        const auto b = divList.begin(), e = divList.end();
-        std::transform(b, e, hashes.divHeaders.begin(),
-                       [](const auto& div) { return build_hash(std::string(div.key)); }
-        );
-        std::transform(b, e, hashes.divProps.begin(),
-                       [](const auto& div) { return build_hash(div.frame); }
+        const auto b = divList.begin() + start, e = divList.begin() + end;
+        // turning a div into a layer (or back) changes where its descendants are
+        // hashed relative to, so it replaces the div instead of patching it
+        std::transform(b, e, hashes.divHeaders.begin() + start,
+                       [](const auto& div) {
+                           return div.layer ? build_hash(std::string(div.key), true) : build_hash(std::string(div.key));
+                       }
         );
+        if (layerOffsets.empty()) {
+            std::transform(b, e, hashes.divProps.begin() + start,
+                           [](const auto& div) { return build_hash(div.frame); }
+            );
+            return;
+        }
+
+        for (size_t i = start; i < end; ++i) {
+            const auto& div = divList[i];
+            const auto o = layerOffsets[i];
+            const Rect<Scalar> frame = {div.frame.pos - o, div.frame.size};
+            hashes.divProps[i] = div.layer ? build_hash(frame, div.layerOrigin - o) : build_hash(frame);
+        }
+    }
+
+
+    // The origin of the nearest layer above each div, its frame and commands are
+    // hashed relative to it. Returns false (leaving `offsets` empty) if there
+    // are no layers. The parents have to come before their children in the
+    // list, as in every tree built by resolveDiv and RetainedTree.
+    bool updateLayerOffsets(const std::vector<ResolvedDiv>& divList, std::vector<Vec2<Scalar>>& offsets) {
+        offsets.clear();
+        if (std::none_of(divList.begin(), divList.end(), [](const ResolvedDiv& d) { return d.layer; })) {
+            return false;
+        }
+
+        offsets.assign(divList.size(), Vec2<Scalar>{0, 0});
+        for (size_t i = 0; i < divList.size(); ++i) {
+            const auto& div = divList[i];
+            const auto o = div.layer ? div.layerOrigin : offsets[i];
+            for (size_t c = div.children.start; c < div.children.start + div.children.size(); ++c) {
+                offsets[c] = o;
+            }
+        }
+        return true;
     }
 
 
-    // Updates command list hashes for all divs
+    // Re-hashes the commands of the divs in [start, end) inside layers relative to the layer
+    void updateLayerCommandHashes(
+            HashStore& hashes,
+            const std::vector<draw::ResolvedCommand>& c,
+            const std::vector<ResolvedDiv>& divList,
+            const std::vector<Vec2<Scalar>>& layerOffsets,
+            size_t start, size_t end
+    ) {
+        const Vec2<Scalar> none = {0, 0};
+        for (size_t i = start; i < end; ++i) {
+            const auto o = layerOffsets[i];
+            if (o == none) {
+                continue;
+            }
+            const auto& div = divList[i];
+            for (size_t j = div.drawCommands.start; j < div.drawCommands.start + div.drawCommands.size(); ++j) {
+                hashes.drawCommands[j] = build_hash(Rect<Scalar>{c[j].frame.pos - o, c[j].frame.size}, c[j].cmd);
+            }
+        }
+    }
+
+
+    // Updates command list hashes for the divs in [start, end)
     void updateCommandHashes(
             HashStore& hashes,
-            const std::vector<ResolvedDiv>& d
+            const std::vector<ResolvedDiv>& d,
+            size_t start, size_t end
     ) {
         std::transform(
-                d.begin(), d.end(), hashes.divCommands.begin(),
+                d.begin() + start, d.begin() + end, hashes.divCommands.begin() + start,
                 [&](const ResolvedDiv& c) {
                     return hash_seq(0, mkz::with_container(c.drawCommands.as<Hash>(), hashes.drawCommands));
                 }
@@ -165,19 +246,70 @@ namespace {
     }
 
 
+    // Grows command bounds that are rect::none while empty (the frame of a
+    // resolved command never is)
+    Rect<Scalar> addCommandBounds(const Rect<Scalar>& bounds, const Rect<Scalar>& r) {
+        if (r.size == rect::none<Scalar>.size) return bounds;
+        return bounds.size == rect::none<Scalar>.size ? r : rect::max(bounds, r);
+    }
+
+
+    // The frames of the commands of the div
+    Rect<Scalar> ownCommandBounds(const ResolvedDiv& div, const std::vector<draw::ResolvedCommand>& commandsList) {
+        Rect<Scalar> bounds = rect::none<Scalar>;
+        const auto cmdEnd = div.drawCommands.start + div.drawCommands.size();
+        for (size_t i = div.drawCommands.start; i < cmdEnd; ++i) {
+            bounds = addCommandBounds(bounds, commandsList[i].frame);
+        }
+        return bounds;
+    }
+
+
+    // The frame of the div and the frames of its commands
+    Rect<Scalar> ownBounds(const ResolvedDiv& div, const Rect<Scalar>& commandBounds) {
+        return commandBounds.size == rect::none<Scalar>.size ? div.frame : rect::max(div.frame, commandBounds);
+    }
+
+
+    // Adds the command range of a child to the range of its parent, which ends at
+    // `end` so far
+    void addCommandRange(size_t& range, size_t& end, const ResolvedDiv& child, size_t childRange) {
+        if (range == scatteredCommands || childRange == 0) {
+            return;
+        }
+        if (childRange == scatteredCommands || child.drawCommands.start != end) {
+            range = scatteredCommands;
+            return;
+        }
+        range += childRange;
+        end += childRange;
+    }
+
+
+    // `cachedDivs` marks the divs whose recursive hash was copied in (may be empty)
     void updateDivChildHashes(
             HashStore& hashes,
+            const std::vector<draw::ResolvedCommand>& commandsList,
             const std::vector<ResolvedDiv>& divList,
+            const std::vector<bool>& cachedDivs,
             size_t idx = 0
 
     ) {
+        if (!cachedDivs.empty() && cachedDivs[idx]) return;
+
         const auto& div = divList[idx];
         hash_builder recursiveHash(div.children.size());
+        Rect<Scalar> commandBounds = ownCommandBounds(div, commandsList);
+        Rect<Scalar> bounds = ownBounds(div, commandBounds);
+        size_t range = div.drawCommands.size(), rangeEnd = div.drawCommands.start + range;
 
-        const auto childCount = div.children.size();
-        for (size_t i = div.children.start; i < childCount; ++i) {
-            updateDivChildHashes(hashes, divList, idx + i);
+        const auto childEnd = div.children.start + div.children.size();
+        for (size_t i = div.children.start; i < childEnd; ++i) {
+            updateDivChildHashes(hashes, commandsList, divList, cachedDivs, i);
             recursiveHash.combine(hashes.divRecursive[i]);
+            bounds = rect::max(bounds, hashes.divBounds[i]);
+            commandBounds = addCommandBounds(commandBounds, hashes.divCommandBounds[i]);
+            addCommandRange(range, rangeEnd, divList[i], hashes.divCommandRanges[i]);
         }
 
 
@@ -186,6 +318,75 @@ namespace {
         recursiveHash.combine(hashes.divCommands[idx]);
 
         hashes.divRecursive[idx] = recursiveHash.get();
+        hashes.divBounds[idx] = bounds;
+        hashes.divCommandBounds[idx] = commandBounds;
+        hashes.divCommandRanges[idx] = range;
+    }
+
+
+    void updateBoundsRec(
+            HashStore& hashes,
+            const std::vector<draw::ResolvedCommand>& commandsList,
+            const std::vector<ResolvedDiv>& divList,
+            size_t idx
+    ) {
+        const auto& div = divList[idx];
+        Rect<Scalar> commandBounds = ownCommandBounds(div, commandsList);
+        Rect<Scalar> b = ownBounds(div, commandBounds);
+        size_t range = div.drawCommands.size(), rangeEnd = div.drawCommands.start + range;
+
+        const auto childEnd = div.children.start + div.children.size();
+        for (size_t i = div.children.start; i < childEnd; ++i) {
+            updateBoundsRec(hashes, commandsList, divList, i);
+            b = rect::max(b, hashes.divBounds[i]);
+            commandBounds = addCommandBounds(commandBounds, hashes.divCommandBounds[i]);
+            addCommandRange(range, rangeEnd, divList[i], hashes.divCommandRanges[i]);
+        }
+        hashes.divBounds[idx] = b;
+        hashes.divCommandBounds[idx] = commandBounds;
+        hashes.divCommandRanges[idx] = range;
+    }
+
+
+    // Copies the cached hashes into the store
+    void copyCachedHashes(HashStore& hashes, const CachedHashes& c) {
+        auto copy = [&](const HashVector& src, HashVector& dst, size_t srcIdx, size_t dstIdx, size_t count) {
+            std::copy(src.begin() + srcIdx, src.begin() + srcIdx + count, dst.begin() + dstIdx);
+        };
+
+        copy(c.src->divHeaders, hashes.divHeaders, c.srcDiv, c.dstDiv, c.divCount);
+        copy(c.src->divProps, hashes.divProps, c.srcDiv, c.dstDiv, c.divCount);
+        copy(c.src->divCommands, hashes.divCommands, c.srcDiv, c.dstDiv, c.divCount);
+        copy(c.src->divRecursive, hashes.divRecursive, c.srcDiv, c.dstDiv, c.divCount);
+        copy(c.src->drawCommands, hashes.drawCommands, c.srcCmd, c.dstCmd, c.cmdCount);
+        copy(c.src->drawContents, hashes.drawContents, c.srcCmd, c.dstCmd, c.cmdCount);
+
+        // only spliced when resolved into the same rect, so the bounds did not move
+        std::copy(c.src->divBounds.begin() + c.srcDiv, c.src->divBounds.begin() + c.srcDiv + c.divCount,
+                  hashes.divBounds.begin() + c.dstDiv);
+        std::copy(c.src->divCommandBounds.begin() + c.srcDiv, c.src->divCommandBounds.begin() + c.srcDiv + c.divCount,
+                  hashes.divCommandBounds.begin() + c.dstDiv);
+        // the whole subtree moves with its commands, so the ranges still hold
+        std::copy(c.src->divCommandRanges.begin() + c.srcDiv, c.src->divCommandRanges.begin() + c.srcDiv + c.divCount,
+                  hashes.divCommandRanges.begin() + c.dstDiv);
+    }
+
+
+    // Calls fn(start, end) for each range in [0, size) not covered by the cached ranges
+    template<typename Range, typename Fn>
+    void forEachUncachedRange(size_t size, const std::vector<CachedHashes>& cached, Range&& range, Fn&& fn) {
+        std::vector<std::pair<size_t, size_t>> covered;
+        for (const auto& c : cached) {
+            covered.emplace_back(range(c));
+        }
+        std::sort(covered.begin(), covered.end());
+
+        size_t start = 0;
+        for (const auto& r : covered) {
+            if (r.first > start) fn(start, r.first);
+            start = numbers::max(start, r.second);
+        }
+        if (start < size) fn(start, size);
     }
 
 }
@@ -201,17 +402,63 @@ namespace elfw {
                 HashStore& hashStore,
                 std::vector<draw::ResolvedCommand>& commandsList,
                 std::vector<ResolvedDiv>& divList
+    ) {
+        updateViewTreeHashes(div, hashStore, commandsList, divList, {});
+    }
+
+
+    void updateViewTreeHashes(ResolvedDiv& div,
+                              HashStore& hashStore,
+                              std::vector<draw::ResolvedCommand>& commandsList,
+                              std::vector<ResolvedDiv>& divList,
+                              const std::vector<CachedHashes>& cached
     ) {
         hash_store::resizeDivs( hashStore, divList.size() );
         hashStore.drawCommands.resize( commandsList.size() );
+        hashStore.drawContents.resize( commandsList.size() );
+
+        std::vector<bool> cachedDivs;
+        if (!cached.empty()) {
+            cachedDivs.resize(divList.size());
+            for (const auto& c : cached) {
+                copyCachedHashes(hashStore, c);
+                std::fill(cachedDivs.begin() + c.dstDiv, cachedDivs.begin() + c.dstDiv + c.divCount, true);
+            }
+        }
 
-        updateDrawCommandHashes(hashStore, commandsList);
-        updateDivHeaderAndPropHashes(hashStore, divList);
-        updateCommandHashes(hashStore, divList);
-        updateDivChildHashes(hashStore, divList);
+        forEachUncachedRange(commandsList.size(), cached,
+                             [](const CachedHashes& c) { return std::make_pair(c.dstCmd, c.dstCmd + c.cmdCount); },
+                             [&](size_t start, size_t end) {
+                                 updateDrawCommandHashes(hashStore, commandsList, start, end);
+                             });
+
+        std::vector<Vec2<Scalar>> layerOffsets;
+        const bool hasLayers = updateLayerOffsets(divList, layerOffsets);
+
+        forEachUncachedRange(divList.size(), cached,
+                             [](const CachedHashes& c) { return std::make_pair(c.dstDiv, c.dstDiv + c.divCount); },
+                             [&](size_t start, size_t end) {
+                                 updateDivHeaderAndPropHashes(hashStore, divList, layerOffsets, start, end);
+                                 if (hasLayers) {
+                                     updateLayerCommandHashes(hashStore, commandsList, divList, layerOffsets, start, end);
+                                 }
+                                 updateCommandHashes(hashStore, divList, start, end);
+                             });
+
+        updateDivChildHashes(hashStore, commandsList, divList, cachedDivs);
+    }
 
 
+    void updateDivBounds(HashStore& hashStore,
+                         const std::vector<draw::ResolvedCommand>& commandsList,
+                         const std::vector<ResolvedDiv>& divList
+    ) {
+        hashStore.divBounds.resize(divList.size());
+        hashStore.divCommandBounds.resize(divList.size());
+        hashStore.divCommandRanges.resize(divList.size());
+        if (!divList.empty()) {
+            updateBoundsRec(hashStore, commandsList, divList, 0);
+        }
     }
 
 }
-
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <limits>
+
 #include "elfw-draw.h"
 #include "elfw-viewtree.h"
 
@@ -12,9 +14,44 @@ namespace elfw {
     using Hash = std::size_t;
     using HashVector = std::vector<Hash>;
 
+    // The command range of a div whose subtree is not laid out in one range
+    const std::size_t scatteredCommands = std::numeric_limits<std::size_t>::max();
+
     struct HashStore {
         HashVector divHeaders, divProps, divCommands, divRecursive;
         HashVector drawCommands;
+        // The hashes of the draw commands without their position (the command
+        // and the size of its frame), to find the commands that only moved
+        HashVector drawContents;
+
+        // The recursive bounds of each div: its frame and the frames of all the
+        // draw commands below it (filled by the same pass as divRecursive, so
+        // culling can skip whole subtrees)
+        std::vector<Rect<Scalar>> divBounds;
+        // The bounds of the draw commands alone below each div (rect::none
+        // without any), and their number when they are the range from the
+        // first command of the div on (resolveDiv lays a subtree out depth
+        // first), else scatteredCommands. Filled with divBounds, so display
+        // lists are only looked up where commands are hit and need no walk of
+        // their own.
+        std::vector<Rect<Scalar>> divCommandBounds;
+        std::vector<std::size_t> divCommandRanges;
+    };
+
+
+    // Combines two hashes
+    inline Hash combineHashes(Hash seed, Hash h) {
+        return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+    }
+
+
+    // Hashes that are copied from another store instead of being recalculated
+    // (`divCount` divs from `srcDiv` to `dstDiv`, same for the draw commands).
+    // The copied divs must form whole subtrees.
+    struct CachedHashes {
+        const HashStore* src;
+        std::size_t srcDiv, dstDiv, divCount;
+        std::size_t srcCmd, dstCmd, cmdCount;
     };
 
 
@@ -30,5 +67,19 @@ namespace elfw {
                               std::vector<ResolvedDiv>& divList
     );
 
+    // Same as above, but copies the cached ranges instead of hashing them
+    void updateViewTreeHashes(ResolvedDiv& div,
+                              HashStore& hashStore,
+                              std::vector<draw::ResolvedCommand>& commandsList,
+                              std::vector<ResolvedDiv>& divList,
+                              const std::vector<CachedHashes>& cached
+    );
+
+    // Only recalculates the div bounds, command bounds and command ranges (for
+    // trees whose hashes were loaded from somewhere else)
+    void updateDivBounds(HashStore& hashStore,
+                         const std::vector<draw::ResolvedCommand>& commandsList,
+                         const std::vector<ResolvedDiv>& divList
+    );
 
 }
\ No newline at end of file
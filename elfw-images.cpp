@@ -0,0 +1,242 @@
+#include "elfw-images.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <unordered_set>
+
+// nanovg compiles stb_image into its own library, so keep this copy private
+// to the translation unit
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include "vendor/nanovg/src/stb_image.h"
+
+namespace {
+    using namespace elfw;
+
+    std::atomic<ImageCache*> currentCache(nullptr);
+
+
+    bool readFile(const std::string& file, std::vector<unsigned char>& bytes) {
+        FILE* f = fopen(file.c_str(), "rb");
+        if (f == nullptr) {
+            return false;
+        }
+        bytes.clear();
+        unsigned char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+            bytes.insert(bytes.end(), buffer, buffer + n);
+        }
+        const bool ok = ferror(f) == 0;
+        fclose(f);
+        return ok;
+    }
+
+
+    // Returns nullptr if the bytes are not an image stb_image can decode
+    std::shared_ptr<const DecodedImage> decode(const std::vector<unsigned char>& encoded) {
+        int w, h, channels;
+        unsigned char* rgba = stbi_load_from_memory(encoded.data(), (int) encoded.size(), &w, &h, &channels, 4);
+        if (rgba == nullptr) {
+            return nullptr;
+        }
+        auto image = std::make_shared<DecodedImage>(DecodedImage{w, h, std::vector<uint32_t>((size_t) w * h)});
+        for (size_t i = 0; i < image->pixels.size(); ++i) {
+            const unsigned char* p = rgba + i * 4;
+            image->pixels[i] = ((uint32_t) p[3] << 24) | ((uint32_t) p[0] << 16) | ((uint32_t) p[1] << 8) | p[2];
+        }
+        stbi_image_free(rgba);
+        return image;
+    }
+
+
+    size_t imageBytes(const DecodedImage& image) {
+        return image.pixels.size() * sizeof(uint32_t);
+    }
+
+
+    bool showsAny(const draw::CommandOp& cmd, const std::unordered_set<draw::ImageId>& ids) {
+        return cmd.match(
+                [&](const draw::cmds::Image& image) { return ids.count(image.image) > 0; },
+                [](const draw::cmds::Rectangle&) { return false; },
+                [](const draw::cmds::RoundedRectangle&) { return false; },
+                [](const draw::cmds::Ellipse&) { return false; },
+                [](const draw::cmds::Text&) { return false; },
+                [](const draw::cmds::Path&) { return false; }
+        );
+    }
+
+    void collectRedraws(const ViewTreeWithHashes& tree, size_t idx, const patch::DivPath& path,
+                        const std::unordered_set<draw::ImageId>& ids, std::vector<CommandPatch>& patches) {
+        const auto& div = tree.divs[idx];
+        for (size_t i = 0; i < div.drawCommands.size(); ++i) {
+            const auto& c = tree.drawCommands[div.drawCommands.start + i];
+            if (showsAny(c.cmd, ids)) {
+                patches.emplace_back(patch::UpdateProps<draw::ResolvedCommand>{
+                        patch::base(path, i, c), patch::base(path, i, c)});
+            }
+        }
+        for (size_t i = 0; i < div.children.size(); ++i) {
+            collectRedraws(tree, div.children.start + i, patch::append_to_path(path, (int) i), ids, patches);
+        }
+    }
+}
+
+
+namespace elfw {
+
+    namespace images {
+
+        Loader fileLoader(std::vector<std::string> files) {
+            return [files](draw::ImageId id, std::vector<unsigned char>& encoded) {
+                return id < files.size() && readFile(files[id], encoded);
+            };
+        }
+
+
+        void use(ImageCache* cache) {
+            currentCache = cache;
+        }
+
+
+        ImageCache* current() {
+            return currentCache;
+        }
+    }
+
+
+    // Image cache
+    // ===========
+
+    ImageCache::ImageCache(const ImageCacheOptions& options, images::Loader loader, std::function<void()> onReady)
+            : options(options), loader(std::move(loader)), onReady(std::move(onReady)) {
+        for (size_t i = 0; i < numbers::max<size_t>(options.threads, 1); ++i) {
+            threads.emplace_back([this]() { decodeLoop(); });
+        }
+    }
+
+
+    ImageCache::~ImageCache() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        for (auto& t : threads) {
+            t.join();
+        }
+        if (images::current() == this) {
+            images::use(nullptr);
+        }
+    }
+
+
+    std::shared_ptr<const DecodedImage> ImageCache::find(draw::ImageId id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(id);
+        if (it == entries.end()) {
+            ++stats.misses;
+            entries.emplace(id, Entry{State::Queued, nullptr, {}});
+            queue.push_back(id);
+            queued.notify_one();
+            return nullptr;
+        }
+
+        switch (it->second.state) {
+            case State::Ready:
+                ++stats.hits;
+                lru.splice(lru.begin(), lru, it->second.lru);
+                return it->second.image;
+            case State::Queued:
+                ++stats.waits;
+                return nullptr;
+            default:
+                return nullptr;
+        }
+    }
+
+
+    bool ImageCache::isDecoded(draw::ImageId id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(id);
+        return it != entries.end() && it->second.state == State::Ready;
+    }
+
+
+    std::vector<draw::ImageId> ImageCache::takeReady() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<draw::ImageId> r;
+        r.swap(ready);
+        return r;
+    }
+
+
+    ImageStats ImageCache::getStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+
+    void ImageCache::evict() {
+        // never evict the image just decoded
+        while (stats.bytes > options.budgetBytes && lru.size() > 1) {
+            auto victim = entries.find(lru.back());
+            stats.bytes -= imageBytes(*victim->second.image);
+            entries.erase(victim);
+            lru.pop_back();
+            ++stats.evictions;
+        }
+    }
+
+
+    void ImageCache::decodeLoop() {
+        std::vector<unsigned char> encoded;
+        for (;;) {
+            draw::ImageId id;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queued.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (stopping) {
+                    return;
+                }
+                id = queue.front();
+                queue.pop_front();
+            }
+
+            auto image = loader(id, encoded) ? decode(encoded) : nullptr;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto& e = entries[id];
+                if (image == nullptr) {
+                    e.state = State::Failed;
+                    ++stats.failed;
+                    continue;
+                }
+                e.state = State::Ready;
+                e.image = std::move(image);
+                lru.push_front(id);
+                e.lru = lru.begin();
+                stats.bytes += imageBytes(*e.image);
+                ++stats.decoded;
+                ready.push_back(id);
+                evict();
+            }
+            if (onReady) {
+                onReady();
+            }
+        }
+    }
+
+
+    void imageRedraws(const ViewTreeWithHashes& tree, const std::vector<draw::ImageId>& ready,
+                      std::vector<CommandPatch>& patches) {
+        if (ready.empty() || tree.divs.empty()) {
+            return;
+        }
+        const std::unordered_set<draw::ImageId> ids(ready.begin(), ready.end());
+        collectRedraws(tree, 0, {0}, ids, patches);
+    }
+
+}
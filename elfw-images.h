@@ -0,0 +1,147 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "elfw-diffing.h"
+
+namespace elfw {
+
+    // IMAGES
+    // ======
+    //
+    // cmds::Image draws an image by id. The images are decoded (PNG, JPEG, ...
+    // with stb_image from vendor/nanovg/src) by the ImageCache on a pool of its
+    // own threads, never on the frame thread:
+    //
+    // - the first find() of an image queues its decode and returns nullptr, so
+    //   the raster fills the frame with the placeholder. Later calls for an
+    //   image being decoded (or that failed) do not queue it again.
+    // - a finished decode calls `onReady` (on the decode thread, to wake up the
+    //   render loop) and is returned by the next takeReady(). imageRedraws()
+    //   turns these into patches for culling, so the frames showing the image
+    //   are redrawn without a change to the tree.
+    // - the decoded images are kept in an LRU of at most `budgetBytes` pixel
+    //   bytes. An image evicted while still on screen is decoded again, so the
+    //   budget should hold the images of a frame.
+    //
+    // The raster draws with the cache set with images::use(). The surfaces it
+    // caches (RasterCache, LayerCompositor) remember the images they drew as
+    // placeholders and are redrawn once these are decoded.
+
+    namespace images {
+
+        // Reads the encoded bytes of an image (called on a decode thread).
+        // Returns false if there is no such image.
+        using Loader = std::function<bool(draw::ImageId, std::vector<unsigned char>& encoded)>;
+
+        // Loads the image files, the id of an image is its index in `files`
+        Loader fileLoader(std::vector<std::string> files);
+    }
+
+
+    struct ImageCacheOptions {
+        // the most decoded pixel bytes kept (the last decoded image is always kept)
+        std::size_t budgetBytes;
+        std::size_t threads;
+    };
+
+    struct ImageStats {
+        // hits: find() returned the image, misses: it queued a decode,
+        // waits: it found the decode already queued or running
+        std::size_t hits, misses, waits;
+        // finished decodes, images that could not be loaded or decoded, images evicted for the budget
+        std::size_t decoded, failed, evictions;
+        // the pixel bytes in the cache
+        std::size_t bytes;
+    };
+
+
+    // 0xAARRGGBB, row major (the colors are not multiplied by the alpha)
+    struct DecodedImage {
+        int width, height;
+        std::vector<uint32_t> pixels;
+    };
+
+
+    class ImageCache {
+    public:
+        ImageCache(const ImageCacheOptions& options, images::Loader loader, std::function<void()> onReady = {});
+
+        // Stops the decode threads (dropping the queued decodes)
+        ~ImageCache();
+
+        ImageCache(const ImageCache&) = delete;
+        ImageCache& operator=(const ImageCache&) = delete;
+
+        // Returns the decoded image (which stays valid when evicted), or nullptr
+        // after queueing its decode if needed
+        std::shared_ptr<const DecodedImage> find(draw::ImageId id);
+
+        // Checks if the image is decoded and cached, without queueing it
+        bool isDecoded(draw::ImageId id);
+
+        // The images decoded since the last call
+        std::vector<draw::ImageId> takeReady();
+
+        ImageStats getStats();
+
+    private:
+        enum class State { Queued, Ready, Failed };
+
+        struct Entry {
+            State state;
+            std::shared_ptr<const DecodedImage> image;
+            // only for ready images
+            std::list<draw::ImageId>::iterator lru;
+        };
+
+        void decodeLoop();
+
+        void evict();
+
+        ImageCacheOptions options;
+        images::Loader loader;
+        std::function<void()> onReady;
+
+        std::mutex mutex;
+        std::condition_variable queued;
+        std::deque<draw::ImageId> queue;
+        bool stopping = false;
+
+        std::unordered_map<draw::ImageId, Entry> entries;
+        // the ready images, most recently used first
+        std::list<draw::ImageId> lru;
+        std::vector<draw::ImageId> ready;
+        ImageStats stats = {0, 0, 0, 0, 0, 0, 0};
+
+        std::vector<std::thread> threads;
+    };
+
+
+    namespace images {
+
+        // Sets the cache the raster draws images from (nullptr: only the placeholders are drawn)
+        void use(ImageCache* cache);
+
+        ImageCache* current();
+    }
+
+
+    // Appends an UpdateProps patch for every Image command of the tree showing
+    // one of the `ready` images, which cullDrawCommands redraws in place. These
+    // are not edits of the tree: do not pass them to RetainedTree::apply or
+    // encodePatches.
+    void imageRedraws(const ViewTreeWithHashes& tree, const std::vector<draw::ImageId>& ready,
+                      std::vector<CommandPatch>& patches);
+
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace elfw {
+
+    // MESSAGE INBOX
+    // =============
+    //
+    // Lock-free multi-producer single-consumer message queue. Input, timer and
+    // I/O threads post() messages, the frame loop drain()s everything posted
+    // since the last frame in one batch, coalesces redundant messages and
+    // applies the rest before the single view() call of the frame.
+
+    struct InboxStats {
+        // messages posted / messages that survived coalescing and were applied
+        std::size_t received, applied;
+    };
+
+
+    template<typename Msg>
+    class Inbox {
+    public:
+        Inbox() : head(nullptr), received(0), applied(0) {}
+
+        ~Inbox() {
+            freeNodes(head.exchange(nullptr, std::memory_order_acquire));
+        }
+
+        Inbox(const Inbox&) = delete;
+        Inbox& operator=(const Inbox&) = delete;
+
+        // Can be called from any thread
+        void post(Msg msg) {
+            // counted before the node is published (released by the CAS), so a
+            // drain never reports more applied than received messages
+            received.fetch_add(1, std::memory_order_relaxed);
+            auto n = new Node{std::move(msg), head.load(std::memory_order_relaxed)};
+            while (!head.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed)) {}
+        }
+
+
+        // Takes all pending messages (consumer thread only) in posting order.
+        //
+        // `coalesce(Msg& last, const Msg& next)` returns true if `next` was folded
+        // into the last kept message (which it may update), `apply(Msg&)` is called
+        // for every message left after coalescing. Returns the number of applied messages.
+        template<typename Coalesce, typename Apply>
+        std::size_t drain(Coalesce&& coalesce, Apply&& apply) {
+            // the stack is LIFO, so reverse it to get the posting order
+            Node* reversed = nullptr;
+            for (Node* n = head.exchange(nullptr, std::memory_order_acquire); n != nullptr;) {
+                Node* next = n->next;
+                n->next = reversed;
+                reversed = n;
+                n = next;
+            }
+
+            batch.clear();
+            for (Node* n = reversed; n != nullptr; n = n->next) {
+                if (batch.empty() || !coalesce(batch.back(), n->msg)) {
+                    batch.emplace_back(std::move(n->msg));
+                }
+            }
+            freeNodes(reversed);
+
+            for (auto& m : batch) {
+                apply(m);
+            }
+
+            applied.fetch_add(batch.size(), std::memory_order_relaxed);
+            return batch.size();
+        }
+
+        // Drains without coalescing
+        template<typename Apply>
+        std::size_t drain(Apply&& apply) {
+            return drain([](Msg&, const Msg&) { return false; }, apply);
+        }
+
+        InboxStats stats() const {
+            return {received.load(std::memory_order_relaxed), applied.load(std::memory_order_relaxed)};
+        }
+
+    private:
+        struct Node {
+            Msg msg;
+            Node* next;
+        };
+
+        static void freeNodes(Node* n) {
+            while (n != nullptr) {
+                Node* next = n->next;
+                delete n;
+                n = next;
+            }
+        }
+
+        std::atomic<Node*> head;
+        // consumer side scratch buffer, kept between drains
+        std::vector<Msg> batch;
+
+        std::atomic<std::size_t> received, applied;
+    };
+
+}
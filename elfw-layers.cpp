@@ -0,0 +1,29 @@
+#include "elfw-layers.h"
+
+namespace elfw {
+
+    Div layer(Div div) {
+        div.layer = true;
+        return div;
+    }
+
+
+    bool layerMoved(const DivPatch& p) {
+        return p.match(
+                [](const patch::UpdateProps<ResolvedDiv>& u) {
+                    if (!u.b.el->layer) {
+                        return false;
+                    }
+                    if (u.a.el == nullptr) {
+                        return true;
+                    }
+                    return u.a.el->layer && !(u.a.el->layerOrigin == u.b.el->layerOrigin);
+                },
+                [](const patch::Add<ResolvedDiv>&) { return false; },
+                [](const patch::Remove<ResolvedDiv>&) { return false; },
+                [](const patch::Reorder<ResolvedDiv>&) { return false; },
+                [](const patch::Move<ResolvedDiv>&) { return false; }
+        );
+    }
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "elfw-diffing.h"
+
+namespace elfw {
+
+    // LAYERS
+    // ======
+    //
+    // The children of a layer div are hashed relative to the origin of their
+    // rect (ResolvedDiv::layerOrigin) instead of the view, so when a layer only
+    // moves diff reports a single UpdateProps for the layer div (see
+    // layerMoved()) and nothing for its descendants. Their resolved frames still
+    // move: RetainedTree::apply carries the retained children along, and the
+    // LayerCompositor (elfw-raster.h) keeps the pixels of each layer in its own
+    // surface, so a move is a recomposite instead of a repaint.
+    //
+    // As the commands below a moved layer are not patched, the damage of the
+    // move comes from the div patches: cullDrawCommands(tree, patches,
+    // divPatches) damages the old and new bounds of the layer, and the
+    // LayerCompositor recomposites the layer from its surface instead. Layers
+    // inside layers are drawn into the outermost one, and the root cannot be a
+    // layer (diff has nothing to compare it to).
+
+    // Makes the div a layer. Works on lazy placeholders too.
+    Div layer(Div div);
+
+    // Checks if the patch is the move of a layer (the UpdateProps of a layer
+    // whose origin changed). A patch without the old div counts as a move.
+    bool layerMoved(const DivPatch& p);
+
+}
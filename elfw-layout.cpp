@@ -0,0 +1,263 @@
+#include "elfw-layout.h"
+#include "elfw-lazy.h"
+
+#include <algorithm>
+#include <string>
+
+namespace {
+    using namespace elfw;
+    using namespace elfw::layout;
+    using Size = Vec2<double>;
+
+    const Div& contents(const Div& div) {
+        return div.lazy ? div.lazy->source : div;
+    }
+
+    // The container properties come from the contents, the item properties from
+    // the div itself if set (a sized lazy placeholder)
+    const Layout* containerLayout(const Div& div) {
+        const Layout* l = contents(div).layout.get();
+        return l != nullptr && l->direction != Direction::None ? l : nullptr;
+    }
+
+    const Layout* itemLayout(const Div& div) {
+        return div.layout ? div.layout.get() : contents(div).layout.get();
+    }
+
+    double grow(const Div& div) {
+        const Layout* l = itemLayout(div);
+        return l != nullptr ? (double) l->grow : 1.0;
+    }
+
+
+    // Main and cross axis access
+    double& at(Size& s, int axis) { return axis == 0 ? s.x : s.y; }
+    double at(const Size& s, int axis) { return axis == 0 ? s.x : s.y; }
+
+
+    struct line {
+        size_t begin, end;
+        double main, cross;
+    };
+
+    // Breaks the children into lines along the main axis (a single line without wrap)
+    std::vector<line> breakLines(const Layout& l, const std::vector<Size>& sizes, double available, int a) {
+        const int b = 1 - a;
+        const double gap = (double) l.gap;
+
+        std::vector<line> lines;
+        line current = {0, 0, 0, 0};
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            const double m = at(sizes[i], a);
+            if (l.wrap && current.end > current.begin && current.main + gap + m > available) {
+                lines.push_back(current);
+                current = {i, i, 0, 0};
+            }
+            current.main += (current.end > current.begin ? gap : 0) + m;
+            current.cross = std::max(current.cross, at(sizes[i], b));
+            current.end = i + 1;
+        }
+        if (current.end > current.begin) {
+            lines.push_back(current);
+        }
+        return lines;
+    }
+
+
+    Size measure(const Div& div, Size available);
+
+    std::vector<Size> measureChildren(const Div& container, Size inner) {
+        std::vector<Size> sizes;
+        sizes.reserve(container.childDivs.size());
+        for (const auto& child : container.childDivs) {
+            sizes.push_back(measure(child, inner));
+        }
+        return sizes;
+    }
+
+    Size innerSize(const Layout& l, Size s) {
+        const double p = 2 * (double) l.padding;
+        return {std::max(0.0, s.x - p), std::max(0.0, s.y - p)};
+    }
+
+
+    Size measureContainer(const Div& container, const Layout& l, Size available) {
+        const int a = l.direction == Direction::Row ? 0 : 1, b = 1 - a;
+        const Size inner = innerSize(l, available);
+        const auto lines = breakLines(l, measureChildren(container, inner), at(inner, a), a);
+
+        Size r = {0, 0};
+        for (size_t i = 0; i < lines.size(); ++i) {
+            at(r, a) = std::max(at(r, a), lines[i].main);
+            at(r, b) += (i > 0 ? (double) l.gap : 0) + lines[i].cross;
+        }
+        r.x += 2 * (double) l.padding;
+        r.y += 2 * (double) l.padding;
+        return r;
+    }
+
+
+    // The intrinsic size of a div inside a container with `available` space
+    Size measure(const Div& div, Size available) {
+        const Layout* item = itemLayout(div);
+        const Layout* container = containerLayout(div);
+
+        Size s = {0, 0};
+        if (item != nullptr) {
+            s = {(double) item->size.x, (double) item->size.y};
+        }
+        if (container == nullptr || (s.x > 0 && s.y > 0)) {
+            return s;
+        }
+
+        Size m;
+        if (div.lazy && container->cache != nullptr) {
+            // lazy subtrees are measured once for the same arguments and constraints
+            auto& cache = *container->cache;
+            const Hash subtree = combineHashes(div.lazy->argsHash, std::hash<std::string>()(div.key));
+            if (const Size* cached = cache.find(subtree, available)) {
+                m = *cached;
+            } else {
+                m = measureContainer(contents(div), *container, available);
+                cache.store(subtree, available, m);
+            }
+        } else {
+            m = measureContainer(contents(div), *container, available);
+        }
+
+        if (s.x <= 0) s.x = m.x;
+        if (s.y <= 0) s.y = m.y;
+        return s;
+    }
+
+
+    Hash constraintsKey(Hash subtree, Size constraints) {
+        return combineHashes(combineHashes(subtree, std::hash<double>()(constraints.x)),
+                             std::hash<double>()(constraints.y));
+    }
+}
+
+
+namespace elfw {
+
+    Div stack(LayoutCache& cache, const char* key, const Frame<Scalar>& frame, const Stack& s,
+              std::vector<Div> children, std::vector<draw::Command> drawCommands) {
+        auto l = std::make_shared<const Layout>(Layout{
+                s.direction, s.wrap, s.gap, s.padding, s.align, &cache, {0, 0}, 0
+        });
+        return Div{key, frame, std::move(children), {drawCommands.begin(), drawCommands.end()}, nullptr, nullptr, l};
+    }
+
+
+    Div sized(Div div, Vec2<Scalar> size, Scalar grow) {
+        Layout l = div.layout ? *div.layout : Layout{Direction::None, false, 0, 0, Align::Start, nullptr, {0, 0}, 0};
+        l.size = size;
+        l.grow = grow;
+        return Div{div.key, div.frame, std::move(div.childDivs), std::move(div.drawCommands), std::move(div.lazy),
+                   std::move(div.virtualList), std::make_shared<const Layout>(l), div.layer};
+    }
+
+
+    // Layout cache
+    // ============
+
+    const Vec2<double>* LayoutCache::find(Hash subtree, Vec2<double> constraints) {
+        auto it = entries.find(constraintsKey(subtree, constraints));
+        if (it == entries.end()) {
+            ++stats.misses;
+            return nullptr;
+        }
+        ++stats.hits;
+        it->second.used = true;
+        return &it->second.size;
+    }
+
+
+    void LayoutCache::store(Hash subtree, Vec2<double> constraints, Vec2<double> size) {
+        entries[constraintsKey(subtree, constraints)] = Entry{size, true};
+    }
+
+
+    void LayoutCache::nextFrame() {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (!it->second.used) {
+                it = entries.erase(it);
+                continue;
+            }
+            it->second.used = false;
+            ++it;
+        }
+    }
+
+
+    namespace layout {
+
+        bool effective(const Div& div, Layout& out) {
+            const Layout* item = itemLayout(div);
+            const Layout* own = contents(div).layout.get();
+            if (item == nullptr) {
+                return false;
+            }
+            out = own != nullptr ? *own : *item;
+            out.size = item->size;
+            out.grow = item->grow;
+            return true;
+        }
+
+
+        void place(const Div& container, const Rect<Scalar>& rect, std::vector<Rect<Scalar>>& out) {
+            const Div& c = contents(container);
+            const Layout* l = containerLayout(container);
+            assert(l != nullptr);
+
+            const int a = l->direction == Direction::Row ? 0 : 1, b = 1 - a;
+            const double padding = (double) l->padding, gap = (double) l->gap;
+            const Size origin = {(double) rect.pos.x + padding, (double) rect.pos.y + padding};
+            const Size inner = innerSize(*l, {(double) rect.size.x, (double) rect.size.y});
+
+            const auto sizes = measureChildren(c, inner);
+            const auto lines = breakLines(*l, sizes, at(inner, a), a);
+
+            out.clear();
+            out.reserve(sizes.size());
+
+            double crossPos = at(origin, b);
+            for (const auto& ln : lines) {
+                // a single line fills the container, wrapped ones are as thick as their children
+                const double lineCross = l->wrap ? ln.cross : at(inner, b);
+
+                double growSum = 0;
+                for (size_t i = ln.begin; i < ln.end; ++i) {
+                    growSum += grow(c.childDivs[i]);
+                }
+                const double free = std::max(0.0, at(inner, a) - ln.main);
+
+                double mainPos = at(origin, a);
+                for (size_t i = ln.begin; i < ln.end; ++i) {
+                    const double main = at(sizes[i], a) + (growSum > 0 ? free * grow(c.childDivs[i]) / growSum : 0);
+
+                    double cross = at(sizes[i], b), offset = 0;
+                    if (l->align == Align::Stretch || cross <= 0) {
+                        cross = lineCross;
+                    } else if (l->align == Align::Center) {
+                        offset = (lineCross - cross) / 2;
+                    } else if (l->align == Align::End) {
+                        offset = lineCross - cross;
+                    }
+
+                    Size pos, size;
+                    at(pos, a) = mainPos;
+                    at(pos, b) = crossPos + offset;
+                    at(size, a) = main;
+                    at(size, b) = cross;
+                    out.push_back(rect::make<Scalar>(Scalar(pos.x), Scalar(pos.y), Scalar(size.x), Scalar(size.y)));
+
+                    mainPos += main + gap;
+                }
+                crossPos += lineCross + gap;
+            }
+        }
+
+    }
+
+}
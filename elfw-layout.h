@@ -0,0 +1,112 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "elfw-viewtree.h"
+#include "elfw-hashing.h"
+
+namespace elfw {
+
+    // LAYOUT
+    // ======
+    //
+    // Stack containers place their children one after the other (in a row or a
+    // column, optionally wrapping into more lines) from the intrinsic sizes of
+    // the children, so view() does not have to compute the positions by hand.
+    //
+    // The layout runs as part of resolveDiv, when the rect of a container is
+    // known: every child is measured, then gets its slot as its rect (its
+    // commands draw in the slot, its frame places its children in the slot as
+    // usual). Divs without layout are measured as zero sized and grow.
+    //
+    // Measuring a container measures its children recursively. The sizes of
+    // lazy subtrees are kept in a LayoutCache keyed by (hash of the lazy
+    // arguments, constraints), so unchanged lazy subtrees are not measured
+    // again: after a change, only the containers on the path to it are.
+
+    class LayoutCache;
+
+    namespace layout {
+        enum class Direction { None, Row, Column };
+        enum class Align { Start, Center, End, Stretch };
+    }
+
+
+    struct Layout {
+        // Container properties (Direction::None for items only)
+        layout::Direction direction;
+        // continue on a new line (or column) when the children do not fit
+        bool wrap;
+        Scalar gap, padding;
+        // placement on the cross axis inside a line
+        layout::Align align;
+        // where lazy children are measured
+        LayoutCache* cache;
+
+        // Item properties: the intrinsic size (a 0 component is measured for
+        // containers and stretched on the cross axis otherwise) and the share of
+        // the free space on the main axis of the parent
+        Vec2<Scalar> size;
+        Scalar grow;
+    };
+
+
+    struct Stack {
+        layout::Direction direction;
+        Scalar gap, padding;
+        layout::Align align;
+        bool wrap;
+    };
+
+
+    // A stack container
+    Div stack(LayoutCache& cache, const char* key, const Frame<Scalar>& frame, const Stack& s,
+              std::vector<Div> children, std::vector<draw::Command> drawCommands = {});
+
+    // Gives a div an intrinsic size (and grow factor) inside a stack. Works on
+    // lazy placeholders and containers too.
+    Div sized(Div div, Vec2<Scalar> size, Scalar grow = 0);
+
+
+    struct LayoutStats {
+        // hits: a lazy subtree was not measured again, misses: it had to be
+        std::size_t hits, misses;
+    };
+
+
+    class LayoutCache {
+    public:
+        // Returns the measured size of the subtree or nullptr, marking it as used
+        const Vec2<double>* find(Hash subtree, Vec2<double> constraints);
+
+        void store(Hash subtree, Vec2<double> constraints, Vec2<double> size);
+
+        // Drops the sizes not used since the last call (call once per frame)
+        void nextFrame();
+
+        const LayoutStats& getStats() const { return stats; }
+
+    private:
+        struct Entry {
+            Vec2<double> size;
+            bool used;
+        };
+
+        std::unordered_map<Hash, Entry> entries;
+        LayoutStats stats = {0, 0};
+    };
+
+
+    namespace layout {
+
+        // The rects of the children of a container covering `rect` (called by resolveDiv)
+        void place(const Div& container, const Rect<Scalar>& rect, std::vector<Rect<Scalar>>& out);
+
+        // The layout of a div as the layout pass sees it (a sized lazy placeholder
+        // merged with its contents). Returns false if the div has none.
+        bool effective(const Div& div, Layout& out);
+    }
+
+}
@@ -0,0 +1,28 @@
+#include "elfw-lazy.h"
+
+namespace elfw {
+
+    std::shared_ptr<LazyNode>& LazyCache::node(const char* key, bool& isNew) {
+        auto it = entries.find(key);
+        isNew = (it == entries.end());
+        if (isNew) {
+            it = entries.emplace(key, Entry{nullptr, true}).first;
+        }
+
+        it->second.used = true;
+        return it->second.node;
+    }
+
+
+    void LazyCache::nextFrame() {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (!it->second.used) {
+                it = entries.erase(it);
+                continue;
+            }
+            it->second.used = false;
+            ++it;
+        }
+    }
+
+}
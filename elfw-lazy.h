@@ -0,0 +1,111 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "elfw-viewtree.h"
+#include "elfw-hashing.h"
+#include "elfw-viewtree-resolve.h"
+
+namespace elfw {
+
+    // LAZY VIEW NODES
+    // ===============
+    //
+    // Like Html.lazy in Elm: lazy(cache, key, fn, args...) only calls fn(args...)
+    // if the hash of the arguments changed since the last frame. Otherwise the
+    // Div from the last call is kept, and if the subtree is resolved into the
+    // same rect, resolveDiv splices the last frame's resolved divs, commands and
+    // hashes into the tree instead of resolving and hashing them again.
+    //
+    // A subtree resolved into a rect of the same size somewhere else (a row of a
+    // scrolled list for example) is spliced moved by the difference instead of
+    // resolved again, only its hashes are recalculated. Subtrees with virtual
+    // lists are only spliced into the same rect and viewport, as their rows
+    // depend on the viewport.
+
+
+    // The memoized state of a single lazy call site
+    struct LazyNode {
+        Hash argsHash;
+
+        // The Div returned by the view function
+        Div source;
+
+        // The resolved subtree from the last frame. The root is divs[0] (its
+        // hashes are not stored, it is always re-hashed by the parent), the
+        // descendants and all commands use indices local to this tree.
+        bool resolved;
+        Rect<Scalar> viewRect;
+        ViewTreeWithHashes tree;
+        // the subtree can be spliced into another rect of the same size
+        bool movable;
+        // the viewRect of the whole tree it was resolved in (the subtrees with
+        // virtual lists are not movable and need the same viewport)
+        Rect<Scalar> viewport;
+    };
+
+
+    struct LazyStats {
+        // hits: the view function was skipped, misses: it had to be called
+        std::size_t hits, misses;
+    };
+
+
+    class LazyCache {
+    public:
+        // Returns the node for the key, marking it as used in this frame.
+        // `isNew` is set if the node did not exist before.
+        std::shared_ptr<LazyNode>& node(const char* key, bool& isNew);
+
+        // Drops the nodes not used since the last call (call once per frame)
+        void nextFrame();
+
+        void countHit(bool hit) { if (hit) ++stats.hits; else ++stats.misses; }
+
+        const LazyStats& getStats() const { return stats; }
+
+    private:
+        struct Entry {
+            std::shared_ptr<LazyNode> node;
+            bool used;
+        };
+
+        std::unordered_map<std::string, Entry> entries;
+        LazyStats stats = {0, 0};
+    };
+
+
+    namespace lazy_detail {
+        inline Hash hashArgs(Hash seed) { return seed; }
+
+        template<typename T, typename... Rest>
+        inline Hash hashArgs(Hash seed, const T& v, const Rest& ... rest) {
+            return hashArgs(combineHashes(seed, std::hash<T>()(v)), rest...);
+        }
+    }
+
+
+    // Creates a lazy Div. `key` has to be unique for the call site and is also used
+    // as the key of the resulting Div. The arguments need std::hash specializations.
+    template<typename Fn, typename... Args>
+    Div lazy(LazyCache& cache, const char* key, Fn&& fn, const Args& ... args) {
+        const Hash argsHash = lazy_detail::hashArgs(sizeof...(Args), args...);
+
+        bool isNew = false;
+        auto& node = cache.node(key, isNew);
+
+        const bool hit = !isNew && node->argsHash == argsHash;
+        cache.countHit(hit);
+
+        if (!hit) {
+            node = std::make_shared<LazyNode>(LazyNode{argsHash, fn(args...), false, rect::none<Scalar>, {}, false,
+                                                               rect::none<Scalar>});
+        }
+
+        // the placeholder only carries the frame, the resolver uses the node
+        return Div{key, node->source.frame, {}, {}, node};
+    }
+
+}
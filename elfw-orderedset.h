@@ -23,7 +23,7 @@ namespace elfw {
                 // Store the indices for the hashes
                 size_t i = 0;
                 for (const auto& e : src) {
-                    hashToIndex.insert({e, i});
+                    insert(e, i);
                     ++i;
                 }
             }
@@ -32,8 +32,7 @@ namespace elfw {
             OrderedSet(const Seq& src) {
                 // Store the indices for the hashes
                 for (size_t i = 0; i < src.size(); ++i) {
-                    const auto hsh = std::hash<typename Seq::value_type>()(src[i]);
-                    hashToIndex.insert({hsh, i});
+                    insert(std::hash<typename Seq::value_type>()(src[i]), i);
                 }
             }
 
@@ -41,7 +40,7 @@ namespace elfw {
             OrderedSet(const Seq& src, HashConverter&& converter) {
                 // Store the indices for the hashes
                 for (size_t i = 0; i < src.size(); ++i) {
-                    hashToIndex.insert({converter(src[i]), i});
+                    insert(converter(src[i]), i);
                 }
             }
 
@@ -60,8 +59,19 @@ namespace elfw {
             const std::map<std::size_t, std::size_t>& hashes() const { return hashToIndex; };
 
         private:
+            // A hash seen before is keyed by the hash and the number of times it was
+            // seen, so equal elements (two separators around a box) are paired up in
+            // order instead of all but the first getting lost
+            void insert(const size_t hsh, const size_t idx) {
+                if (hashToIndex.insert({hsh, idx}).second) return;
+                const size_t n = ++repeats[hsh];
+                hashToIndex.insert({hsh ^ (n + 0x9e3779b9 + (hsh << 6) + (hsh >> 2)), idx});
+            }
+
             // the source collection
             std::map<std::size_t, std::size_t> hashToIndex;
+            // the times each hash was seen again
+            std::map<std::size_t, std::size_t> repeats;
 
         };
 
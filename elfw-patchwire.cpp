@@ -0,0 +1,452 @@
+#include "elfw-patchwire.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    using namespace elfw;
+    using namespace elfw::patchwire;
+
+    template<typename T>
+    void put(std::vector<char>& out, const T& v) {
+        const auto* p = reinterpret_cast<const char*>(&v);
+        out.insert(out.end(), p, p + sizeof(T));
+    }
+
+    void putBytes(std::vector<char>& out, const char* bytes, size_t size) {
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    void putPath(std::vector<char>& out, const patch::DivPath& path) {
+        put(out, (uint16_t) path.size());
+        for (const auto i : path) {
+            put(out, (int32_t) i);
+        }
+    }
+
+    void putHeader(std::vector<char>& out, Kind kind, const patch::DivPath& path) {
+        put(out, (uint8_t) kind);
+        putPath(out, path);
+    }
+
+    Props propsOf(const ResolvedDiv& d) {
+        Props p;
+        memset(&p, 0, sizeof(p));
+        p.frame = d.frame;
+        p.layerOrigin = d.layerOrigin;
+        p.layer = d.layer ? 1 : 0;
+        return p;
+    }
+
+    ResolvedDiv fromProps(const char* key, const Props& p) {
+        return ResolvedDiv{key, p.frame, {}, {}, p.layer != 0, p.layerOrigin};
+    }
+
+
+    // A Text is followed by its string and a Path by its segments, as [size:uint32][bytes]
+    void putCommand(std::vector<char>& out, const draw::ResolvedCommand& c) {
+        std::vector<char> data;
+        const auto op = snapshot::toRecord(c.cmd, data);
+        put(out, snapshot::Command{c.frame, op});
+        if (op.op == snapshot::Text) {
+            put(out, (uint32_t) (data.size() - 1));
+            putBytes(out, data.data(), data.size() - 1);
+        } else if (op.op == snapshot::Path) {
+            put(out, (uint32_t) data.size());
+            putBytes(out, data.data(), data.size());
+        }
+    }
+
+    // Breadth first, so the decoder can lay the children out next to each other
+    void putSubtree(std::vector<char>& out, const ViewTreeWithHashes& tree, const ResolvedDiv& root) {
+        std::vector<const ResolvedDiv*> nodes = {&root};
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const auto& d = *nodes[i];
+            const size_t keyBytes = strlen(d.key);
+
+            // zeroed, so the padding after the counts is not sent
+            patchwire::Div w;
+            memset(&w, 0, sizeof(w));
+            w.props = propsOf(d);
+            w.keyBytes = (uint32_t) keyBytes;
+            w.childCount = (uint32_t) d.children.size();
+            w.commandCount = (uint32_t) d.drawCommands.size();
+            put(out, w);
+            putBytes(out, d.key, keyBytes);
+
+            for (size_t c = d.drawCommands.start; c < d.drawCommands.start + d.drawCommands.size(); ++c) {
+                putCommand(out, tree.drawCommands[c]);
+            }
+            for (size_t c = d.children.start; c < d.children.start + d.children.size(); ++c) {
+                nodes.push_back(&tree.divs[c]);
+            }
+        }
+    }
+
+
+    void putPatch(std::vector<char>& out, const ViewTreeWithHashes&, const CommandPatch& p) {
+        using draw::ResolvedCommand;
+        p.match(
+                [&](const patch::Add<ResolvedCommand>& a) {
+                    putHeader(out, AddCommand, a.b.path);
+                    put(out, (uint32_t) a.b.idx);
+                    putCommand(out, *a.b.el);
+                },
+                [&](const patch::Remove<ResolvedCommand>& r) {
+                    putHeader(out, RemoveCommand, r.a.path);
+                    put(out, (uint32_t) r.a.idx);
+                },
+                [&](const patch::Reorder<ResolvedCommand>& r) {
+                    putHeader(out, ReorderCommand, r.a.path);
+                    put(out, (uint32_t) r.a.idx);
+                    put(out, (uint32_t) r.b.idx);
+                },
+                [&](const patch::Move<ResolvedCommand>& m) {
+                    putHeader(out, MoveCommand, m.a.path);
+                    put(out, (uint32_t) m.a.idx);
+                    put(out, (uint32_t) m.b.idx);
+                    put(out, *m.b.frame);
+                },
+                // changed commands are removed and added by diff
+                [&](const patch::UpdateProps<ResolvedCommand>&) { assert(false); }
+        );
+    }
+
+    void putPatch(std::vector<char>& out, const ViewTreeWithHashes& target, const DivPatch& p) {
+        p.match(
+                [&](const patch::Add<ResolvedDiv>& a) {
+                    putHeader(out, AddDiv, a.b.path);
+                    put(out, (uint32_t) a.b.idx);
+                    putSubtree(out, target, *a.b.el);
+                },
+                [&](const patch::Remove<ResolvedDiv>& r) {
+                    putHeader(out, RemoveDiv, r.a.path);
+                    put(out, (uint32_t) r.a.idx);
+                },
+                [&](const patch::Reorder<ResolvedDiv>& r) {
+                    putHeader(out, ReorderDiv, r.a.path);
+                    put(out, (uint32_t) r.a.idx);
+                    put(out, (uint32_t) r.b.idx);
+                },
+                // the old props and the path in the target too, for the damage of moved layers
+                [&](const patch::UpdateProps<ResolvedDiv>& u) {
+                    putHeader(out, UpdateDivProps, u.a.path);
+                    putPath(out, u.b.path);
+                    put(out, propsOf(*u.a.el));
+                    put(out, propsOf(*u.b.el));
+                },
+                // diff only moves commands
+                [&](const patch::Move<ResolvedDiv>&) { assert(false); }
+        );
+    }
+
+
+    // Reads packed records, `ok` turns false once reading past the end
+    struct reader {
+        const char* pos;
+        const char* end;
+        bool ok;
+
+        template<typename T>
+        T get() {
+            T v{};
+            if (sizeof(T) > (size_t) (end - pos)) {
+                ok = false;
+                return v;
+            }
+            memcpy(&v, pos, sizeof(T));
+            pos += sizeof(T);
+            return v;
+        }
+
+        const char* bytes(size_t size) {
+            if (size > (size_t) (end - pos)) {
+                ok = false;
+                return pos;
+            }
+            const char* p = pos;
+            pos += size;
+            return p;
+        }
+    };
+
+
+    struct decoded_patch {
+        Kind kind;
+        // pathB is only sent for UpdateDivProps
+        patch::DivPath path, pathB;
+        size_t idxA, idxB;
+        // the added command or div (or the divs with the old and new props, or
+        // the new frame of a moved command in movedFrames) in the payload
+        size_t payload;
+    };
+
+    bool isCommandKind(Kind k) {
+        return k == AddCommand || k == RemoveCommand || k == ReorderCommand || k == MoveCommand;
+    }
+
+    template<typename T>
+    patch::Base<T> indexOnly(const patch::DivPath& path, size_t idx) { return {path, nullptr, nullptr, idx}; }
+
+
+    // The interned strings a command points to (only texts do)
+    void markStrings(const draw::ResolvedCommand& c, std::unordered_set<const char*>& live) {
+        c.cmd.match(
+                [&](const draw::cmds::Text& t) { live.insert(t.text); },
+                [](const draw::cmds::Rectangle&) {},
+                [](const draw::cmds::RoundedRectangle&) {},
+                [](const draw::cmds::Ellipse&) {},
+                [](const draw::cmds::Image&) {},
+                [](const draw::cmds::Path&) {}
+        );
+    }
+
+    void markStrings(const RetainedDiv& div, std::unordered_set<const char*>& live) {
+        live.insert(div.key);
+        for (const auto& c : div.commands) {
+            markStrings(c, live);
+        }
+        for (const auto& c : div.children) {
+            markStrings(*c, live);
+        }
+    }
+}
+
+
+namespace elfw {
+
+    void encodePatches(const ViewTreeWithHashes& target,
+                       const std::vector<CommandPatch>& patches,
+                       const std::vector<DivPatch>& divPatches,
+                       std::vector<char>& out) {
+        const auto& root = target.divs[0];
+        const size_t rootKeyBytes = strlen(root.key);
+
+        FrameHeader h;
+        memset(&h, 0, sizeof(h));
+        h.magic = patchwire::magic;
+        h.scalarKind = (uint32_t) scalarKind;
+        h.scalarSize = sizeof(Scalar);
+        h.commandPatchCount = (uint32_t) patches.size();
+        h.divPatchCount = (uint32_t) divPatches.size();
+        h.rootKeyBytes = (uint32_t) rootKeyBytes;
+        h.rootHash = target.hashStore.divRecursive[0];
+        h.rootFrame = root.frame;
+
+        put(out, h);
+        putBytes(out, root.key, rootKeyBytes);
+        for (const auto& p : patches) {
+            putPatch(out, target, p);
+        }
+        for (const auto& p : divPatches) {
+            putPatch(out, target, p);
+        }
+    }
+
+
+    const char* PatchDecoder::intern(const char* key, size_t size) {
+        return keys.emplace(key, size).first->c_str();
+    }
+
+
+    void PatchDecoder::releaseKeys(const RetainedTree& tree) {
+        if (keys.size() < std::max<size_t>(2 * keptKeys, 1024)) {
+            return;
+        }
+
+        std::unordered_set<const char*> live;
+        markStrings(tree.root(), live);
+        for (const auto& d : payload.divs) {
+            live.insert(d.key);
+        }
+        for (const auto& c : payload.drawCommands) {
+            markStrings(c, live);
+        }
+
+        // the strings are in the nodes of the set, erasing does not move the others
+        for (auto it = keys.begin(); it != keys.end();) {
+            it = live.count(it->c_str()) > 0 ? std::next(it) : keys.erase(it);
+        }
+        keptKeys = keys.size();
+    }
+
+
+    PatchDecoder::Result PatchDecoder::decode(const char* bytes, size_t size) {
+        payload.divs.clear();
+        payload.drawCommands.clear();
+        commandPatches.clear();
+        decodedDivPatches.clear();
+        movedFrames.clear();
+
+        reader r = {bytes, bytes + size, true};
+        const auto h = r.get<FrameHeader>();
+        if (!r.ok || h.magic != patchwire::magic) {
+            return NotAFrame;
+        }
+        if (h.scalarKind != (uint32_t) scalarKind || h.scalarSize != sizeof(Scalar)) {
+            return WrongScalar;
+        }
+
+        const char* rootKey = r.bytes(h.rootKeyBytes);
+        if (!r.ok) {
+            return Truncated;
+        }
+        payload.divs.push_back(ResolvedDiv{intern(rootKey, h.rootKeyBytes), h.rootFrame, {}, {}});
+        payload.hashStore.divRecursive.assign(1, (Hash) h.rootHash);
+
+        auto readCommand = [&]() {
+            auto c = r.get<snapshot::Command>();
+            const char* text = "";
+            if (r.ok && c.op.op == snapshot::Text) {
+                const auto textBytes = r.get<uint32_t>();
+                const char* bytes = r.bytes(textBytes);
+                text = r.ok ? intern(bytes, textBytes) : "";
+                c.op.dataOffset = 0;
+            } else if (r.ok && c.op.op == snapshot::Path) {
+                // the segments are copied out of the frame by fromRecord
+                const auto segmentBytes = r.get<uint32_t>();
+                const char* bytes = r.bytes(segmentBytes);
+                if (!r.ok || c.op.resource > segmentBytes / sizeof(snapshot::PathSegment)) {
+                    r.ok = false;
+                    c.op.resource = 0;
+                }
+                text = r.ok ? bytes : "";
+                c.op.dataOffset = 0;
+            }
+            payload.drawCommands.push_back(draw::ResolvedCommand{c.frame, snapshot::fromRecord(c.op, text)});
+        };
+
+        // the children of each div follow the divs before them (breadth first)
+        auto readSubtree = [&]() {
+            size_t pending = 1, nextChild = payload.divs.size() + 1;
+            while (pending > 0 && r.ok) {
+                const auto d = r.get<patchwire::Div>();
+                const char* key = r.bytes(d.keyBytes);
+                if (!r.ok) {
+                    return;
+                }
+
+                ResolvedDiv div = fromProps(intern(key, d.keyBytes), d.props);
+                const size_t cmdStart = payload.drawCommands.size();
+                for (uint32_t i = 0; i < d.commandCount && r.ok; ++i) {
+                    readCommand();
+                }
+                div.drawCommands = {cmdStart, payload.drawCommands.size()};
+                div.children = {nextChild, nextChild + d.childCount};
+                nextChild += d.childCount;
+
+                payload.divs.push_back(div);
+                pending = pending - 1 + d.childCount;
+            }
+        };
+
+        // paths start at the root (RetainedTree::apply checks the rest)
+        auto readPath = [&](patch::DivPath& path) {
+            const auto depth = r.get<uint16_t>();
+            for (uint16_t d = 0; d < depth && r.ok; ++d) {
+                path.push_back((int) r.get<int32_t>());
+            }
+            return !r.ok || (!path.empty() && path[0] == 0 &&
+                             std::all_of(path.begin(), path.end(), [](int i) { return i >= 0; }));
+        };
+
+        // decode everything first, as the patches point into the payload (every
+        // patch takes at least its kind and path length)
+        const size_t patchCount = (size_t) h.commandPatchCount + h.divPatchCount;
+        if (patchCount > (size_t) (r.end - r.pos) / (sizeof(uint8_t) + sizeof(uint16_t))) {
+            return Truncated;
+        }
+        std::vector<decoded_patch> decoded(patchCount);
+        for (size_t i = 0; i < patchCount && r.ok; ++i) {
+            auto& p = decoded[i];
+            p.kind = (Kind) r.get<uint8_t>();
+            if (p.kind > MoveCommand || isCommandKind(p.kind) != (i < h.commandPatchCount)) {
+                return NotAFrame;
+            }
+
+            if (!readPath(p.path)) {
+                return NotAFrame;
+            }
+
+            switch (p.kind) {
+                case AddCommand:
+                    p.idxB = r.get<uint32_t>();
+                    p.payload = payload.drawCommands.size();
+                    readCommand();
+                    break;
+                case AddDiv:
+                    p.idxB = r.get<uint32_t>();
+                    p.payload = payload.divs.size();
+                    readSubtree();
+                    break;
+                case RemoveCommand:
+                case RemoveDiv:
+                    p.idxA = r.get<uint32_t>();
+                    break;
+                case ReorderCommand:
+                case ReorderDiv:
+                    p.idxA = r.get<uint32_t>();
+                    p.idxB = r.get<uint32_t>();
+                    break;
+                case UpdateDivProps:
+                    if (!readPath(p.pathB)) {
+                        return NotAFrame;
+                    }
+                    p.payload = payload.divs.size();
+                    payload.divs.push_back(fromProps("", r.get<Props>()));
+                    payload.divs.push_back(fromProps("", r.get<Props>()));
+                    break;
+                case MoveCommand:
+                    p.idxA = r.get<uint32_t>();
+                    p.idxB = r.get<uint32_t>();
+                    p.payload = movedFrames.size();
+                    movedFrames.push_back(r.get<Rect<Scalar>>());
+                    break;
+            }
+        }
+        if (!r.ok) {
+            return Truncated;
+        }
+
+        using draw::ResolvedCommand;
+        for (const auto& p : decoded) {
+            switch (p.kind) {
+                case AddCommand:
+                    commandPatches.emplace_back(patch::Add<ResolvedCommand>{
+                            patch::base(p.path, p.idxB, payload.drawCommands[p.payload])});
+                    break;
+                case RemoveCommand:
+                    commandPatches.emplace_back(patch::Remove<ResolvedCommand>{indexOnly<ResolvedCommand>(p.path, p.idxA)});
+                    break;
+                case ReorderCommand:
+                    commandPatches.emplace_back(patch::Reorder<ResolvedCommand>{
+                            indexOnly<ResolvedCommand>(p.path, p.idxA), indexOnly<ResolvedCommand>(p.path, p.idxB)});
+                    break;
+                case AddDiv:
+                    decodedDivPatches.emplace_back(patch::Add<ResolvedDiv>{
+                            patch::base(p.path, p.idxB, payload.divs[p.payload])});
+                    break;
+                case RemoveDiv:
+                    decodedDivPatches.emplace_back(patch::Remove<ResolvedDiv>{indexOnly<ResolvedDiv>(p.path, p.idxA)});
+                    break;
+                case ReorderDiv:
+                    decodedDivPatches.emplace_back(patch::Reorder<ResolvedDiv>{
+                            indexOnly<ResolvedDiv>(p.path, p.idxA), indexOnly<ResolvedDiv>(p.path, p.idxB)});
+                    break;
+                case UpdateDivProps:
+                    decodedDivPatches.emplace_back(patch::UpdateProps<ResolvedDiv>{
+                            patch::base(p.path, 0, payload.divs[p.payload]),
+                            patch::base(p.pathB, 0, payload.divs[p.payload + 1])});
+                    break;
+                case MoveCommand:
+                    commandPatches.emplace_back(patch::Move<ResolvedCommand>{
+                            indexOnly<ResolvedCommand>(p.path, p.idxA),
+                            patch::Base<ResolvedCommand>{p.path, nullptr, &movedFrames[p.payload], p.idxB}});
+                    break;
+            }
+        }
+
+        return Ok;
+    }
+
+}
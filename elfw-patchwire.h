@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "elfw-diffing.h"
+#include "elfw-retained.h"
+#include "elfw-snapshot.h"
+
+namespace elfw {
+
+    // PATCH WIRE FORMAT
+    // =================
+    //
+    // A binary encoding of the patches of a frame, so a RetainedTree can be kept
+    // in another process (see elfw-shmring.h for the transport):
+    //
+    // [FrameHeader][root key][command patches][div patches]
+    //
+    // Every patch is [kind:uint8][path length:uint16][path:int32 x length] then
+    // its indices and payload. Only what RetainedTree::apply needs is sent: the
+    // old indices and paths, the new index of Add / Reorder / Move, the new
+    // path and the old and new Props of UpdateProps (the damage of a moved
+    // layer needs both), the new frame of Move, and the added commands or
+    // subtrees (breadth first, as [Div][key][commands] records). The records
+    // are packed and not aligned. A Text command is followed by its string, a
+    // Path command by its segments.
+
+    namespace patchwire {
+
+        static const uint32_t magic = 0x57504c45; // "ELPW"
+
+        enum Kind : uint8_t {
+            AddCommand, RemoveCommand, ReorderCommand,
+            AddDiv, RemoveDiv, ReorderDiv, UpdateDivProps,
+            MoveCommand
+        };
+
+        struct FrameHeader {
+            uint32_t magic;
+            // ScalarKind and sizeof(Scalar) of the writer
+            uint32_t scalarKind, scalarSize;
+            uint32_t commandPatchCount, divPatchCount;
+            uint32_t rootKeyBytes;
+            // the recursive hash of the target tree, to verify the mirror
+            uint64_t rootHash;
+            Rect<Scalar> rootFrame;
+        };
+
+        // The props of a div (sent for UpdateProps and added divs)
+        struct Props {
+            Rect<Scalar> frame;
+            Vec2<Scalar> layerOrigin;
+            uint32_t layer;
+        };
+
+        struct Div {
+            Props props;
+            uint32_t keyBytes, childCount, commandCount;
+        };
+    }
+
+
+    // Appends the patches of diff(a, target) to `out`
+    void encodePatches(const ViewTreeWithHashes& target,
+                       const std::vector<CommandPatch>& patches,
+                       const std::vector<DivPatch>& divPatches,
+                       std::vector<char>& out);
+
+
+    // Turns encoded frames back into patches for RetainedTree::apply:
+    //
+    //      decoder.decode(bytes, size);
+    //      tree.apply(decoder.target(), decoder.patches(), decoder.divPatches());
+    //      decoder.releaseKeys(tree);
+    //
+    // target() is not a full tree: it only holds the root and the payload of the
+    // patches (and the root hash as its only recursive hash, for verify). The
+    // patches point into it until the next decode(). The keys (and the strings
+    // of the texts) are interned by the decoder, as the retained divs point to
+    // them, until releaseKeys() finds that the tree no longer does.
+    class PatchDecoder {
+    public:
+        enum Result { Ok, NotAFrame, WrongScalar, Truncated };
+
+        Result decode(const char* bytes, size_t size);
+
+        // Frees the interned strings that neither `tree` nor target() point to.
+        // Cheap enough for every frame: the tree is only walked once the number
+        // of strings doubled since the last time.
+        void releaseKeys(const RetainedTree& tree);
+
+        const ViewTreeWithHashes& target() const { return payload; }
+        const std::vector<CommandPatch>& patches() const { return commandPatches; }
+        const std::vector<DivPatch>& divPatches() const { return decodedDivPatches; }
+
+    private:
+        const char* intern(const char* key, size_t size);
+
+        ViewTreeWithHashes payload;
+        std::vector<CommandPatch> commandPatches;
+        std::vector<DivPatch> decodedDivPatches;
+        // the new frames of the moved commands
+        std::vector<Rect<Scalar>> movedFrames;
+        std::unordered_set<std::string> keys;
+        // the strings left by the last releaseKeys()
+        size_t keptKeys = 0;
+    };
+
+}
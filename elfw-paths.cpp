@@ -0,0 +1,311 @@
+#include "elfw-paths.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    using namespace elfw;
+    using namespace elfw::draw;
+    using Point = Vec2<double>;
+
+    Point lerp(Point a, Point b, double t) { return {a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t}; }
+
+    double length(Point v) { return std::sqrt(v.x * v.x + v.y * v.y); }
+
+
+    // The number of lines a curve is flattened into, from how far its control
+    // points are from a line (its second differences)
+    size_t flatteningSteps(double deviation, double tolerance) {
+        const double steps = std::ceil(std::sqrt(deviation / tolerance));
+        return (size_t) numbers::min(numbers::max(steps, 1.0), 256.0);
+    }
+
+
+    // A flattened subpath
+    struct contour {
+        std::vector<Point> points;
+        bool closed;
+    };
+
+    // Flattens the path, mapping every point with `map` first
+    template<typename Map>
+    std::vector<contour> flatten(const path::Data& data, double tolerance, Map&& map) {
+        std::vector<contour> contours;
+        Point current = {0, 0};
+        auto startAt = [&](Point p) {
+            if (contours.empty() || contours.back().points.size() > 1 || contours.back().closed) {
+                contours.push_back(contour{{}, false});
+            }
+            contours.back().points.assign(1, p);
+        };
+        auto lineTo = [&](Point p) {
+            if (contours.empty() || contours.back().closed) {
+                startAt(current);
+            }
+            contours.back().points.push_back(p);
+        };
+
+        for (const auto& s : data.segments) {
+            switch (s.verb) {
+                case path::Verb::Move:
+                    current = map(s.points[0]);
+                    startAt(current);
+                    break;
+                case path::Verb::Line:
+                    current = map(s.points[0]);
+                    lineTo(current);
+                    break;
+                case path::Verb::Quad: {
+                    const Point p0 = current, p1 = map(s.points[0]), p2 = map(s.points[1]);
+                    const double d = length({p0.x - 2 * p1.x + p2.x, p0.y - 2 * p1.y + p2.y}) / 4;
+                    const size_t n = flatteningSteps(d, tolerance);
+                    for (size_t i = 1; i <= n; ++i) {
+                        const double t = (double) i / n;
+                        lineTo(lerp(lerp(p0, p1, t), lerp(p1, p2, t), t));
+                    }
+                    current = p2;
+                    break;
+                }
+                case path::Verb::Cubic: {
+                    const Point p0 = current, p1 = map(s.points[0]), p2 = map(s.points[1]), p3 = map(s.points[2]);
+                    const double d = 0.75 * numbers::max(
+                            length({p0.x - 2 * p1.x + p2.x, p0.y - 2 * p1.y + p2.y}),
+                            length({p1.x - 2 * p2.x + p3.x, p1.y - 2 * p2.y + p3.y}));
+                    const size_t n = flatteningSteps(d, tolerance);
+                    for (size_t i = 1; i <= n; ++i) {
+                        const double t = (double) i / n;
+                        const Point a = lerp(p0, p1, t), b = lerp(p1, p2, t), c = lerp(p2, p3, t);
+                        lineTo(lerp(lerp(a, b, t), lerp(b, c, t), t));
+                    }
+                    current = p3;
+                    break;
+                }
+                case path::Verb::Close:
+                    if (!contours.empty() && !contours.back().closed) {
+                        contours.back().closed = true;
+                        current = contours.back().points.front();
+                    }
+                    break;
+            }
+        }
+        return contours;
+    }
+
+
+    // Adds the edges of a closed polygon. The stroke polygons are turned
+    // counter-clockwise first, so their windings add up and nonzero fills
+    // their union.
+    void addPolygon(std::vector<Point> polygon, bool positive, std::vector<PathEdge>& edges) {
+        if (positive) {
+            double area = 0;
+            for (size_t i = 0; i < polygon.size(); ++i) {
+                const Point a = polygon[i], b = polygon[(i + 1) % polygon.size()];
+                area += a.x * b.y - b.x * a.y;
+            }
+            if (area < 0) {
+                std::reverse(polygon.begin(), polygon.end());
+            }
+        }
+        for (size_t i = 0; i < polygon.size(); ++i) {
+            const Point a = polygon[i], b = polygon[(i + 1) % polygon.size()];
+            if (a.y < b.y) {
+                edges.push_back(PathEdge{a.x, a.y, b.x, b.y, 1});
+            } else if (a.y > b.y) {
+                edges.push_back(PathEdge{b.x, b.y, a.x, a.y, -1});
+            }
+        }
+    }
+
+
+    // The outline of every segment and a bevel at every join (no caps)
+    void strokeContour(const contour& c, double halfWidth, std::vector<PathEdge>& edges) {
+        const auto& p = c.points;
+        const size_t count = c.closed ? p.size() : p.size() - 1;
+
+        std::vector<Point> normals;
+        for (size_t i = 0; i < count; ++i) {
+            const Point a = p[i], b = p[(i + 1) % p.size()];
+            const double l = length({b.x - a.x, b.y - a.y});
+            if (l <= 0) {
+                continue;
+            }
+            const Point n = {-(b.y - a.y) / l * halfWidth, (b.x - a.x) / l * halfWidth};
+            addPolygon({{a.x + n.x, a.y + n.y}, {b.x + n.x, b.y + n.y}, {b.x - n.x, b.y - n.y}, {a.x - n.x, a.y - n.y}},
+                       true, edges);
+            if (!normals.empty()) {
+                const Point m = normals.back();
+                addPolygon({a, {a.x + m.x, a.y + m.y}, {a.x + n.x, a.y + n.y}}, true, edges);
+                addPolygon({a, {a.x - m.x, a.y - m.y}, {a.x - n.x, a.y - n.y}}, true, edges);
+            }
+            normals.push_back(n);
+        }
+        if (c.closed && normals.size() > 1) {
+            const Point a = p.front(), m = normals.back(), n = normals.front();
+            addPolygon({a, {a.x + m.x, a.y + m.y}, {a.x + n.x, a.y + n.y}}, true, edges);
+            addPolygon({a, {a.x - m.x, a.y - m.y}, {a.x - n.x, a.y - n.y}}, true, edges);
+        }
+    }
+
+
+    bool isFilled(const Fill& fill) {
+        return fill.match(
+                [](const fill::None&) { return false; },
+                [](const fill::Solid&) { return true; }
+        );
+    }
+
+
+    PathGeometry tessellate(const cmds::Path& p, double devicePixelRatio, double tolerance) {
+        const double outset = paths::strokeOutset(p.stroke);
+        const Point origin = {p.path->bounds.pos.x - outset, p.path->bounds.pos.y - outset};
+        const auto contours = flatten(*p.path, tolerance, [&](Point v) {
+            return Point{(v.x - origin.x) * devicePixelRatio, (v.y - origin.y) * devicePixelRatio};
+        });
+
+        PathGeometry g;
+        const bool filled = isFilled(p.fill);
+        for (const auto& c : contours) {
+            if (filled && c.points.size() > 2) {
+                addPolygon(c.points, false, g.fill);
+            }
+            if (outset > 0 && c.points.size() > 1) {
+                strokeContour(c, outset * devicePixelRatio, g.stroke);
+            }
+        }
+        return g;
+    }
+
+
+    size_t geometryBytes(const PathGeometry& g) {
+        return (g.fill.size() + g.stroke.size()) * sizeof(PathEdge);
+    }
+}
+
+
+namespace elfw {
+
+    // Building
+    // ========
+
+    PathBuilder& PathBuilder::moveTo(double x, double y) {
+        segments.push_back(draw::path::Segment{draw::path::Verb::Move, {{x, y}}});
+        return *this;
+    }
+
+    PathBuilder& PathBuilder::lineTo(double x, double y) {
+        segments.push_back(draw::path::Segment{draw::path::Verb::Line, {{x, y}}});
+        return *this;
+    }
+
+    PathBuilder& PathBuilder::quadTo(double cx, double cy, double x, double y) {
+        segments.push_back(draw::path::Segment{draw::path::Verb::Quad, {{cx, cy}, {x, y}}});
+        return *this;
+    }
+
+    PathBuilder& PathBuilder::cubicTo(double c1x, double c1y, double c2x, double c2y, double x, double y) {
+        segments.push_back(draw::path::Segment{draw::path::Verb::Cubic, {{c1x, c1y}, {c2x, c2y}, {x, y}}});
+        return *this;
+    }
+
+    PathBuilder& PathBuilder::close() {
+        segments.push_back(draw::path::Segment{draw::path::Verb::Close, {}});
+        return *this;
+    }
+
+    std::shared_ptr<const draw::path::Data> PathBuilder::build() const {
+        return paths::make(segments);
+    }
+
+
+    namespace paths {
+
+        std::shared_ptr<const draw::path::Data> make(std::vector<draw::path::Segment> segments) {
+            using draw::path::Verb;
+            static const size_t pointCounts[] = {1, 1, 2, 3, 0};
+
+            Point lo = {0, 0}, hi = {0, 0};
+            bool empty = true;
+            Hash h = segments.size();
+            std::hash<double> hd;
+            for (const auto& s : segments) {
+                h = combineHashes(h, (Hash) s.verb);
+                for (size_t i = 0; i < pointCounts[(size_t) s.verb]; ++i) {
+                    const Point p = s.points[i];
+                    h = combineHashes(combineHashes(h, hd(p.x)), hd(p.y));
+                    lo = empty ? p : vec2::min(lo, p);
+                    hi = empty ? p : vec2::max(hi, p);
+                    empty = false;
+                }
+            }
+            return std::make_shared<const draw::path::Data>(draw::path::Data{
+                    std::move(segments), {lo, {hi.x - lo.x, hi.y - lo.y}}, h
+            });
+        }
+
+
+        double strokeOutset(const draw::Stroke& stroke) {
+            return stroke.match(
+                    [](const draw::stroke::None&) { return 0.0; },
+                    [](const draw::stroke::Solid& s) { return s.width / 2; }
+            );
+        }
+
+
+        PathCache& sharedCache() {
+            static PathCache cache(PathCacheOptions{16 * 1024 * 1024, 0.25});
+            return cache;
+        }
+    }
+
+
+    draw::Command pathCommand(std::shared_ptr<const draw::path::Data> path, draw::Fill fill, draw::Stroke stroke) {
+        const double outset = paths::strokeOutset(stroke);
+        const auto& b = path->bounds;
+        // a frame can not be empty, even for a straight line without stroke
+        const Frame<Scalar> frame = frame::absolute<Scalar>(
+                Scalar(b.pos.x - outset), Scalar(b.pos.y - outset),
+                Scalar(numbers::max(b.size.x + 2 * outset, 1.0)), Scalar(numbers::max(b.size.y + 2 * outset, 1.0)));
+        return draw::Command{frame, draw::cmds::Path{std::move(path), fill, stroke}};
+    }
+
+
+    // Path cache
+    // ==========
+
+    std::shared_ptr<const PathGeometry> PathCache::geometry(const draw::cmds::Path& p, double devicePixelRatio) {
+        std::hash<double> h;
+        const Hash key = combineHashes(combineHashes(p.path->hash, h(paths::strokeOutset(p.stroke))),
+                                       combineHashes(h(devicePixelRatio), (Hash) isFilled(p.fill)));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            ++stats.hits;
+            return it->second.geometry;
+        }
+        ++stats.misses;
+
+        auto g = std::make_shared<const PathGeometry>(tessellate(p, devicePixelRatio, options.tolerance));
+        lru.push_front(key);
+        entries.emplace(key, Entry{g, lru.begin()});
+        stats.bytes += geometryBytes(*g);
+
+        // never evict the path just flattened
+        while (stats.bytes > options.budgetBytes && lru.size() > 1) {
+            auto victim = entries.find(lru.back());
+            stats.bytes -= geometryBytes(*victim->second.geometry);
+            entries.erase(victim);
+            lru.pop_back();
+            ++stats.evictions;
+        }
+        return g;
+    }
+
+
+    PathStats PathCache::getStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+}
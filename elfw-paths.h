@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "elfw-draw.h"
+#include "elfw-hashing.h"
+
+namespace elfw {
+
+    // PATHS
+    // =====
+    //
+    // cmds::Path draws move / line / quad / cubic segments. Drawing a path
+    // first flattens its curves into polygons (the fill contours, and for the
+    // stroke an outline polygon for every flattened segment and join), then
+    // fills them scanline by scanline.
+    //
+    // The polygons are kept in a PathCache keyed by the hash of the segments,
+    // the stroke width and the device pixel ratio. They are stored relative to
+    // the origin of the path, so a path that is unchanged or only translated
+    // (an icon in a scrolled list) is drawn from the cached polygons. The least
+    // recently used polygons are dropped to stay in the byte budget.
+
+    class PathBuilder {
+    public:
+        PathBuilder& moveTo(double x, double y);
+        PathBuilder& lineTo(double x, double y);
+        PathBuilder& quadTo(double cx, double cy, double x, double y);
+        PathBuilder& cubicTo(double c1x, double c1y, double c2x, double c2y, double x, double y);
+        PathBuilder& close();
+
+        std::shared_ptr<const draw::path::Data> build() const;
+
+    private:
+        std::vector<draw::path::Segment> segments;
+    };
+
+
+    namespace paths {
+
+        // Computes the bounds (of all the points, so they hold the curves) and
+        // the hash of the segments
+        std::shared_ptr<const draw::path::Data> make(std::vector<draw::path::Segment> segments);
+
+        // The half width of the stroke, which the bounds of a stroked path grow by
+        double strokeOutset(const draw::Stroke& stroke);
+    }
+
+
+    // A Path command whose frame is the stroked bounds of the path, so the path
+    // is drawn at its own coordinates in the rect of the div (and culled by
+    // its bounds)
+    draw::Command pathCommand(std::shared_ptr<const draw::path::Data> path, draw::Fill fill, draw::Stroke stroke);
+
+
+    // A polygon edge in device pixels from the origin of the path, y0 < y1
+    struct PathEdge {
+        double x0, y0, x1, y1;
+        // +1 if the edge goes down in the polygon, -1 if it goes up
+        int winding;
+    };
+
+    struct PathGeometry {
+        std::vector<PathEdge> fill, stroke;
+    };
+
+
+    struct PathCacheOptions {
+        // the most bytes of edges kept (the last flattened path is always kept)
+        std::size_t budgetBytes;
+        // the most distance of the flattened curves from the real ones, in device pixels
+        double tolerance;
+    };
+
+    struct PathStats {
+        // hits: the polygons were cached, misses: the path was flattened
+        std::size_t hits, misses, evictions;
+        std::size_t bytes;
+    };
+
+
+    // Can be used from several threads
+    class PathCache {
+    public:
+        explicit PathCache(const PathCacheOptions& options) : options(options) {}
+
+        // The polygons of the path (which stay valid when evicted)
+        std::shared_ptr<const PathGeometry> geometry(const draw::cmds::Path& p, double devicePixelRatio);
+
+        PathStats getStats();
+
+    private:
+        struct Entry {
+            std::shared_ptr<const PathGeometry> geometry;
+            std::list<Hash>::iterator lru;
+        };
+
+        PathCacheOptions options;
+        std::mutex mutex;
+        std::unordered_map<Hash, Entry> entries;
+        // the keys of the entries, most recently used first
+        std::list<Hash> lru;
+        PathStats stats = {0, 0, 0, 0};
+    };
+
+
+    namespace paths {
+
+        // The cache the raster draws with
+        PathCache& sharedCache();
+    }
+
+}
@@ -0,0 +1,125 @@
+#include "elfw-pipeline.h"
+
+namespace {
+    using namespace elfw;
+
+    // The first frame has nothing to diff against, so everything is redrawn
+    void cullEverything(const ViewTreeWithHashes& tree, CulledDrawCommands& c) {
+        c.changedRects.assign(1, tree.divs[0].frame);
+        c.drawCommands = tree.drawCommands;
+        c.rectIndices = {0, tree.drawCommands.size()};
+    }
+
+}
+
+namespace elfw {
+
+    Pipeline::Pipeline(const PipelineConfig& cfg, FrontStage front)
+    // the back stage holds the previous and the current frame, the front stage
+    // can fill the rest
+            : frames(cfg.framesInFlight + 2)
+            , freeFrames(cfg.framesInFlight + 2)
+            , readyFrames(cfg.framesInFlight)
+            , previous(nullptr)
+            , front(std::move(front))
+            , running(true)
+            , produced(0)
+            , consumed(0) {
+        assert(cfg.framesInFlight > 0);
+
+        for (auto& f : frames) {
+            freeFrames.push(&f);
+        }
+
+        frontThread = std::thread([this] { frontLoop(); });
+    }
+
+
+    Pipeline::~Pipeline() {
+        stop();
+    }
+
+
+    void Pipeline::stop() {
+        running.store(false, std::memory_order_release);
+        if (frontThread.joinable()) {
+            frontThread.join();
+        }
+    }
+
+
+    PipelineStats Pipeline::stats() const {
+        return {produced.load(std::memory_order_relaxed), consumed.load(std::memory_order_relaxed)};
+    }
+
+
+    void Pipeline::frontLoop() {
+        std::size_t frameIndex = 0;
+
+        while (running.load(std::memory_order_acquire)) {
+            PipelineFrame* f = nullptr;
+            if (!freeFrames.pop(f)) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            f->frameIndex = frameIndex++;
+            if (!front(f->frameIndex, f->tree)) {
+                running.store(false, std::memory_order_release);
+                return;
+            }
+
+            while (!readyFrames.push(f)) {
+                if (!running.load(std::memory_order_acquire)) return;
+                std::this_thread::yield();
+            }
+
+            produced.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+
+    bool Pipeline::consume(const BackStage& back) {
+        PipelineFrame* f = nullptr;
+        if (!readyFrames.pop(f)) {
+            return false;
+        }
+
+        f->commandPatches.clear();
+        f->divPatches.clear();
+
+        if (previous == nullptr) {
+            cullEverything(f->tree, f->culled);
+        } else {
+            diff(previous->tree, f->tree, f->commandPatches, f->divPatches);
+            f->culled = cullDrawCommands(f->tree, f->commandPatches, f->divPatches);
+        }
+
+        back(*f);
+
+        // the patches point into the previous tree, so drop them before recycling it
+        f->commandPatches.clear();
+        f->divPatches.clear();
+
+        if (previous != nullptr) {
+            // there is always room, as every frame has a slot in the free queue
+            freeFrames.push(previous);
+        }
+        previous = f;
+
+        consumed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+
+    bool Pipeline::consumeBlocking(const BackStage& back) {
+        while (!consume(back)) {
+            if (!running.load(std::memory_order_acquire) && readyFrames.empty()) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "elfw-viewtree-resolve.h"
+#include "elfw-diffing.h"
+#include "elfw-culling.h"
+#include "elfw-spscqueue.h"
+
+namespace elfw {
+
+    // PIPELINED FRAME EXECUTION
+    // =========================
+    //
+    // Splits a frame into two stages that run on different threads:
+    //
+    //  - front: view() + resolveDiv + hashing (on the pipeline's own thread)
+    //  - back:  diff + culling + rasterization (on the thread calling consume(),
+    //           usually the render loop that owns the GL context)
+    //
+    // so while the back stage draws frame N, the front stage is already
+    // building frame N+1. Frames are handed over through two lock-free SPSC
+    // queues of recycled PipelineFrame buffers.
+
+    // A recycled frame buffer travelling between the stages
+    struct PipelineFrame {
+        std::size_t frameIndex;
+
+        // Filled by the front stage
+        ViewTreeWithHashes tree;
+
+        // Filled by the back stage (only valid inside the BackStage callback,
+        // as the patches point into the previous frame)
+        std::vector<CommandPatch> commandPatches;
+        std::vector<DivPatch> divPatches;
+        CulledDrawCommands culled;
+    };
+
+
+    struct PipelineConfig {
+        // The number of frames the front stage may run ahead of the back stage.
+        // 1 gives the lowest latency, larger values absorb spikes in the front stage.
+        std::size_t framesInFlight;
+    };
+
+
+    struct PipelineStats {
+        std::size_t produced, consumed;
+    };
+
+
+    class Pipeline {
+    public:
+        // Builds the next frame into the recycled tree (use the reusing
+        // resolveDiv overload). Return false to stop producing frames.
+        using FrontStage = std::function<bool(std::size_t frameIndex, ViewTreeWithHashes& tree)>;
+
+        // Rasterizes a diffed and culled frame
+        using BackStage = std::function<void(const PipelineFrame& frame)>;
+
+        Pipeline(const PipelineConfig& cfg, FrontStage front);
+        ~Pipeline();
+
+        Pipeline(const Pipeline&) = delete;
+        Pipeline& operator=(const Pipeline&) = delete;
+
+        // Runs the back stage on the oldest ready frame on the calling thread.
+        // Returns false if there was no frame ready.
+        bool consume(const BackStage& back);
+
+        // Waits for the next frame. Returns false if the front stage stopped.
+        bool consumeBlocking(const BackStage& back);
+
+        // Stops and joins the front stage
+        void stop();
+
+        PipelineStats stats() const;
+
+    private:
+        void frontLoop();
+
+        std::vector<PipelineFrame> frames;
+        // back -> front
+        containers::SpscQueue<PipelineFrame*> freeFrames;
+        // front -> back
+        containers::SpscQueue<PipelineFrame*> readyFrames;
+
+        // The last frame consumed by the back stage (the next diff base)
+        PipelineFrame* previous;
+
+        FrontStage front;
+        std::atomic<bool> running;
+        std::atomic<std::size_t> produced, consumed;
+        std::thread frontThread;
+    };
+
+}
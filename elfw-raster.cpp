@@ -0,0 +1,684 @@
+#include "elfw-raster.h"
+#include "elfw-text.h"
+#include "elfw-images.h"
+#include "elfw-paths.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+namespace {
+    using namespace elfw;
+
+    // A command's shape in device pixels
+    struct Shape {
+        double x0, y0, x1, y1;
+        // corner radius for rounded rectangles
+        double radius;
+    };
+
+
+    uint32_t blend(uint32_t dst, draw::Color c) {
+        const uint32_t a = c.a, ia = 255 - a;
+        auto channel = [&](uint32_t src, int shift) {
+            const uint32_t d = (dst >> shift) & 0xff;
+            return ((src * a + d * ia + 127) / 255) << shift;
+        };
+        const uint32_t da = dst >> 24;
+        const uint32_t outA = a + (da * ia + 127) / 255;
+        return (outA << 24) | channel(c.r, 16) | channel(c.g, 8) | channel(c.b, 0);
+    }
+
+
+    // Checks if the center of a pixel is inside the shape shrunk by `inset`
+    template<typename Op>
+    bool inside(const Shape& s, double px, double py, double inset);
+
+    template<>
+    bool inside<draw::cmds::Rectangle>(const Shape& s, double px, double py, double inset) {
+        return px >= s.x0 + inset && px < s.x1 - inset && py >= s.y0 + inset && py < s.y1 - inset;
+    }
+
+    template<>
+    bool inside<draw::cmds::RoundedRectangle>(const Shape& s, double px, double py, double inset) {
+        if (!inside<draw::cmds::Rectangle>(s, px, py, inset)) {
+            return false;
+        }
+        const double r = numbers::max(s.radius - inset, 0.0);
+        // the distance from the nearest corner circle's center (if in a corner)
+        const double cx = numbers::max(numbers::max(s.x0 + inset + r - px, px - (s.x1 - inset - r)), 0.0);
+        const double cy = numbers::max(numbers::max(s.y0 + inset + r - py, py - (s.y1 - inset - r)), 0.0);
+        return cx * cx + cy * cy <= r * r;
+    }
+
+    template<>
+    bool inside<draw::cmds::Ellipse>(const Shape& s, double px, double py, double inset) {
+        const double rx = (s.x1 - s.x0) / 2 - inset, ry = (s.y1 - s.y0) / 2 - inset;
+        if (rx <= 0 || ry <= 0) {
+            return false;
+        }
+        const double dx = (px - (s.x0 + s.x1) / 2) / rx, dy = (py - (s.y0 + s.y1) / 2) / ry;
+        return dx * dx + dy * dy <= 1.0;
+    }
+
+
+    // Fills and strokes (inside the edge) a shape
+    template<typename Op>
+    void drawShape(const Shape& s, const Op& op, const Rect<int>& clip, double devicePixelRatio, Surface& surface) {
+        const int x0 = numbers::max(numbers::max(clip.pos.x, (int) std::floor(s.x0)), 0);
+        const int y0 = numbers::max(numbers::max(clip.pos.y, (int) std::floor(s.y0)), 0);
+        const int x1 = numbers::min(numbers::min(rect::right(clip), (int) std::ceil(s.x1)), surface.width);
+        const int y1 = numbers::min(numbers::min(rect::bottom(clip), (int) std::ceil(s.y1)), surface.height);
+
+        const bool hasFill = op.fill.match(
+                [](const draw::fill::None&) { return false; },
+                [](const draw::fill::Solid&) { return true; }
+        );
+        const draw::Color fillColor = op.fill.match(
+                [](const draw::fill::None&) { return draw::Color{0, 0, 0, 0}; },
+                [](const draw::fill::Solid& c) { return c; }
+        );
+        const draw::stroke::Solid stroke = op.stroke.match(
+                [](const draw::stroke::None&) { return draw::stroke::Solid{0, {0, 0, 0, 0}}; },
+                [](const draw::stroke::Solid& st) { return st; }
+        );
+        const double strokeWidth = stroke.width * devicePixelRatio;
+
+        for (int y = y0; y < y1; ++y) {
+            uint32_t* row = &surface.pixels[(size_t) y * surface.width];
+            const double py = y + 0.5;
+            for (int x = x0; x < x1; ++x) {
+                const double px = x + 0.5;
+                if (!inside<Op>(s, px, py, 0)) {
+                    continue;
+                }
+                if (strokeWidth > 0 && !inside<Op>(s, px, py, strokeWidth)) {
+                    row[x] = blend(row[x], stroke.color);
+                } else if (hasFill) {
+                    row[x] = blend(row[x], fillColor);
+                }
+            }
+        }
+    }
+
+
+    // Draws a label from the glyph atlas of the shared text cache, clipped to
+    // the pixels whose centers are in the shape (like a rectangle)
+    void drawText(const Shape& s, const draw::cmds::Text& t, const Rect<int>& clip, double devicePixelRatio,
+                  Surface& surface) {
+        const int cx0 = numbers::max(numbers::max(clip.pos.x, (int) std::ceil(s.x0 - 0.5)), 0);
+        const int cy0 = numbers::max(numbers::max(clip.pos.y, (int) std::ceil(s.y0 - 0.5)), 0);
+        const int cx1 = numbers::min(numbers::min(rect::right(clip), (int) std::ceil(s.x1 - 0.5)), surface.width);
+        const int cy1 = numbers::min(numbers::min(rect::bottom(clip), (int) std::ceil(s.y1 - 0.5)), surface.height);
+        if (cx0 >= cx1 || cy0 >= cy1) {
+            return;
+        }
+
+        // the pen starts on whole pixels, so the glyphs look the same wherever the label is
+        const int left = (int) std::floor(s.x0 + 0.5), top = (int) std::floor(s.y0 + 0.5);
+        text::sharedCache().glyphs(t, devicePixelRatio, [&](const GlyphBitmap& g, Vec2<int> pen) {
+            const int gx = left + pen.x + g.pos.x, gy = top + pen.y + g.pos.y;
+            const int x0 = numbers::max(cx0, gx), x1 = numbers::min(cx1, gx + g.size.x);
+            const int y0 = numbers::max(cy0, gy), y1 = numbers::min(cy1, gy + g.size.y);
+            for (int y = y0; y < y1; ++y) {
+                const uint8_t* coverage = g.pixels + (size_t) (y - gy) * g.stride - gx;
+                uint32_t* row = &surface.pixels[(size_t) y * surface.width];
+                for (int x = x0; x < x1; ++x) {
+                    if (coverage[x] != 0) {
+                        draw::Color c = t.color;
+                        c.a = (uint8_t) ((c.a * coverage[x] + 127) / 255);
+                        row[x] = blend(row[x], c);
+                    }
+                }
+            }
+        });
+    }
+
+
+    // Draws an image scaled to the shape (sampled at the pixel centers), or
+    // fills the shape with the placeholder until the image is decoded (adding
+    // it to `placeholders` if set)
+    void drawImage(const Shape& s, const draw::cmds::Image& image, const Rect<int>& clip, Surface& surface,
+                   std::vector<draw::ImageId>* placeholders) {
+        ImageCache* cache = images::current();
+        const auto decoded = cache != nullptr ? cache->find(image.image) : nullptr;
+        if (decoded == nullptr || decoded->width <= 0 || decoded->height <= 0) {
+            drawShape(s, draw::cmds::Rectangle{image.placeholder, draw::stroke::none()}, clip, 1.0, surface);
+            if (placeholders != nullptr) {
+                placeholders->push_back(image.image);
+            }
+            return;
+        }
+
+        const int x0 = numbers::max(numbers::max(clip.pos.x, (int) std::floor(s.x0)), 0);
+        const int y0 = numbers::max(numbers::max(clip.pos.y, (int) std::floor(s.y0)), 0);
+        const int x1 = numbers::min(numbers::min(rect::right(clip), (int) std::ceil(s.x1)), surface.width);
+        const int y1 = numbers::min(numbers::min(rect::bottom(clip), (int) std::ceil(s.y1)), surface.height);
+        const double sx = decoded->width / (s.x1 - s.x0), sy = decoded->height / (s.y1 - s.y0);
+
+        for (int y = y0; y < y1; ++y) {
+            const double py = y + 0.5;
+            if (py < s.y0 || py >= s.y1) {
+                continue;
+            }
+            const int iy = numbers::min((int) ((py - s.y0) * sy), decoded->height - 1);
+            const uint32_t* from = &decoded->pixels[(size_t) iy * decoded->width];
+            uint32_t* row = &surface.pixels[(size_t) y * surface.width];
+            for (int x = x0; x < x1; ++x) {
+                const double px = x + 0.5;
+                if (px < s.x0 || px >= s.x1) {
+                    continue;
+                }
+                const uint32_t c = from[numbers::min((int) ((px - s.x0) * sx), decoded->width - 1)];
+                row[x] = blend(row[x], draw::Color{(uint8_t) (c >> 24), (uint8_t) (c >> 16), (uint8_t) (c >> 8),
+                                                   (uint8_t) c});
+            }
+        }
+    }
+
+
+    // Fills the polygons with the nonzero rule, sampling at the pixel centers
+    // of each row. `origin` is where the origin of the edges is on the surface.
+    void fillEdges(const std::vector<PathEdge>& edges, Vec2<double> origin, int x0, int y0, int x1, int y1,
+                   draw::Color color, Surface& surface) {
+        // the crossings of a row: x, winding
+        std::vector<std::pair<double, int>> crossings;
+        for (int y = y0; y < y1; ++y) {
+            const double py = y + 0.5 - origin.y;
+            crossings.clear();
+            for (const auto& e : edges) {
+                if (py >= e.y0 && py < e.y1) {
+                    crossings.emplace_back(e.x0 + (py - e.y0) * (e.x1 - e.x0) / (e.y1 - e.y0) + origin.x, e.winding);
+                }
+            }
+            if (crossings.empty()) {
+                continue;
+            }
+            std::sort(crossings.begin(), crossings.end());
+
+            uint32_t* row = &surface.pixels[(size_t) y * surface.width];
+            int winding = 0;
+            for (size_t i = 0; i + 1 < crossings.size(); ++i) {
+                winding += crossings[i].second;
+                if (winding == 0) {
+                    continue;
+                }
+                // the pixels whose centers are between the two crossings
+                const int from = numbers::max(x0, (int) std::ceil(crossings[i].first - 0.5));
+                const int to = numbers::min(x1, (int) std::ceil(crossings[i + 1].first - 0.5));
+                for (int x = from; x < to; ++x) {
+                    row[x] = blend(row[x], color);
+                }
+            }
+        }
+    }
+
+
+    // Draws a path from the polygons of the shared path cache, the top left of
+    // the shape being the top left of its stroked bounds
+    void drawPath(const Shape& s, const draw::cmds::Path& p, const Rect<int>& clip, double devicePixelRatio,
+                  Surface& surface) {
+        const int x0 = numbers::max(numbers::max(clip.pos.x, (int) std::ceil(s.x0 - 0.5)), 0);
+        const int y0 = numbers::max(numbers::max(clip.pos.y, (int) std::ceil(s.y0 - 0.5)), 0);
+        const int x1 = numbers::min(numbers::min(rect::right(clip), (int) std::ceil(s.x1 - 0.5)), surface.width);
+        const int y1 = numbers::min(numbers::min(rect::bottom(clip), (int) std::ceil(s.y1 - 0.5)), surface.height);
+        if (x0 >= x1 || y0 >= y1) {
+            return;
+        }
+
+        const auto geometry = paths::sharedCache().geometry(p, devicePixelRatio);
+        p.fill.match(
+                [](const draw::fill::None&) {},
+                [&](const draw::fill::Solid& c) { fillEdges(geometry->fill, {s.x0, s.y0}, x0, y0, x1, y1, c, surface); }
+        );
+        p.stroke.match(
+                [](const draw::stroke::None&) {},
+                [&](const draw::stroke::Solid& st) {
+                    fillEdges(geometry->stroke, {s.x0, s.y0}, x0, y0, x1, y1, st.color, surface);
+                }
+        );
+    }
+
+
+    Rect<int> snapOutward(const Rect<Scalar>& r, double devicePixelRatio) {
+        const int x = (int) std::floor((double) r.pos.x * devicePixelRatio);
+        const int y = (int) std::floor((double) r.pos.y * devicePixelRatio);
+        return {{x, y},
+                {(int) std::ceil((double) rect::right(r) * devicePixelRatio) - x,
+                 (int) std::ceil((double) rect::bottom(r) * devicePixelRatio) - y}};
+    }
+
+
+    // Draws the commands with their device pixel frames shifted by -`offset`
+    // (and their view frames by `origin`, for display lists). The images drawn
+    // as placeholders are added to `placeholders` if set.
+    void rasterizeAt(const draw::ResolvedCommand* begin, const draw::ResolvedCommand* end,
+                     const Rect<int>& clip, double devicePixelRatio, Vec2<int> offset, Surface& surface,
+                     std::vector<draw::ImageId>* placeholders = nullptr, Vec2<Scalar> origin = {0, 0}) {
+        for (auto it = begin; it != end; ++it) {
+            const Rect<Scalar> f = {it->frame.pos + origin, it->frame.size};
+            Shape s = {
+                    (double) f.pos.x * devicePixelRatio - offset.x, (double) f.pos.y * devicePixelRatio - offset.y,
+                    (double) rect::right(f) * devicePixelRatio - offset.x,
+                    (double) rect::bottom(f) * devicePixelRatio - offset.y,
+                    0
+            };
+
+            it->cmd.match(
+                    [&](const draw::cmds::Rectangle& r) { drawShape(s, r, clip, devicePixelRatio, surface); },
+                    [&](const draw::cmds::RoundedRectangle& r) {
+                        s.radius = r.radius * devicePixelRatio;
+                        drawShape(s, r, clip, devicePixelRatio, surface);
+                    },
+                    [&](const draw::cmds::Ellipse& r) { drawShape(s, r, clip, devicePixelRatio, surface); },
+                    [&](const draw::cmds::Text& t) { drawText(s, t, clip, devicePixelRatio, surface); },
+                    [&](const draw::cmds::Image& i) { drawImage(s, i, clip, surface, placeholders); },
+                    [&](const draw::cmds::Path& p) { drawPath(s, p, clip, devicePixelRatio, surface); }
+            );
+        }
+    }
+
+
+    void clear(const Rect<int>& clip, Surface& surface) {
+        const int x0 = numbers::max(clip.pos.x, 0), x1 = numbers::min(rect::right(clip), surface.width);
+        const int y0 = numbers::max(clip.pos.y, 0), y1 = numbers::min(rect::bottom(clip), surface.height);
+        for (int y = y0; y < y1; ++y) {
+            for (int x = x0; x < x1; ++x) {
+                surface.pixels[(size_t) y * surface.width + x] = 0;
+            }
+        }
+    }
+
+
+    // Layers
+    // ======
+
+    // Blends a pixel of a layer over the frame (the pixels drawn by blend() onto
+    // a cleared surface have their colors multiplied by their alpha)
+    uint32_t over(uint32_t dst, uint32_t src) {
+        const uint32_t ia = 255 - (src >> 24);
+        auto channel = [&](int shift) {
+            const uint32_t v = ((src >> shift) & 0xff) + (((dst >> shift) & 0xff) * ia + 127) / 255;
+            return numbers::min<uint32_t>(v, 255) << shift;
+        };
+        return channel(24) | channel(16) | channel(8) | channel(0);
+    }
+
+    void blit(const Surface& src, Vec2<int> pos, const Rect<int>& clip, Surface& surface) {
+        const int x0 = numbers::max(numbers::max(clip.pos.x, pos.x), 0);
+        const int y0 = numbers::max(numbers::max(clip.pos.y, pos.y), 0);
+        const int x1 = numbers::min(numbers::min(rect::right(clip), pos.x + src.width), surface.width);
+        const int y1 = numbers::min(numbers::min(rect::bottom(clip), pos.y + src.height), surface.height);
+        for (int y = y0; y < y1; ++y) {
+            const uint32_t* from = src.pixels.data() + (size_t) (y - pos.y) * src.width;
+            uint32_t* row = &surface.pixels[(size_t) y * surface.width];
+            for (int x = x0; x < x1; ++x) {
+                row[x] = over(row[x], from[x - pos.x]);
+            }
+        }
+    }
+
+
+    // Draws the commands of the subtree in tree order
+    void drawSubtree(const ViewTreeWithHashes& tree, size_t idx, const Rect<int>& clip, double devicePixelRatio,
+                     Vec2<int> offset, Surface& surface, std::vector<draw::ImageId>* placeholders = nullptr) {
+        const auto& div = tree.divs[idx];
+        const auto* cmds = tree.drawCommands.data() + div.drawCommands.start;
+        rasterizeAt(cmds, cmds + div.drawCommands.size(), clip, devicePixelRatio, offset, surface, placeholders);
+        for (size_t c = div.children.start; c < div.children.start + div.children.size(); ++c) {
+            drawSubtree(tree, c, clip, devicePixelRatio, offset, surface, placeholders);
+        }
+    }
+
+
+    // Checks if one of the images drawn as a placeholder into a cached surface
+    // was decoded since (the hashes of the tree do not change when it is)
+    bool anyDecoded(const std::vector<draw::ImageId>& placeholders) {
+        ImageCache* cache = images::current();
+        if (cache == nullptr) {
+            return false;
+        }
+        for (const auto id : placeholders) {
+            if (cache->isDecoded(id)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    // Counts the draw commands in each subtree and the rect they cover (the
+    // bounds in the HashStore also cover the frames of the divs, which are as
+    // large as their parents)
+    void measureSubtrees(const ViewTreeWithHashes& tree, size_t idx, std::vector<size_t>& counts,
+                         std::vector<Rect<Scalar>>& bounds) {
+        const auto& div = tree.divs[idx];
+        size_t count = div.drawCommands.size();
+        Rect<Scalar> b = rect::none<Scalar>;
+        for (size_t c = div.drawCommands.start; c < div.drawCommands.start + div.drawCommands.size(); ++c) {
+            b = c == div.drawCommands.start ? tree.drawCommands[c].frame : rect::max(b, tree.drawCommands[c].frame);
+        }
+        for (size_t c = div.children.start; c < div.children.start + div.children.size(); ++c) {
+            measureSubtrees(tree, c, counts, bounds);
+            if (counts[c] > 0) {
+                b = count > 0 ? rect::max(b, bounds[c]) : bounds[c];
+                count += counts[c];
+            }
+        }
+        counts[idx] = count;
+        bounds[idx] = b;
+    }
+
+
+    // A layer to be composited instead of the children of its div
+    struct placed_layer {
+        const Surface* pixels;
+        Vec2<int> pos;
+    };
+
+    // Draws the subtree into the clip rect of the frame, skipping the subtrees
+    // that miss it
+    void paintSubtree(const ViewTreeWithHashes& tree, size_t idx, const std::vector<placed_layer>& placed,
+                      const Rect<int>& clip, double devicePixelRatio, Surface& surface) {
+        if (!rect::intersects(snapOutward(tree.hashStore.divBounds[idx], devicePixelRatio), clip)) {
+            return;
+        }
+
+        const auto& div = tree.divs[idx];
+        const auto* cmds = tree.drawCommands.data() + div.drawCommands.start;
+        rasterizeAt(cmds, cmds + div.drawCommands.size(), clip, devicePixelRatio, {0, 0}, surface);
+
+        if (placed[idx].pixels != nullptr) {
+            blit(*placed[idx].pixels, placed[idx].pos, clip, surface);
+            return;
+        }
+        for (size_t c = div.children.start; c < div.children.start + div.children.size(); ++c) {
+            paintSubtree(tree, c, placed, clip, devicePixelRatio, surface);
+        }
+    }
+}
+
+
+namespace elfw {
+
+    void rasterize(const draw::ResolvedCommand* begin, const draw::ResolvedCommand* end,
+                   const Rect<int>& clip, double devicePixelRatio, Surface& surface) {
+        rasterizeAt(begin, end, clip, devicePixelRatio, {0, 0}, surface);
+    }
+
+
+    void rasterize(const CulledDrawCommands& culled, double devicePixelRatio, Surface& surface) {
+        assert(culled.displayListRefs.empty());
+
+        const bool snapped = !culled.damageRects.empty();
+        for (size_t i = 0; i < culled.changedRects.size(); ++i) {
+            const auto clip = snapped ? culled.damageRects[i] : snapOutward(culled.changedRects[i], devicePixelRatio);
+            clear(clip, surface);
+
+            const auto* cmds = culled.drawCommands.data();
+            rasterize(cmds + culled.rectIndices[i], cmds + culled.rectIndices[i + 1], clip, devicePixelRatio, surface);
+        }
+    }
+
+
+    void rasterize(const CulledDrawCommands& culled, const DisplayListCache& displayLists,
+                   double devicePixelRatio, Surface& surface) {
+        const bool snapped = !culled.damageRects.empty();
+        const bool refs = !culled.rectRefIndices.empty();
+        for (size_t i = 0; i < culled.changedRects.size(); ++i) {
+            const auto clip = snapped ? culled.damageRects[i] : snapOutward(culled.changedRects[i], devicePixelRatio);
+            clear(clip, surface);
+
+            // the ranges of the display lists go between the commands
+            const auto* cmds = culled.drawCommands.data();
+            size_t next = culled.rectIndices[i];
+            for (size_t r = refs ? culled.rectRefIndices[i] : 0; refs && r < culled.rectRefIndices[i + 1]; ++r) {
+                const auto& ref = culled.displayListRefs[r];
+                rasterize(cmds + next, cmds + ref.at, clip, devicePixelRatio, surface);
+                next = ref.at;
+
+                const DisplayList* list = displayLists.list(ref.list);
+                assert(list != nullptr);
+                const auto* listCmds = list->commands.data() + ref.offset;
+                rasterizeAt(listCmds, listCmds + ref.count, clip, devicePixelRatio, {0, 0}, surface, nullptr,
+                            ref.origin);
+            }
+            rasterize(cmds + next, cmds + culled.rectIndices[i + 1], clip, devicePixelRatio, surface);
+        }
+    }
+
+
+
+    // Layer compositing
+    // =================
+
+    void LayerCompositor::updateLayers(const ViewTreeWithHashes& tree, size_t idx, Hash path, double devicePixelRatio,
+                                       std::vector<const CachedLayer*>& placed, std::vector<Rect<int>>& damage) {
+        const auto& div = tree.divs[idx];
+        const auto& hashes = tree.hashStore;
+        const Hash id = combineHashes(path, hashes.divHeaders[idx]);
+
+        if (!div.layer) {
+            for (size_t c = div.children.start; c < div.children.start + div.children.size(); ++c) {
+                updateLayers(tree, c, id, devicePixelRatio, placed, damage);
+            }
+            return;
+        }
+        if (div.children.size() == 0) {
+            return;
+        }
+
+        Rect<Scalar> bounds = hashes.divBounds[div.children.start];
+        Hash contents = div.children.size();
+        for (size_t c = div.children.start; c < div.children.start + div.children.size(); ++c) {
+            bounds = rect::max(bounds, hashes.divBounds[c]);
+            contents = combineHashes(contents, hashes.divRecursive[c]);
+        }
+
+        // the surface moves by whole pixels, the rest of the origin is part of its contents
+        const double ox = (double) div.layerOrigin.x * devicePixelRatio;
+        const double oy = (double) div.layerOrigin.y * devicePixelRatio;
+        const Vec2<int> offset = {(int) std::floor(ox), (int) std::floor(oy)};
+        const Rect<int> r = snapOutward(bounds, devicePixelRatio);
+        const Rect<int> local = {{r.pos.x - offset.x, r.pos.y - offset.y}, r.size};
+
+        std::hash<double> h;
+        contents = combineHashes(contents, h(ox - offset.x));
+        contents = combineHashes(contents, h(oy - offset.y));
+        contents = combineHashes(contents, h(devicePixelRatio));
+        contents = combineHashes(contents, std::hash<int>()(local.pos.x));
+        contents = combineHashes(contents, std::hash<int>()(local.pos.y));
+        contents = combineHashes(contents, std::hash<int>()(local.size.x));
+        contents = combineHashes(contents, std::hash<int>()(local.size.y));
+
+        auto it = layers.find(id);
+        if (it == layers.end() || it->second.contents != contents || anyDecoded(it->second.placeholders)) {
+            if (it != layers.end()) {
+                damage.push_back(it->second.rect);
+                layers.erase(it);
+            }
+            it = layers.emplace(id, CachedLayer{Surface(r.size.x, r.size.y), r, contents, false, {}}).first;
+            for (size_t c = div.children.start; c < div.children.start + div.children.size(); ++c) {
+                drawSubtree(tree, c, {{0, 0}, r.size}, devicePixelRatio, r.pos, it->second.pixels,
+                            &it->second.placeholders);
+            }
+            damage.push_back(r);
+            ++stats.repainted;
+        } else if (!(it->second.rect == r)) {
+            damage.push_back(it->second.rect);
+            damage.push_back(r);
+            it->second.rect = r;
+            ++stats.moved;
+        }
+
+        it->second.used = true;
+        placed[idx] = &it->second;
+    }
+
+
+    void LayerCompositor::compose(const ViewTreeWithHashes& tree, const CulledDrawCommands& culled,
+                                  double devicePixelRatio, Surface& surface) {
+        assert(tree.hashStore.divBounds.size() == tree.divs.size());
+
+        std::vector<Rect<int>> damage;
+        const bool snapped = !culled.damageRects.empty();
+        for (size_t i = 0; i < culled.changedRects.size(); ++i) {
+            damage.push_back(snapped ? culled.damageRects[i] : snapOutward(culled.changedRects[i], devicePixelRatio));
+        }
+
+        for (auto& l : layers) {
+            l.second.used = false;
+        }
+        std::vector<const CachedLayer*> placed(tree.divs.size(), nullptr);
+        if (!tree.divs.empty()) {
+            updateLayers(tree, 0, 0, devicePixelRatio, placed, damage);
+        }
+        for (auto it = layers.begin(); it != layers.end();) {
+            if (!it->second.used) {
+                damage.push_back(it->second.rect);
+                it = layers.erase(it);
+                continue;
+            }
+            ++it;
+        }
+
+        if (tree.divs.empty()) {
+            return;
+        }
+        std::vector<placed_layer> surfaces(tree.divs.size(), placed_layer{nullptr, {0, 0}});
+        for (size_t i = 0; i < placed.size(); ++i) {
+            if (placed[i] != nullptr) {
+                surfaces[i] = {&placed[i]->pixels, placed[i]->rect.pos};
+            }
+        }
+
+        for (const auto& clip : damage) {
+            clear(clip, surface);
+            paintSubtree(tree, 0, surfaces, clip, devicePixelRatio, surface);
+        }
+    }
+
+
+
+    // Raster cache
+    // ============
+
+    void RasterCache::evictTo(std::size_t bytes) {
+        while (stats.bytes > bytes && !lru.empty()) {
+            const auto it = entries.find(lru.back());
+            stats.bytes -= it->second.pixels.pixels.size() * sizeof(uint32_t);
+            entries.erase(it);
+            lru.pop_back();
+            ++stats.evictions;
+        }
+    }
+
+
+    const RasterCache::Entry* RasterCache::bitmap(const ViewTreeWithHashes& tree, size_t idx, const Rect<int>& rect,
+                                                   double devicePixelRatio) {
+        // the recursive hash does not cover where a layer is (see elfw-layers.h),
+        // the exact bounds do. The bitmap only holds `rect` (the bounds clipped to
+        // the surface), so a larger surface needs another one.
+        const auto& b = subtreeBounds[idx];
+        std::hash<double> h;
+        Hash key = tree.hashStore.divRecursive[idx];
+        for (const double v : {(double) b.pos.x, (double) b.pos.y, (double) b.size.x, (double) b.size.y,
+                               devicePixelRatio}) {
+            key = combineHashes(key, h(v));
+        }
+        for (const int v : {rect.pos.x, rect.pos.y, rect.size.x, rect.size.y}) {
+            key = combineHashes(key, std::hash<int>()(v));
+        }
+
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            ++stats.hits;
+            auto& e = it->second;
+            if (anyDecoded(e.placeholders)) {
+                std::fill(e.pixels.pixels.begin(), e.pixels.pixels.end(), 0);
+                e.placeholders.clear();
+                drawSubtree(tree, idx, {{0, 0}, rect.size}, devicePixelRatio, rect.pos, e.pixels, &e.placeholders);
+            }
+            return &e;
+        }
+        ++stats.misses;
+
+        auto& s = seen[key];
+        if (s.lastFrame != frame) {
+            s.frames = s.lastFrame + options.stableFrames >= frame ? s.frames + 1 : 1;
+            s.lastFrame = frame;
+        }
+        const size_t bytes = (size_t) rect.size.x * rect.size.y * sizeof(uint32_t);
+        if (s.frames < options.stableFrames || bytes == 0 || bytes > options.budgetBytes) {
+            return nullptr;
+        }
+        seen.erase(key);
+
+        evictTo(options.budgetBytes - bytes);
+        lru.push_front(key);
+        auto& e = entries.emplace(key, Entry{Surface(rect.size.x, rect.size.y), rect, lru.begin(), {}}).first->second;
+        drawSubtree(tree, idx, {{0, 0}, rect.size}, devicePixelRatio, rect.pos, e.pixels, &e.placeholders);
+        stats.bytes += bytes;
+        return &e;
+    }
+
+
+    void RasterCache::paint(const ViewTreeWithHashes& tree, size_t idx, const Rect<int>& clip, double devicePixelRatio,
+                            Surface& surface) {
+        const Rect<int> bounds = snapOutward(tree.hashStore.divBounds[idx], devicePixelRatio);
+        if (!rect::intersects(bounds, clip)) {
+            return;
+        }
+
+        if (subtreeCommands[idx] >= options.minCommands) {
+            // only the part on the surface is kept
+            const Rect<int> visible = rect::min(snapOutward(subtreeBounds[idx], devicePixelRatio),
+                                                Rect<int>{{0, 0}, {surface.width, surface.height}});
+            if (visible.size.x > 0 && visible.size.y > 0) {
+                if (const Entry* e = bitmap(tree, idx, visible, devicePixelRatio)) {
+                    blit(e->pixels, e->rect.pos, clip, surface);
+                    return;
+                }
+            }
+        }
+
+        const auto& div = tree.divs[idx];
+        const auto* cmds = tree.drawCommands.data() + div.drawCommands.start;
+        rasterizeAt(cmds, cmds + div.drawCommands.size(), clip, devicePixelRatio, {0, 0}, surface);
+        for (size_t c = div.children.start; c < div.children.start + div.children.size(); ++c) {
+            paint(tree, c, clip, devicePixelRatio, surface);
+        }
+    }
+
+
+    void RasterCache::rasterize(const ViewTreeWithHashes& tree, const CulledDrawCommands& culled,
+                                double devicePixelRatio, Surface& surface) {
+        assert(tree.hashStore.divBounds.size() == tree.divs.size());
+        ++frame;
+
+        if (!tree.divs.empty()) {
+            subtreeCommands.resize(tree.divs.size());
+            subtreeBounds.resize(tree.divs.size());
+            measureSubtrees(tree, 0, subtreeCommands, subtreeBounds);
+
+            const bool snapped = !culled.damageRects.empty();
+            for (size_t i = 0; i < culled.changedRects.size(); ++i) {
+                const auto clip = snapped ? culled.damageRects[i] : snapOutward(culled.changedRects[i], devicePixelRatio);
+                clear(clip, surface);
+                paint(tree, 0, clip, devicePixelRatio, surface);
+            }
+        }
+
+        // forget the subtrees that stopped counting
+        for (auto it = seen.begin(); it != seen.end();) {
+            if (it->second.lastFrame + options.stableFrames < frame) {
+                it = seen.erase(it);
+                continue;
+            }
+            ++it;
+        }
+    }
+
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "elfw-culling.h"
+
+namespace elfw {
+
+    // CPU RASTER
+    // ==========
+    //
+    // A simple software rasterizer for the draw commands, used to render headless
+    // (replays, tests) without a GL context. Pixels are sampled at their centers
+    // (no anti-aliasing) and blended source-over.
+
+    struct Surface {
+        int width, height;
+        // 0xAARRGGBB, row major
+        std::vector<uint32_t> pixels;
+
+        Surface(int width, int height) : width(width), height(height), pixels((size_t) width * height, 0) {}
+    };
+
+
+    // Draws the commands in the order given, clipped to `clip` (in device pixels)
+    void rasterize(const draw::ResolvedCommand* begin, const draw::ResolvedCommand* end,
+                   const Rect<int>& clip, double devicePixelRatio, Surface& surface);
+
+    // Redraws every damaged area of the culled commands. Uses the damageRects if
+    // the commands were culled with DamageOptions, the changedRects otherwise.
+    void rasterize(const CulledDrawCommands& culled, double devicePixelRatio, Surface& surface);
+
+    // Same as above for commands culled with display lists, the ranges are drawn
+    // from `displayLists` (which must not cull another frame before this)
+    void rasterize(const CulledDrawCommands& culled, const DisplayListCache& displayLists,
+                   double devicePixelRatio, Surface& surface);
+
+
+    // LAYER COMPOSITING
+    // =================
+    //
+    // Draws trees with layers (see elfw-layers.h). The children of each layer are
+    // rasterized into a surface of their own, which is only redrawn when their
+    // contents change, then blended into the frame. A layer moving by whole
+    // device pixels is a recomposite of its old and new rect (a fractional move
+    // has to be redrawn, as the pixel centers sample the shapes differently).
+
+    struct LayerStats {
+        // layers drawn into their surface, layers composited from their surface at a new rect
+        std::size_t repainted, moved;
+    };
+
+
+    class LayerCompositor {
+    public:
+        // Redraws the damaged areas of the frame: the culled rects (see
+        // cullDrawCommands) and the old and new rects of the layers that moved,
+        // changed, appeared or disappeared since the last call
+        void compose(const ViewTreeWithHashes& tree, const CulledDrawCommands& culled,
+                     double devicePixelRatio, Surface& surface);
+
+        const LayerStats& getStats() const { return stats; }
+
+    private:
+        struct CachedLayer {
+            Surface pixels;
+            // where the pixels go in the frame (device pixels)
+            Rect<int> rect;
+            // the hash of what the pixels were drawn from
+            Hash contents;
+            bool used;
+            // the images drawn as placeholders, the layer is redrawn once one is decoded
+            std::vector<draw::ImageId> placeholders;
+        };
+
+        // Updates the surfaces of the outermost layers in the subtree
+        void updateLayers(const ViewTreeWithHashes& tree, size_t idx, Hash path, double devicePixelRatio,
+                          std::vector<const CachedLayer*>& placed, std::vector<Rect<int>>& damage);
+
+        // keyed by the hash of the keys on the path to the layer
+        std::unordered_map<Hash, CachedLayer> layers;
+        LayerStats stats = {0, 0};
+    };
+
+
+    // RASTER CACHE
+    // ============
+    //
+    // Redraws the damage like rasterize(culled), but subtrees drawn unchanged in
+    // `stableFrames` frames are drawn once into a bitmap of their own, which is
+    // blitted instead while their recursive hash (HashStore::divRecursive) and
+    // bounds stay the same. The bitmaps are evicted least recently used first
+    // to stay in the budget.
+    //
+    // Subtrees with fewer than `minCommands` draw commands are always drawn (a
+    // blit costs about as much as a few shapes). Translucent colors are rounded
+    // differently when blended through a bitmap, opaque ones give the same pixels.
+
+    struct RasterCacheOptions {
+        // a subtree is cached when drawn in this many frames (a subtree not
+        // drawn for as many frames starts counting again)
+        std::size_t stableFrames;
+        std::size_t minCommands;
+        // the most pixel bytes kept
+        std::size_t budgetBytes;
+    };
+
+    struct RasterCacheStats {
+        // hits: subtrees blitted from a bitmap, misses: cacheable subtrees
+        // without one, evictions: bitmaps dropped to stay in the budget
+        std::size_t hits, misses, evictions;
+        // the pixel bytes in the cache
+        std::size_t bytes;
+    };
+
+
+    class RasterCache {
+    public:
+        explicit RasterCache(const RasterCacheOptions& options) : options(options) {}
+
+        // Redraws every damaged area of the culled commands from the tree they
+        // were culled from
+        void rasterize(const ViewTreeWithHashes& tree, const CulledDrawCommands& culled,
+                       double devicePixelRatio, Surface& surface);
+
+        const RasterCacheStats& getStats() const { return stats; }
+
+    private:
+        struct Entry {
+            Surface pixels;
+            // where the pixels go in the frame (device pixels)
+            Rect<int> rect;
+            std::list<Hash>::iterator lru;
+            // the images drawn as placeholders, the bitmap is redrawn once one is decoded
+            std::vector<draw::ImageId> placeholders;
+        };
+
+        // The frames a subtree not cached yet was drawn in
+        struct Seen {
+            std::size_t frames;
+            std::uint64_t lastFrame;
+        };
+
+        void paint(const ViewTreeWithHashes& tree, size_t idx, const Rect<int>& clip, double devicePixelRatio,
+                   Surface& surface);
+
+        // Returns the bitmap of the subtree (drawing it if it just became stable) or nullptr
+        const Entry* bitmap(const ViewTreeWithHashes& tree, size_t idx, const Rect<int>& rect,
+                            double devicePixelRatio);
+
+        // Evicts bitmaps until at most `bytes` are used
+        void evictTo(std::size_t bytes);
+
+        RasterCacheOptions options;
+        std::unordered_map<Hash, Entry> entries;
+        // the keys of the entries, most recently used first
+        std::list<Hash> lru;
+        std::unordered_map<Hash, Seen> seen;
+        // the number of draw commands in each subtree of the current tree and the rect they cover
+        std::vector<std::size_t> subtreeCommands;
+        std::vector<Rect<Scalar>> subtreeBounds;
+        std::uint64_t frame = 0;
+        RasterCacheStats stats = {0, 0, 0, 0};
+    };
+
+}
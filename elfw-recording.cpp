@@ -0,0 +1,286 @@
+#include "elfw-recording.h"
+#include "elfw-lazy.h"
+#include "elfw-virtuallist.h"
+#include "elfw-layout.h"
+
+#include <cstring>
+
+namespace {
+    using namespace elfw;
+
+    // The actual contents of a div (lazy placeholders are recorded expanded)
+    const Div& contents(const Div& div) {
+        return div.lazy ? div.lazy->source : div;
+    }
+
+
+    recording::Layout toRecord(const Div& div) {
+        recording::Layout r;
+        memset(&r, 0, sizeof(r));
+
+        Layout l;
+        if (layout::effective(div, l)) {
+            r.hasLayout = 1;
+            r.direction = (uint8_t) l.direction;
+            r.align = (uint8_t) l.align;
+            r.wrap = l.wrap ? 1 : 0;
+            r.gap = l.gap;
+            r.padding = l.padding;
+            r.grow = l.grow;
+            r.size = l.size;
+        }
+        return r;
+    }
+
+    std::shared_ptr<const Layout> fromRecord(const recording::Layout& r) {
+        if (r.hasLayout == 0) {
+            return nullptr;
+        }
+        return std::make_shared<const Layout>(Layout{
+                (layout::Direction) r.direction, r.wrap != 0, r.gap, r.padding, (layout::Align) r.align, nullptr,
+                r.size, r.grow
+        });
+    }
+
+
+    // Flattens a view in pre-order. Virtualized lists are recorded with the rows
+    // they have in `viewport`, so the rects are tracked like in resolveDiv.
+    // `frameRect` is the rect the div is resolved in.
+    void flatten(const Div& view,
+                 const Rect<Scalar>& frameRect,
+                 const Rect<Scalar>& viewport,
+                 std::vector<recording::Div>& divs,
+                 std::vector<recording::Command>& commands,
+                 std::vector<char>& keys) {
+        const Div& div = contents(view);
+        const auto childRect = frame::resolve(div.frame, frameRect);
+        const auto rows = div.virtualList
+                          ? virtual_list::visibleRows(*div.virtualList, childRect, viewport)
+                          : std::vector<Div>{};
+        const auto& children = div.virtualList ? rows : div.childDivs;
+        const size_t keySize = strlen(div.key);
+
+        divs.emplace_back(recording::Div{
+                div.frame, keys.size(), (uint32_t) children.size(), (uint32_t) div.drawCommands.size(), toRecord(view),
+                view.layer || div.layer ? 1u : 0u, 0
+        });
+        keys.insert(keys.end(), div.key, div.key + keySize + 1);
+
+        for (const auto& c : div.drawCommands) {
+            commands.emplace_back(recording::Command{c.frame, snapshot::toRecord(c.cmd, keys)});
+        }
+        // the children of stack containers are resolved in their slots
+        std::vector<Rect<Scalar>> slots;
+        if (div.layout && div.layout->direction != layout::Direction::None) {
+            layout::place(div, childRect, slots);
+        }
+        for (size_t i = 0; i < children.size(); ++i) {
+            flatten(children[i], slots.empty() ? childRect : slots[i], viewport, divs, commands, keys);
+        }
+    }
+
+
+    // Rebuilds a view from its pre-order records
+    struct unflatten_state {
+        const std::vector<recording::Div>& divs;
+        const std::vector<recording::Command>& commands;
+        const char* keys;
+        size_t nextDiv, nextCommand;
+    };
+
+    Div unflatten(unflatten_state& s) {
+        const auto& d = s.divs[s.nextDiv++];
+
+        std::vector<draw::Command> cmds;
+        for (uint32_t i = 0; i < d.commandCount; ++i) {
+            const auto& c = s.commands[s.nextCommand++];
+            cmds.push_back(draw::Command{c.frame, snapshot::fromRecord(c.op, s.keys)});
+        }
+
+        std::vector<Div> children;
+        for (uint32_t i = 0; i < d.childCount; ++i) {
+            children.emplace_back(unflatten(s));
+        }
+
+        return Div{s.keys + d.keyOffset, d.frame, std::move(children), {cmds.begin(), cmds.end()}, nullptr, nullptr,
+                   fromRecord(d.layout), d.layer != 0};
+    }
+
+
+    // Checks that the pre-order counts add up (and the strings and path
+    // segments are in the key table) before rebuilding the view
+    bool validPreOrder(const std::vector<recording::Div>& divs, const std::vector<recording::Command>& commands,
+                       size_t keyBytes) {
+        size_t pending = 1, commandCount = 0;
+        for (const auto& d : divs) {
+            if (pending == 0 || d.keyOffset >= keyBytes) {
+                return false;
+            }
+            pending = pending - 1 + d.childCount;
+            commandCount += d.commandCount;
+        }
+        for (const auto& c : commands) {
+            if (c.op.op == snapshot::Text && c.op.dataOffset >= keyBytes) {
+                return false;
+            }
+            if (c.op.op == snapshot::Path &&
+                (c.op.dataOffset > keyBytes ||
+                 c.op.resource > (keyBytes - c.op.dataOffset) / sizeof(snapshot::PathSegment))) {
+                return false;
+            }
+        }
+        return pending == 0 && commandCount == commands.size();
+    }
+
+
+    template<typename T>
+    bool readRecords(FILE* f, std::vector<T>& v, size_t count) {
+        v.resize(count);
+        return fread(v.data(), sizeof(T), count, f) == count;
+    }
+}
+
+
+namespace elfw {
+
+    // Recorder
+    // ========
+
+    Recorder::Recorder(const std::string& file)
+            : out(fopen(file.c_str(), "wb")), start(std::chrono::steady_clock::now()) {
+        if (out == nullptr) {
+            return;
+        }
+
+        recording::Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, recording::magic, sizeof(header.magic));
+        header.version = recording::version;
+        header.scalarKind = (uint32_t) scalarKind;
+        header.scalarSize = sizeof(Scalar);
+        fwrite(&header, sizeof(header), 1, out);
+    }
+
+
+    Recorder::~Recorder() {
+        if (out != nullptr) {
+            fclose(out);
+        }
+    }
+
+
+    void Recorder::message(const void* bytes, size_t size) {
+        if (out == nullptr) {
+            return;
+        }
+        const auto size32 = (uint32_t) size;
+        const auto* p = static_cast<const char*>(bytes);
+        messages.insert(messages.end(), reinterpret_cast<const char*>(&size32), reinterpret_cast<const char*>(&size32 + 1));
+        messages.insert(messages.end(), p, p + size);
+        ++messageCount;
+    }
+
+
+    void Recorder::frame(const Div& view, Rect<Scalar> viewRect, const ViewTreeWithHashes& resolved) {
+        if (out == nullptr) {
+            return;
+        }
+
+        std::vector<recording::Div> divs;
+        std::vector<recording::Command> commands;
+        std::vector<char> keys;
+        flatten(view, viewRect, viewRect, divs, commands, keys);
+
+        recording::FrameHeader h;
+        memset(&h, 0, sizeof(h));
+        h.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        h.messageBytes = messages.size();
+        h.messageCount = messageCount;
+        h.divCount = (uint32_t) divs.size();
+        h.commandCount = (uint32_t) commands.size();
+        h.keyBytes = (uint32_t) keys.size();
+        h.viewRect = viewRect;
+        h.rootHash = resolved.hashStore.divRecursive.empty() ? 0 : resolved.hashStore.divRecursive[0];
+
+        fwrite(&h, sizeof(h), 1, out);
+        fwrite(messages.data(), 1, messages.size(), out);
+        fwrite(divs.data(), sizeof(recording::Div), divs.size(), out);
+        fwrite(commands.data(), sizeof(recording::Command), commands.size(), out);
+        fwrite(keys.data(), 1, keys.size(), out);
+        fflush(out);
+
+        messages.clear();
+        messageCount = 0;
+    }
+
+
+    // Recording
+    // =========
+
+    Recording::OpenResult Recording::open(const std::string& file) {
+        recorded.clear();
+        keys.clear();
+
+        FILE* f = fopen(file.c_str(), "rb");
+        if (f == nullptr) {
+            return NotARecording;
+        }
+
+        recording::Header header;
+        if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, recording::magic, sizeof(header.magic)) != 0) {
+            fclose(f);
+            return NotARecording;
+        }
+        if (header.version != recording::version) {
+            fclose(f);
+            return BadVersion;
+        }
+        if (header.scalarKind != (uint32_t) scalarKind || header.scalarSize != sizeof(Scalar)) {
+            fclose(f);
+            return WrongScalar;
+        }
+
+        OpenResult result = Ok;
+        recording::FrameHeader h;
+        std::vector<char> messageBytes;
+        std::vector<recording::Div> divs;
+        std::vector<recording::Command> commands;
+
+        while (fread(&h, sizeof(h), 1, f) == 1) {
+            keys.emplace_back();
+            auto& frameKeys = keys.back();
+
+            if (!readRecords(f, messageBytes, (size_t) h.messageBytes) ||
+                !readRecords(f, divs, h.divCount) ||
+                !readRecords(f, commands, h.commandCount) ||
+                !readRecords(f, frameKeys, h.keyBytes) ||
+                !validPreOrder(divs, commands, frameKeys.size())) {
+                result = Truncated;
+                break;
+            }
+
+            std::vector<std::vector<char>> frameMessages;
+            size_t pos = 0;
+            for (uint32_t i = 0; i < h.messageCount && pos + sizeof(uint32_t) <= messageBytes.size(); ++i) {
+                uint32_t size;
+                memcpy(&size, &messageBytes[pos], sizeof(size));
+                pos += sizeof(size);
+                if (pos + size > messageBytes.size()) {
+                    break;
+                }
+                frameMessages.emplace_back(messageBytes.begin() + pos, messageBytes.begin() + pos + size);
+                pos += size;
+            }
+
+            unflatten_state state = {divs, commands, frameKeys.data(), 0, 0};
+            recorded.emplace_back(RecordedFrame{
+                    h.timestampNs, std::move(frameMessages), unflatten(state), h.viewRect, (Hash) h.rootHash
+            });
+        }
+
+        fclose(f);
+        return result;
+    }
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "elfw-viewtree-resolve.h"
+#include "elfw-snapshot.h"
+
+namespace elfw {
+
+    // FRAME RECORDINGS
+    // ================
+    //
+    // A log of the messages fed to update() and the views they produced, so a
+    // session captured in the field can be replayed headless (see elfw-replay).
+    //
+    // [Header] then for every frame:
+    // [FrameHeader][messages][divs][commands][keys]
+    //
+    // The views are stored in pre-order (lazy placeholders are replaced by their
+    // contents, virtualized lists by their visible rows), each message as a
+    // uint32 size and its bytes. The strings of the Text commands and the
+    // segments of the Path commands are in the key table.
+
+    namespace recording {
+
+        static const char magic[8] = {'E', 'L', 'F', 'W', 'R', 'E', 'C', '1'};
+        static const uint32_t version = 1;
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t scalarKind, scalarSize;
+            uint32_t reserved;
+        };
+
+        struct FrameHeader {
+            // since the recorder was created
+            int64_t timestampNs;
+            uint64_t messageBytes;
+            uint32_t messageCount;
+            uint32_t divCount, commandCount;
+            uint32_t keyBytes;
+            // the viewRect the view was resolved in
+            Rect<Scalar> viewRect;
+            // the recursive hash of the resolved root, to check the replay
+            uint64_t rootHash;
+        };
+
+        // The Layout of a div (without its cache), hasLayout is 0 if it has none
+        struct Layout {
+            uint8_t hasLayout, direction, align, wrap;
+            uint32_t reserved;
+            Scalar gap, padding, grow;
+            Vec2<Scalar> size;
+        };
+
+        struct Div {
+            Frame<Scalar> frame;
+            uint64_t keyOffset;
+            uint32_t childCount, commandCount;
+            Layout layout;
+            uint32_t layer, reserved;
+        };
+
+        struct Command {
+            Frame<Scalar> frame;
+            snapshot::CommandOp op;
+        };
+    }
+
+
+    // Writes a recording. Messages are collected until the next frame.
+    class Recorder {
+    public:
+        // Does nothing if the file cannot be opened, or the name is empty (see isOpen())
+        explicit Recorder(const std::string& file);
+        ~Recorder();
+
+        Recorder(const Recorder&) = delete;
+        Recorder& operator=(const Recorder&) = delete;
+
+        bool isOpen() const { return out != nullptr; }
+
+        void message(const void* bytes, size_t size);
+
+        // Messages are stored as their bytes, so they have to be trivially copyable
+        template<typename Msg>
+        void message(const Msg& msg) {
+            static_assert(std::is_trivially_copyable<Msg>::value, "Recorded messages must be trivially copyable");
+            message(&msg, sizeof(Msg));
+        }
+
+        // Writes a frame with the messages since the last one
+        void frame(const Div& view, Rect<Scalar> viewRect, const ViewTreeWithHashes& resolved);
+
+    private:
+        FILE* out = nullptr;
+        std::chrono::steady_clock::time_point start;
+        std::vector<char> messages;
+        uint32_t messageCount = 0;
+    };
+
+
+    struct RecordedFrame {
+        int64_t timestampNs;
+        std::vector<std::vector<char>> messages;
+        Div view;
+        Rect<Scalar> viewRect;
+        Hash rootHash;
+    };
+
+
+    // Reads a whole recording into memory
+    class Recording {
+    public:
+        enum OpenResult { Ok, NotARecording, BadVersion, WrongScalar, Truncated };
+
+        OpenResult open(const std::string& file);
+
+        const std::vector<RecordedFrame>& frames() const { return recorded; }
+
+    private:
+        std::vector<RecordedFrame> recorded;
+        // the keys of the divs (and the strings of the texts) point into these
+        std::deque<std::vector<char>> keys;
+    };
+
+}
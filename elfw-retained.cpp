@@ -0,0 +1,379 @@
+#include "elfw-retained.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+    using namespace elfw;
+
+    std::unique_ptr<RetainedDiv> mirror(const ViewTreeWithHashes& tree, const ResolvedDiv& div) {
+        std::unique_ptr<RetainedDiv> r(new RetainedDiv{div.key, div.frame, {}, {}, div.layer, div.layerOrigin});
+
+        const auto cmds = tree.drawCommands.begin() + div.drawCommands.start;
+        r->commands.assign(cmds, cmds + div.drawCommands.size());
+
+        r->children.reserve(div.children.size());
+        for (size_t i = div.children.start; i < div.children.start + div.children.size(); ++i) {
+            r->children.emplace_back(mirror(tree, tree.divs[i]));
+        }
+        return r;
+    }
+
+
+    // The edits of a single list (children or commands) of a div
+    template<typename T>
+    struct list_edits {
+        // indices in the old list
+        std::vector<size_t> removed;
+        // indices in the new list and the element in the target tree
+        std::vector<std::pair<size_t, const T*>> added;
+        // new index -> old index
+        std::unordered_map<size_t, size_t> moved;
+        // new index -> new frame of the moved elements that changed position
+        std::vector<std::pair<size_t, Rect<Scalar>>> reframed;
+    };
+
+    struct div_edits {
+        list_edits<ResolvedDiv> children;
+        list_edits<draw::ResolvedCommand> commands;
+        // the div in the target tree if the props changed
+        const ResolvedDiv* props = nullptr;
+        // the length of its path (moved layers are processed parents first, the
+        // lists children first)
+        size_t depth = 0;
+    };
+
+    using edit_map = std::unordered_map<RetainedDiv*, div_edits>;
+
+
+    // Finds a div by its path in the old tree, nullptr if there is none (the
+    // patches may come from another process)
+    RetainedDiv* atPathA(RetainedDiv* root, const patch::DivPath& path) {
+        RetainedDiv* d = path.empty() ? nullptr : root;
+        for (size_t i = 1; i < path.size() && d != nullptr; ++i) {
+            d = path[i] >= 0 && (size_t) path[i] < d->children.size() ? d->children[path[i]].get() : nullptr;
+        }
+        return d;
+    }
+
+    // Finds a div by its path in the new tree (before any edits are applied, so
+    // the path has to go through the reorders of the parents)
+    RetainedDiv* atPathB(RetainedDiv* root, const patch::DivPath& path, const edit_map& edits) {
+        RetainedDiv* d = path.empty() ? nullptr : root;
+        for (size_t i = 1; i < path.size() && d != nullptr; ++i) {
+            if (path[i] < 0) {
+                return nullptr;
+            }
+            size_t idx = (size_t) path[i];
+            const auto e = edits.find(d);
+            if (e != edits.end()) {
+                const auto m = e->second.children.moved.find(idx);
+                if (m != e->second.children.moved.end()) {
+                    idx = m->second;
+                }
+            }
+            d = idx < d->children.size() ? d->children[idx].get() : nullptr;
+        }
+        return d;
+    }
+
+
+    // Only commands are moved to another frame by diff
+    void setFrame(draw::ResolvedCommand& c, const Rect<Scalar>& frame) { c.frame = frame; }
+    void setFrame(std::unique_ptr<RetainedDiv>&, const Rect<Scalar>&) { assert(false); }
+
+
+    // Checks that the edits rebuild a list of `size` elements: every index is
+    // in range and every old element is removed or ends up in one place
+    template<typename E>
+    bool validListEdits(size_t size, const list_edits<E>& edits) {
+        if (edits.removed.empty() && edits.added.empty() && edits.moved.empty()) {
+            return true;
+        }
+        if (edits.removed.size() > size) {
+            return false;
+        }
+
+        const size_t newSize = size - edits.removed.size() + edits.added.size();
+        std::vector<bool> oldUsed(size, false), newUsed(newSize, false);
+        std::vector<size_t> fromOld(newSize);
+        for (size_t i = 0; i < newSize; ++i) {
+            fromOld[i] = i;
+        }
+        for (const auto r : edits.removed) {
+            if (r >= size || oldUsed[r]) {
+                return false;
+            }
+            oldUsed[r] = true;
+        }
+        for (const auto& a : edits.added) {
+            if (a.first >= newSize || newUsed[a.first]) {
+                return false;
+            }
+            newUsed[a.first] = true;
+        }
+        for (const auto& m : edits.moved) {
+            if (m.first >= newSize || newUsed[m.first]) {
+                return false;
+            }
+            fromOld[m.first] = m.second;
+        }
+        for (size_t i = 0; i < newSize; ++i) {
+            if (!newUsed[i]) {
+                if (fromOld[i] >= size || oldUsed[fromOld[i]]) {
+                    return false;
+                }
+                oldUsed[fromOld[i]] = true;
+            }
+        }
+        return true;
+    }
+
+
+    // Rebuilds a list from the edits: the elements not added or moved keep their
+    // index (diff reports them as constant only if their index did not change)
+    template<typename T, typename E, typename Make>
+    void applyListEdits(std::vector<T>& list, const list_edits<E>& edits, Make&& make) {
+        if (edits.removed.empty() && edits.added.empty() && edits.moved.empty()) {
+            return;
+        }
+
+        const size_t newSize = list.size() - edits.removed.size() + edits.added.size();
+        std::vector<size_t> fromOld(newSize);
+        std::vector<const E*> addedAt(newSize, nullptr);
+        for (size_t i = 0; i < newSize; ++i) {
+            fromOld[i] = i;
+        }
+        for (const auto& m : edits.moved) {
+            fromOld[m.first] = m.second;
+        }
+        for (const auto& a : edits.added) {
+            addedAt[a.first] = a.second;
+        }
+
+        std::vector<T> out;
+        out.reserve(newSize);
+        for (size_t i = 0; i < newSize; ++i) {
+            if (addedAt[i] != nullptr) {
+                out.emplace_back(make(*addedAt[i]));
+            } else {
+                out.emplace_back(std::move(list[fromOld[i]]));
+            }
+        }
+        for (const auto& f : edits.reframed) {
+            setFrame(out[f.first], f.second);
+        }
+        list.swap(out);
+    }
+
+
+    // Only divs have props (commands are replaced instead)
+    void setProps(div_edits& e, const ResolvedDiv* div, size_t depth) {
+        e.props = div;
+        e.depth = depth;
+    }
+    void setProps(div_edits&, const draw::ResolvedCommand*, size_t) { assert(false); }
+
+
+    // Moves everything below the div (the children of a layer are resolved
+    // relative to its origin, diff does not patch them when it moves)
+    void moveChildren(RetainedDiv& div, Vec2<Scalar> delta) {
+        for (auto& c : div.children) {
+            c->frame.pos = c->frame.pos + delta;
+            c->layerOrigin = c->layerOrigin + delta;
+            for (auto& cmd : c->commands) {
+                cmd.frame.pos = cmd.frame.pos + delta;
+            }
+            moveChildren(*c, delta);
+        }
+    }
+
+    void moveLayer(RetainedDiv& div, const ResolvedDiv& target) {
+        if (div.layer && target.layer && !(div.layerOrigin == target.layerOrigin)) {
+            moveChildren(div, target.layerOrigin - div.layerOrigin);
+            div.layerOrigin = target.layerOrigin;
+        }
+    }
+
+
+    // The edits of the div, nullptr if the path led nowhere
+    div_edits* editsAt(edit_map& edits, RetainedDiv* div, const patch::DivPath& path) {
+        if (div == nullptr) {
+            return nullptr;
+        }
+        auto& e = edits[div];
+        e.depth = path.size();
+        return &e;
+    }
+
+
+    // Collects the edits of the patches by the div they edit, returns false if a
+    // path leads nowhere or a list is moved twice to the same place
+    template<typename T, typename EditsOf>
+    bool collectEdits(RetainedDiv* root, const std::vector<Patch<T>>& patches, edit_map& edits, EditsOf&& editsOf) {
+        bool ok = true;
+
+        // the moves first, as the paths in the new tree depend on them
+        for (const auto& p : patches) {
+            p.match(
+                    [&](const patch::Reorder<T>& r) {
+                        auto* e = editsAt(edits, atPathA(root, r.a.path), r.a.path);
+                        ok = ok && e != nullptr && editsOf(*e).moved.emplace(r.b.idx, r.a.idx).second;
+                    },
+                    // a reorder that also changes the frame (inside the same div)
+                    [&](const patch::Move<T>& m) {
+                        auto* e = editsAt(edits, atPathA(root, m.a.path), m.a.path);
+                        ok = ok && e != nullptr && editsOf(*e).moved.emplace(m.b.idx, m.a.idx).second;
+                        if (ok) {
+                            editsOf(*e).reframed.emplace_back(m.b.idx, *m.b.frame);
+                        }
+                    },
+                    [](const patch::Add<T>&) {},
+                    [](const patch::Remove<T>&) {},
+                    [](const patch::UpdateProps<T>&) {}
+            );
+        }
+        if (!ok) {
+            return false;
+        }
+
+        for (const auto& p : patches) {
+            p.match(
+                    [&](const patch::Add<T>& a) {
+                        auto* e = editsAt(edits, atPathB(root, a.b.path, edits), a.b.path);
+                        ok = ok && e != nullptr;
+                        if (ok) {
+                            editsOf(*e).added.emplace_back(a.b.idx, a.b.el);
+                        }
+                    },
+                    [&](const patch::Remove<T>& r) {
+                        auto* e = editsAt(edits, atPathA(root, r.a.path), r.a.path);
+                        ok = ok && e != nullptr;
+                        if (ok) {
+                            editsOf(*e).removed.emplace_back(r.a.idx);
+                        }
+                    },
+                    [](const patch::Reorder<T>&) {},
+                    [](const patch::Move<T>&) {},
+                    // the path is the path of the div itself
+                    [&](const patch::UpdateProps<T>& u) {
+                        auto* e = editsAt(edits, atPathA(root, u.a.path), u.a.path);
+                        ok = ok && e != nullptr;
+                        if (ok) {
+                            setProps(*e, u.b.el, u.a.path.size());
+                        }
+                    }
+            );
+        }
+        return ok;
+    }
+
+}
+
+
+namespace elfw {
+
+    RetainedTree::RetainedTree(const ViewTreeWithHashes& tree)
+            : rootDiv(mirror(tree, tree.divs[0])) {}
+
+
+    bool RetainedTree::apply(const ViewTreeWithHashes& target,
+                             const std::vector<CommandPatch>& patches,
+                             const std::vector<DivPatch>& divPatches,
+                             bool verify) {
+        // find every edited div before changing anything, so the paths stay
+        // valid, and leave the mirror untouched if the patches do not fit it
+        edit_map edits;
+        if (!collectEdits(rootDiv.get(), divPatches, edits,
+                          [](div_edits& e) -> list_edits<ResolvedDiv>& { return e.children; }) ||
+            !collectEdits(rootDiv.get(), patches, edits,
+                          [](div_edits& e) -> list_edits<draw::ResolvedCommand>& { return e.commands; })) {
+            return false;
+        }
+        for (const auto& e : edits) {
+            if (!validListEdits(e.first->children.size(), e.second.children) ||
+                !validListEdits(e.first->commands.size(), e.second.commands)) {
+                return false;
+            }
+        }
+
+        // move the layers before anything is added to them (the added divs and
+        // commands are already in place), the outer layers first
+        std::vector<std::pair<size_t, RetainedDiv*>> layers;
+        for (auto& e : edits) {
+            if (e.second.props != nullptr && e.second.props->layer) {
+                layers.emplace_back(e.second.depth, e.first);
+            }
+        }
+        std::sort(layers.begin(), layers.end(),
+                  [](const std::pair<size_t, RetainedDiv*>& a, const std::pair<size_t, RetainedDiv*>& b) {
+                      return a.first < b.first;
+                  });
+        for (const auto& l : layers) {
+            moveLayer(*l.second, *edits[l.second].props);
+        }
+
+        // the children first, so a div is edited before its parent removes it
+        std::vector<std::pair<size_t, RetainedDiv*>> order;
+        order.reserve(edits.size());
+        for (const auto& e : edits) {
+            order.emplace_back(e.second.depth, e.first);
+        }
+        std::sort(order.begin(), order.end(),
+                  [](const std::pair<size_t, RetainedDiv*>& a, const std::pair<size_t, RetainedDiv*>& b) {
+                      return a.first > b.first;
+                  });
+        for (const auto& o : order) {
+            RetainedDiv& div = *o.second;
+            const auto& e = edits[o.second];
+            if (e.props != nullptr) {
+                div.frame = e.props->frame;
+                div.layer = e.props->layer;
+                div.layerOrigin = e.props->layerOrigin;
+            }
+            applyListEdits(div.commands, e.commands, [](const draw::ResolvedCommand& c) { return c; });
+            applyListEdits(div.children, e.children, [&](const ResolvedDiv& d) { return mirror(target, d); });
+        }
+
+        // the root is never patched by diff (it has no parent to compare it in)
+        rootDiv->key = target.divs[0].key;
+        rootDiv->frame = target.divs[0].frame;
+
+        if (!verify) {
+            return true;
+        }
+
+        ViewTreeWithHashes result;
+        flatten(result);
+        return result.hashStore.divRecursive[0] == target.hashStore.divRecursive[0];
+    }
+
+
+    // Lays out the divs breadth first, so the children of each div are next to each other
+    void RetainedTree::flatten(ViewTreeWithHashes& out) const {
+        out.divs.clear();
+        out.drawCommands.clear();
+
+        std::vector<const RetainedDiv*> nodes = {rootDiv.get()};
+        out.divs.emplace_back(ResolvedDiv{rootDiv->key, rootDiv->frame, {0, 0}, {0, 0}, rootDiv->layer, rootDiv->layerOrigin});
+
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const auto& n = *nodes[i];
+
+            const size_t cmdStart = out.drawCommands.size();
+            out.drawCommands.insert(out.drawCommands.end(), n.commands.begin(), n.commands.end());
+
+            const size_t childStart = out.divs.size();
+            for (const auto& c : n.children) {
+                nodes.push_back(c.get());
+                out.divs.emplace_back(ResolvedDiv{c->key, c->frame, {0, 0}, {0, 0}, c->layer, c->layerOrigin});
+            }
+
+            out.divs[i].drawCommands = {cmdStart, out.drawCommands.size()};
+            out.divs[i].children = {childStart, out.divs.size()};
+        }
+
+        updateViewTreeHashes(out.divs[0], out.hashStore, out.drawCommands, out.divs);
+    }
+
+}
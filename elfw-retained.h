@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "elfw-diffing.h"
+
+namespace elfw {
+
+    // RETAINED TREES
+    // ==============
+    //
+    // A node based mirror of a resolved tree that is kept up to date by applying
+    // the patches of elfw::diff, instead of rebuilding it every frame. Only the
+    // divs named by the patches are visited (plus the child or command lists they
+    // edit), the rest of the tree is left untouched. The exception are moved
+    // layers: their descendants are not patched, so they are moved here.
+    //
+    // The keys point to the same strings as the keys of the resolved trees.
+
+    struct RetainedDiv {
+        const char* key;
+        Rect<Scalar> frame;
+        draw::ResolvedCommandList commands;
+        std::vector<std::unique_ptr<RetainedDiv>> children;
+        bool layer;
+        Vec2<Scalar> layerOrigin;
+    };
+
+
+    class RetainedTree {
+    public:
+        // Mirrors the tree
+        explicit RetainedTree(const ViewTreeWithHashes& tree);
+
+        const RetainedDiv& root() const { return *rootDiv; }
+
+        // Turns the mirror (`from`) into `target` using the patches of diff(from, target).
+        // The patches point into `target`, which is also where added subtrees are
+        // copied from. With `verify` the recursive hash of the result is checked
+        // against the target (O(tree), for debugging), returns false if they differ.
+        // Also returns false, before changing anything, if the paths or indices
+        // of the patches do not fit the mirror (decoded patches are not trusted).
+        bool apply(const ViewTreeWithHashes& target,
+                   const std::vector<CommandPatch>& patches,
+                   const std::vector<DivPatch>& divPatches,
+                   bool verify = false);
+
+        // Converts the mirror back to a resolved tree (with hashes)
+        void flatten(ViewTreeWithHashes& out) const;
+
+    private:
+        std::unique_ptr<RetainedDiv> rootDiv;
+    };
+
+}
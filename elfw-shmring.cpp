@@ -0,0 +1,257 @@
+#include "elfw-shmring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    using namespace elfw;
+
+    // The data starts on the cache line after the header
+    const size_t dataOffset = (sizeof(shmring::Header) + 63) / 64 * 64;
+
+    size_t roundUpToPowerOfTwo(size_t n) {
+        size_t p = 64;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+
+    // Copies into / out of the ring at a byte position, wrapping around the end
+    void copyIn(char* data, uint64_t capacity, uint64_t at, const void* bytes, size_t size) {
+        const size_t offset = (size_t) (at & (capacity - 1));
+        const size_t first = std::min(size, (size_t) capacity - offset);
+        memcpy(data + offset, bytes, first);
+        memcpy(data, static_cast<const char*>(bytes) + first, size - first);
+    }
+
+    void copyOut(const char* data, uint64_t capacity, uint64_t at, void* bytes, size_t size) {
+        const size_t offset = (size_t) (at & (capacity - 1));
+        const size_t first = std::min(size, (size_t) capacity - offset);
+        memcpy(bytes, data + offset, first);
+        memcpy(static_cast<char*>(bytes) + first, data, size - first);
+    }
+
+
+    // Checks if the other end of the socket was closed (the reader only ever
+    // closes it, so anything to read is the end of the stream too)
+    bool peerClosed(int socket) {
+        pollfd p = {socket, POLLIN, 0};
+        return poll(&p, 1, 0) > 0 && (p.revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+    }
+
+
+    bool sendFd(int socket, int fd) {
+        char byte = 0;
+        iovec iov = {&byte, 1};
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+
+        return sendmsg(socket, &msg, MSG_NOSIGNAL) == 1;
+    }
+
+    int receiveFd(int socket) {
+        char byte;
+        iovec iov = {&byte, 1};
+        char control[CMSG_SPACE(sizeof(int))];
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(socket, &msg, MSG_CMSG_CLOEXEC) != 1) {
+            return -1;
+        }
+        cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        if (c == nullptr || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+            return -1;
+        }
+        int fd;
+        memcpy(&fd, CMSG_DATA(c), sizeof(int));
+        return fd;
+    }
+}
+
+
+namespace elfw {
+
+    // Writer
+    // ======
+
+    ShmRingWriter::~ShmRingWriter() {
+        close();
+        if (header != nullptr) {
+            munmap(header, mappedSize);
+        }
+    }
+
+
+    bool ShmRingWriter::create(int s, size_t minCapacity) {
+        const size_t capacity = roundUpToPowerOfTwo(minCapacity);
+        const size_t size = dataOffset + capacity;
+
+        const int fd = memfd_create("elfw-shmring", MFD_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        void* mem = ftruncate(fd, (off_t) size) == 0
+                    ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                    : MAP_FAILED;
+        if (mem == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+
+        header = new(mem) shmring::Header();
+        header->capacity = capacity;
+        data = static_cast<char*>(mem) + dataOffset;
+        mappedSize = size;
+
+        // the reader maps its own copy, the fd is not needed after sending it
+        const bool sent = sendFd(s, fd);
+        ::close(fd);
+        if (sent) {
+            socket = s;
+        }
+        return sent;
+    }
+
+
+    bool ShmRingWriter::write(const void* bytes, size_t size) {
+        const uint64_t needed = sizeof(uint32_t) + size;
+        if (header == nullptr || gone || needed > header->capacity) {
+            return false;
+        }
+
+        // a reader that died never frees the ring, so check the socket now and then
+        const uint64_t tail = header->tail.load(std::memory_order_relaxed);
+        for (size_t spins = 1; header->capacity - (tail - header->head.load(std::memory_order_acquire)) < needed;
+             ++spins) {
+            if (spins % 256 == 0 && peerClosed(socket)) {
+                gone = true;
+                return false;
+            }
+            std::this_thread::yield();
+        }
+
+        const auto size32 = (uint32_t) size;
+        copyIn(data, header->capacity, tail, &size32, sizeof(size32));
+        copyIn(data, header->capacity, tail + sizeof(size32), bytes, size);
+        header->tail.store(tail + needed, std::memory_order_release);
+
+        // if the socket is full the reader has wake-ups pending anyway
+        const char wake = 0;
+        if (send(socket, &wake, 1, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && (errno == EPIPE || errno == ECONNRESET)) {
+            gone = true;
+        }
+        return true;
+    }
+
+
+    void ShmRingWriter::close() {
+        if (socket < 0) {
+            return;
+        }
+        header->closed.store(1, std::memory_order_release);
+        shutdown(socket, SHUT_WR);
+        socket = -1;
+    }
+
+
+    // Reader
+    // ======
+
+    ShmRingReader::~ShmRingReader() {
+        if (header != nullptr) {
+            munmap(header, mappedSize);
+        }
+    }
+
+
+    bool ShmRingReader::open(int s) {
+        const int fd = receiveFd(s);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        void* mem = fstat(fd, &st) == 0 && (size_t) st.st_size > dataOffset
+                    ? mmap(nullptr, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                    : MAP_FAILED;
+        ::close(fd);
+        if (mem == MAP_FAILED) {
+            return false;
+        }
+
+        header = static_cast<shmring::Header*>(mem);
+        data = static_cast<char*>(mem) + dataOffset;
+        mappedSize = (size_t) st.st_size;
+        if (dataOffset + header->capacity != mappedSize) {
+            munmap(mem, mappedSize);
+            header = nullptr;
+            return false;
+        }
+
+        socket = s;
+        return true;
+    }
+
+
+    bool ShmRingReader::read(std::vector<char>& message) {
+        if (header == nullptr) {
+            return false;
+        }
+
+        for (;;) {
+            const uint64_t head = header->head.load(std::memory_order_relaxed);
+            if (head != header->tail.load(std::memory_order_acquire)) {
+                uint32_t size;
+                copyOut(data, header->capacity, head, &size, sizeof(size));
+                message.resize(size);
+                copyOut(data, header->capacity, head + sizeof(size), message.data(), size);
+                header->head.store(head + sizeof(size) + size, std::memory_order_release);
+                return true;
+            }
+
+            // check the ring again, a last message may have been written before closing
+            if (writerGone || header->closed.load(std::memory_order_acquire) != 0) {
+                if (header->tail.load(std::memory_order_acquire) == head) {
+                    return false;
+                }
+                continue;
+            }
+
+            // wait for the next wake-up (the writer publishes before sending it)
+            char wake[256];
+            const ssize_t n = recv(socket, wake, sizeof(wake), 0);
+            if (n == 0 || (n < 0 && errno != EINTR)) {
+                writerGone = true;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace elfw {
+
+    // SHARED MEMORY RINGS
+    // ===================
+    //
+    // A single producer, single consumer byte ring in a memfd shared by two
+    // processes (Linux only). The writer creates the memfd and passes it over a
+    // connected Unix socket (SCM_RIGHTS), after which the socket only carries a
+    // wake-up byte per message for a reader waiting on an empty ring.
+    //
+    // Messages are stored as [uint32 size][bytes] and wrap around the end of the
+    // ring, so a message is copied once on each side. The writer spins while the
+    // ring is full, until the reader frees some of it or closes its socket.
+
+    namespace shmring {
+
+        struct Header {
+            uint64_t capacity;
+            std::atomic<uint32_t> closed;
+            // bytes written and read so far, on separate cache lines
+            alignas(64) std::atomic<uint64_t> head;
+            alignas(64) std::atomic<uint64_t> tail;
+        };
+    }
+
+
+    class ShmRingWriter {
+    public:
+        ShmRingWriter() = default;
+        ~ShmRingWriter();
+
+        ShmRingWriter(const ShmRingWriter&) = delete;
+        ShmRingWriter& operator=(const ShmRingWriter&) = delete;
+
+        // Creates a ring of at least `minCapacity` bytes and sends it to the
+        // reader at the other end of `socket`. Returns false on failure.
+        bool create(int socket, size_t minCapacity);
+
+        // Returns false if the message does not fit in the ring or the reader
+        // went away (see readerGone())
+        bool write(const void* bytes, size_t size);
+
+        // Set once a write found the socket of the reader closed (it exited or
+        // crashed), later writes fail
+        bool readerGone() const { return gone; }
+
+        // Lets the reader return false once it read everything
+        void close();
+
+        size_t capacity() const { return header != nullptr ? (size_t) header->capacity : 0; }
+
+    private:
+        int socket = -1;
+        bool gone = false;
+        shmring::Header* header = nullptr;
+        char* data = nullptr;
+        size_t mappedSize = 0;
+    };
+
+
+    class ShmRingReader {
+    public:
+        ShmRingReader() = default;
+        ~ShmRingReader();
+
+        ShmRingReader(const ShmRingReader&) = delete;
+        ShmRingReader& operator=(const ShmRingReader&) = delete;
+
+        // Waits for the ring from the writer at the other end of `socket`.
+        // Returns false on failure.
+        bool open(int socket);
+
+        // Waits for the next message. Returns false once the writer closed the
+        // ring (or went away) and all messages were read.
+        bool read(std::vector<char>& message);
+
+    private:
+        int socket = -1;
+        bool writerGone = false;
+        shmring::Header* header = nullptr;
+        char* data = nullptr;
+        size_t mappedSize = 0;
+    };
+
+}
@@ -0,0 +1,393 @@
+#include "elfw-snapshot.h"
+#include "elfw-paths.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    using namespace elfw;
+
+    const size_t sectionAlignment = 8;
+
+    size_t alignUp(size_t v) { return (v + sectionAlignment - 1) / sectionAlignment * sectionAlignment; }
+
+
+    template<typename T>
+    void writeAt(FILE* f, size_t& pos, size_t offset, const T* data, size_t count) {
+        static const char zeros[sectionAlignment] = {};
+        fwrite(zeros, 1, offset - pos, f);
+        fwrite(data, sizeof(T), count, f);
+        pos = offset + sizeof(T) * count;
+    }
+}
+
+
+namespace elfw {
+
+    namespace snapshot {
+
+        CommandOp toRecord(const draw::CommandOp& cmd, std::vector<char>& strings) {
+            using namespace elfw::draw;
+
+            CommandOp r;
+            memset(&r, 0, sizeof(r));
+
+            auto setFill = [&](const Fill& f) {
+                f.match(
+                        [&](const fill::None&) { r.fill = NoFill; },
+                        [&](const fill::Solid& s) {
+                            r.fill = SolidFill;
+                            r.fillColor = s;
+                        }
+                );
+            };
+
+            auto setStroke = [&](const Stroke& s) {
+                s.match(
+                        [&](const stroke::None&) { r.stroke = NoStroke; },
+                        [&](const stroke::Solid& solid) {
+                            r.stroke = SolidStroke;
+                            r.strokeWidth = solid.width;
+                            r.strokeColor = solid.color;
+                        }
+                );
+            };
+
+            cmd.match(
+                    [&](const cmds::Rectangle& x) {
+                        r.op = Rectangle;
+                        setFill(x.fill);
+                        setStroke(x.stroke);
+                    },
+                    [&](const cmds::RoundedRectangle& x) {
+                        r.op = RoundedRectangle;
+                        r.radius = x.radius;
+                        setFill(x.fill);
+                        setStroke(x.stroke);
+                    },
+                    [&](const cmds::Ellipse& x) {
+                        r.op = Ellipse;
+                        setFill(x.fill);
+                        setStroke(x.stroke);
+                    },
+                    [&](const cmds::Text& x) {
+                        r.op = Text;
+                        r.fill = SolidFill;
+                        r.fillColor = x.color;
+                        r.resource = x.font;
+                        r.textSize = x.size;
+                        r.dataOffset = strings.size();
+                        strings.insert(strings.end(), x.text, x.text + strlen(x.text) + 1);
+                    },
+                    [&](const cmds::Image& x) {
+                        r.op = Image;
+                        r.fill = SolidFill;
+                        r.fillColor = x.placeholder;
+                        r.resource = x.image;
+                    },
+                    [&](const cmds::Path& x) {
+                        r.op = Path;
+                        setFill(x.fill);
+                        setStroke(x.stroke);
+                        r.resource = (uint32_t) x.path->segments.size();
+                        r.dataOffset = strings.size();
+                        for (const auto& segment : x.path->segments) {
+                            PathSegment p = {(uint32_t) segment.verb, 0, {
+                                    segment.points[0].x, segment.points[0].y, segment.points[1].x,
+                                    segment.points[1].y, segment.points[2].x, segment.points[2].y
+                            }};
+                            const char* bytes = reinterpret_cast<const char*>(&p);
+                            strings.insert(strings.end(), bytes, bytes + sizeof(p));
+                        }
+                    }
+            );
+            return r;
+        }
+
+
+        draw::CommandOp fromRecord(const CommandOp& r, const char* strings) {
+            using namespace elfw::draw;
+
+            const Fill f = (r.fill == SolidFill) ? Fill{r.fillColor} : Fill{fill::none()};
+            const Stroke s = (r.stroke == SolidStroke)
+                             ? Stroke{stroke::Solid{r.strokeWidth, r.strokeColor}}
+                             : Stroke{stroke::none()};
+
+            switch (r.op) {
+                case RoundedRectangle:
+                    return cmds::RoundedRectangle{r.radius, f, s};
+                case Ellipse:
+                    return cmds::Ellipse{f, s};
+                case Text:
+                    return cmds::Text{strings + r.dataOffset, r.resource, r.textSize, r.fillColor};
+                case Image:
+                    return cmds::Image{r.resource, r.fillColor};
+                case Path: {
+                    std::vector<path::Segment> segments(r.resource);
+                    for (size_t i = 0; i < segments.size(); ++i) {
+                        PathSegment p;
+                        memcpy(&p, strings + r.dataOffset + i * sizeof(p), sizeof(p));
+                        segments[i] = path::Segment{(path::Verb) p.verb, {
+                                {p.points[0], p.points[1]}, {p.points[2], p.points[3]}, {p.points[4], p.points[5]}
+                        }};
+                    }
+                    return cmds::Path{paths::make(std::move(segments)), f, s};
+                }
+                default:
+                    return cmds::Rectangle{f, s};
+            }
+        }
+    }
+
+
+    // Writing
+    // =======
+
+    bool writeSnapshot(const std::string& file, const ViewTreeWithHashes& tree) {
+        const auto& store = tree.hashStore;
+        const HashVector* hashVectors[snapshot::HashSectionCount] = {
+                &store.divHeaders, &store.divProps, &store.divCommands, &store.divRecursive, &store.drawCommands,
+                &store.drawContents
+        };
+
+        std::vector<snapshot::Div> divs;
+        std::vector<char> keys;
+        divs.reserve(tree.divs.size());
+        for (const auto& d : tree.divs) {
+            const size_t keySize = strlen(d.key);
+            divs.emplace_back(snapshot::Div{
+                    d.frame, keys.size(),
+                    (uint32_t) d.drawCommands.start, (uint32_t) (d.drawCommands.start + d.drawCommands.size()),
+                    (uint32_t) d.children.start, (uint32_t) (d.children.start + d.children.size()),
+                    d.layerOrigin, d.layer ? 1u : 0u, 0
+            });
+            keys.insert(keys.end(), d.key, d.key + keySize + 1);
+        }
+
+        // the strings of the texts go after the keys, the segments of the paths
+        // into their own section (so the key table keeps ending with a '\0')
+        std::vector<snapshot::Command> commands;
+        std::vector<char> data, segments;
+        commands.reserve(tree.drawCommands.size());
+        for (const auto& c : tree.drawCommands) {
+            data.clear();
+            auto op = snapshot::toRecord(c.cmd, data);
+            auto& table = op.op == snapshot::Path ? segments : keys;
+            op.dataOffset += table.size();
+            table.insert(table.end(), data.begin(), data.end());
+            commands.emplace_back(snapshot::Command{c.frame, op});
+        }
+
+        // the hashes are stored as 64 bit whatever the size of Hash is
+        std::vector<uint64_t> hashes[snapshot::HashSectionCount];
+        for (size_t i = 0; i < snapshot::HashSectionCount; ++i) {
+            hashes[i].assign(hashVectors[i]->begin(), hashVectors[i]->end());
+        }
+
+        snapshot::Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, snapshot::magic, sizeof(header.magic));
+        header.version = snapshot::version;
+        header.scalarKind = (uint32_t) scalarKind;
+        header.scalarSize = sizeof(Scalar);
+        header.divCount = divs.size();
+        header.commandCount = commands.size();
+
+        size_t end = alignUp(sizeof(header));
+        header.divsOffset = end;
+        end = alignUp(end + divs.size() * sizeof(snapshot::Div));
+        header.commandsOffset = end;
+        end = alignUp(end + commands.size() * sizeof(snapshot::Command));
+        for (size_t i = 0; i < snapshot::HashSectionCount; ++i) {
+            header.hashOffsets[i] = end;
+            header.hashCounts[i] = hashes[i].size();
+            end = alignUp(end + hashes[i].size() * sizeof(uint64_t));
+        }
+        header.pathsOffset = end;
+        header.pathSegmentCount = segments.size() / sizeof(snapshot::PathSegment);
+        end = alignUp(end + segments.size());
+        header.keysOffset = end;
+
+        FILE* f = fopen(file.c_str(), "wb");
+        if (f == nullptr) {
+            return false;
+        }
+
+        size_t pos = 0;
+        writeAt(f, pos, 0, &header, 1);
+        writeAt(f, pos, (size_t) header.divsOffset, divs.data(), divs.size());
+        writeAt(f, pos, (size_t) header.commandsOffset, commands.data(), commands.size());
+        for (size_t i = 0; i < snapshot::HashSectionCount; ++i) {
+            writeAt(f, pos, (size_t) header.hashOffsets[i], hashes[i].data(), hashes[i].size());
+        }
+        writeAt(f, pos, (size_t) header.pathsOffset, segments.data(), segments.size());
+        writeAt(f, pos, (size_t) header.keysOffset, keys.data(), keys.size());
+
+        const bool ok = ferror(f) == 0;
+        return (fclose(f) == 0) && ok;
+    }
+
+
+    // Reading
+    // =======
+
+    Snapshot::~Snapshot() {
+#ifndef _WIN32
+        if (mapped != nullptr) {
+            munmap(const_cast<char*>(mapped), mappedSize);
+        }
+#endif
+    }
+
+
+    Snapshot::OpenResult Snapshot::open(const std::string& file) {
+#ifndef _WIN32
+        const int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return NotASnapshot;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(snapshot::Header)) {
+            close(fd);
+            return NotASnapshot;
+        }
+
+        void* p = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            return NotASnapshot;
+        }
+
+        const auto result = use(static_cast<const char*>(p), (size_t) st.st_size);
+        if (result != Ok) {
+            munmap(p, (size_t) st.st_size);
+            return result;
+        }
+
+        mapped = static_cast<const char*>(p);
+        mappedSize = (size_t) st.st_size;
+        return Ok;
+#else
+        // no mmap here, read the snapshot into memory instead
+        std::ifstream f(file, std::ios::in | std::ios::binary);
+        if (!f.good()) {
+            return NotASnapshot;
+        }
+        copy.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        return use(copy.data(), copy.size());
+#endif
+    }
+
+
+    // Checks the header, that the sections are inside the file and that every
+    // record points inside its section
+    Snapshot::OpenResult Snapshot::use(const char* bytes, size_t size) {
+        if (size < sizeof(snapshot::Header) || memcmp(bytes, snapshot::magic, sizeof(snapshot::magic)) != 0) {
+            return NotASnapshot;
+        }
+
+        const auto* h = reinterpret_cast<const snapshot::Header*>(bytes);
+        if (h->version != snapshot::version) {
+            return BadVersion;
+        }
+        if (h->scalarKind != (uint32_t) scalarKind || h->scalarSize != sizeof(Scalar)) {
+            return WrongScalar;
+        }
+
+        auto fits = [&](uint64_t offset, uint64_t count, size_t recordSize) {
+            return offset <= size && count <= (size - offset) / recordSize;
+        };
+        bool valid = fits(h->divsOffset, h->divCount, sizeof(snapshot::Div)) &&
+                     fits(h->commandsOffset, h->commandCount, sizeof(snapshot::Command)) &&
+                     fits(h->pathsOffset, h->pathSegmentCount, sizeof(snapshot::PathSegment)) &&
+                     h->keysOffset <= size;
+        for (size_t i = 0; i < snapshot::HashSectionCount; ++i) {
+            valid = valid && fits(h->hashOffsets[i], h->hashCounts[i], sizeof(uint64_t));
+        }
+        if (!valid) {
+            return NotASnapshot;
+        }
+
+        // the key table runs to the end of the file, every string in it ends
+        // with its last '\0'
+        const uint64_t keyBytes = size - h->keysOffset;
+        size_t stringEnd = (size_t) keyBytes;
+        while (stringEnd > 0 && bytes[h->keysOffset + stringEnd - 1] != '\0') {
+            --stringEnd;
+        }
+
+        const auto* divRecords = reinterpret_cast<const snapshot::Div*>(bytes + h->divsOffset);
+        for (size_t i = 0; i < h->divCount; ++i) {
+            const auto& d = divRecords[i];
+            if (d.keyOffset >= stringEnd || d.cmdStart > d.cmdEnd || d.cmdEnd > h->commandCount ||
+                d.childStart > d.childEnd || d.childEnd > h->divCount) {
+                return NotASnapshot;
+            }
+        }
+        const auto* commandRecords = reinterpret_cast<const snapshot::Command*>(bytes + h->commandsOffset);
+        for (size_t i = 0; i < h->commandCount; ++i) {
+            const auto& op = commandRecords[i].op;
+            const bool inside =
+                    op.op == snapshot::Text ? op.dataOffset < stringEnd
+                    : op.op == snapshot::Path ? op.dataOffset % sizeof(snapshot::PathSegment) == 0 &&
+                                                op.dataOffset / sizeof(snapshot::PathSegment) <= h->pathSegmentCount &&
+                                                op.resource <= h->pathSegmentCount -
+                                                               op.dataOffset / sizeof(snapshot::PathSegment)
+                    : true;
+            if (!inside) {
+                return NotASnapshot;
+            }
+        }
+
+        base = bytes;
+        header = h;
+        return Ok;
+    }
+
+
+    void Snapshot::load(ViewTreeWithHashes& out) const {
+        assert(isOpen());
+
+        out.divs.clear();
+        out.divs.reserve(divCount());
+        for (size_t i = 0; i < divCount(); ++i) {
+            const auto& d = divs()[i];
+            out.divs.emplace_back(ResolvedDiv{key(d), d.frame, {d.cmdStart, d.cmdEnd}, {d.childStart, d.childEnd},
+                                              d.layer != 0, d.layerOrigin});
+        }
+
+        out.drawCommands.clear();
+        out.drawCommands.reserve(commandCount());
+        const char* strings = base + header->keysOffset;
+        const char* segments = base + header->pathsOffset;
+        for (size_t i = 0; i < commandCount(); ++i) {
+            const auto& c = commands()[i];
+            out.drawCommands.emplace_back(draw::ResolvedCommand{
+                    c.frame, snapshot::fromRecord(c.op, c.op.op == snapshot::Path ? segments : strings)
+            });
+        }
+
+        auto& store = out.hashStore;
+        HashVector* hashVectors[snapshot::HashSectionCount] = {
+                &store.divHeaders, &store.divProps, &store.divCommands, &store.divRecursive, &store.drawCommands,
+                &store.drawContents
+        };
+        for (size_t i = 0; i < snapshot::HashSectionCount; ++i) {
+            const auto s = (snapshot::HashSection) i;
+            hashVectors[i]->assign(hashes(s), hashes(s) + hashCount(s));
+        }
+        // the bounds are not stored, they follow from the geometry
+        updateDivBounds(store, out.drawCommands, out.divs);
+    }
+
+}
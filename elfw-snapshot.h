@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "elfw-viewtree-resolve.h"
+
+namespace elfw {
+
+    // SNAPSHOTS
+    // =========
+    //
+    // A binary dump of a resolved frame (divs, draw commands and the hash store)
+    // that can be loaded back by memory mapping the file:
+    //
+    // [SnapshotHeader][divs][commands][hashes x 6][path segments][keys]
+    //
+    // The key table also holds the strings of the Text commands, the segments
+    // of the Path commands have a section of their own.
+    //
+    // All sections are arrays of fixed size records (8 byte aligned) so opening a
+    // snapshot only checks the header and that the records point inside their
+    // sections, the records are used in place. The geometry is stored as Scalar,
+    // so a snapshot can only be opened by a build with the same scalar type.
+
+    namespace snapshot {
+
+        static const char magic[8] = {'E', 'L', 'F', 'W', 'S', 'N', 'A', 'P'};
+        static const uint32_t version = 1;
+
+        // The hash vectors of the HashStore in file order
+        enum HashSection : uint32_t {
+            DivHeaders, DivProps, DivCommands, DivRecursive, DrawCommands, DrawContents, HashSectionCount
+        };
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            // ScalarKind and sizeof(Scalar) of the writer
+            uint32_t scalarKind, scalarSize;
+            uint32_t reserved;
+            uint64_t divCount, commandCount;
+            // offsets from the start of the file
+            uint64_t divsOffset, commandsOffset, keysOffset;
+            uint64_t pathsOffset, pathSegmentCount;
+            uint64_t hashOffsets[HashSectionCount];
+            uint64_t hashCounts[HashSectionCount];
+        };
+
+        struct Div {
+            Rect<Scalar> frame;
+            // offset of the (zero terminated) key in the key table
+            uint64_t keyOffset;
+            uint32_t cmdStart, cmdEnd;
+            uint32_t childStart, childEnd;
+            Vec2<Scalar> layerOrigin;
+            uint32_t layer, reserved;
+        };
+
+        // A draw::CommandOp flattened into a single record
+        enum Op : uint8_t { Rectangle, RoundedRectangle, Ellipse, Text, Image, Path };
+        enum FillKind : uint8_t { NoFill, SolidFill };
+        enum StrokeKind : uint8_t { NoStroke, SolidStroke };
+
+        struct CommandOp {
+            double radius;
+            double strokeWidth;
+            // the color of a Text and the placeholder of an Image are their fill
+            draw::Color fillColor, strokeColor;
+            uint8_t op, fill, stroke;
+            uint8_t reserved;
+            // the font of a Text, the image of an Image, the segment count of a Path
+            uint32_t resource;
+            double textSize;
+            // the (zero terminated) string of a Text or the PathSegments of a
+            // Path in a string table (not aligned, a snapshot keeps the
+            // segments in a section of their own)
+            uint64_t dataOffset;
+        };
+
+        struct PathSegment {
+            uint32_t verb, reserved;
+            double points[6];
+        };
+
+        struct Command {
+            Rect<Scalar> frame;
+            CommandOp op;
+        };
+
+        // The string of a Text (or the segments of a Path) is appended to `strings`
+        CommandOp toRecord(const draw::CommandOp& cmd, std::vector<char>& strings);
+        // The string of a Text points into `strings`, the segments of a Path are copied
+        draw::CommandOp fromRecord(const CommandOp& r, const char* strings);
+    }
+
+
+    // Writes the tree to `file`. Returns false if the file cannot be written.
+    bool writeSnapshot(const std::string& file, const ViewTreeWithHashes& tree);
+
+
+    // A read-only, memory mapped snapshot
+    class Snapshot {
+    public:
+        enum OpenResult { Ok, NotASnapshot, BadVersion, WrongScalar };
+
+        Snapshot() = default;
+        ~Snapshot();
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        OpenResult open(const std::string& file);
+
+        bool isOpen() const { return header != nullptr; }
+
+        size_t divCount() const { return (size_t) header->divCount; }
+        size_t commandCount() const { return (size_t) header->commandCount; }
+
+        const snapshot::Div* divs() const { return reinterpret_cast<const snapshot::Div*>(base + header->divsOffset); }
+
+        const snapshot::Command* commands() const {
+            return reinterpret_cast<const snapshot::Command*>(base + header->commandsOffset);
+        }
+
+        const uint64_t* hashes(snapshot::HashSection s) const {
+            return reinterpret_cast<const uint64_t*>(base + header->hashOffsets[s]);
+        }
+
+        size_t hashCount(snapshot::HashSection s) const { return (size_t) header->hashCounts[s]; }
+
+        const char* key(const snapshot::Div& d) const { return base + header->keysOffset + d.keyOffset; }
+
+        // Builds the resolved tree (for diffing against it). The keys of the divs
+        // (and the strings of the texts) point into the snapshot, so it has to
+        // stay open while `out` is used.
+        void load(ViewTreeWithHashes& out) const;
+
+    private:
+        OpenResult use(const char* bytes, size_t size);
+
+        const char* base = nullptr;
+        const snapshot::Header* header = nullptr;
+
+        const char* mapped = nullptr;
+        size_t mappedSize = 0;
+#ifdef _WIN32
+        std::vector<char> copy;
+#endif
+    };
+
+}
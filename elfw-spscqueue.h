@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+namespace elfw {
+
+    namespace containers {
+
+        // Bounded lock-free single-producer single-consumer ring buffer.
+        //
+        // Exactly one thread may call push() and exactly one (other) thread
+        // may call pop(). The capacity is rounded up to a power of two.
+        template<typename T>
+        class SpscQueue {
+        public:
+            explicit SpscQueue(std::size_t minCapacity)
+                    : slots(roundUpToPowerOfTwo(minCapacity + 1)), mask(slots.size() - 1), head(0), tail(0) {}
+
+            SpscQueue(const SpscQueue&) = delete;
+            SpscQueue& operator=(const SpscQueue&) = delete;
+
+            // Returns false if the queue is full
+            bool push(const T& v) {
+                const auto t = tail.load(std::memory_order_relaxed);
+                const auto next = (t + 1) & mask;
+                if (next == head.load(std::memory_order_acquire)) return false;
+
+                slots[t] = v;
+                tail.store(next, std::memory_order_release);
+                return true;
+            }
+
+            // Returns false if the queue is empty
+            bool pop(T& out) {
+                const auto h = head.load(std::memory_order_relaxed);
+                if (h == tail.load(std::memory_order_acquire)) return false;
+
+                out = slots[h];
+                head.store((h + 1) & mask, std::memory_order_release);
+                return true;
+            }
+
+            bool empty() const {
+                return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+            }
+
+            std::size_t capacity() const { return mask; }
+
+        private:
+            static std::size_t roundUpToPowerOfTwo(std::size_t n) {
+                std::size_t p = 2;
+                while (p < n) p <<= 1;
+                return p;
+            }
+
+            std::vector<T> slots;
+            const std::size_t mask;
+
+            // keep the producer and consumer indices on separate cache lines
+            alignas(64) std::atomic<std::size_t> head;
+            alignas(64) std::atomic<std::size_t> tail;
+        };
+
+    }
+}
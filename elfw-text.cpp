@@ -0,0 +1,327 @@
+#include "elfw-text.h"
+#include "elfw-layout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <unordered_set>
+
+// nanovg compiles stb_truetype into its own library (through fontstash), so
+// keep this copy private to the translation unit
+#define STBTT_STATIC
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "vendor/nanovg/src/stb_truetype.h"
+
+namespace {
+    using namespace elfw;
+
+    struct loaded_font {
+        std::vector<unsigned char> data;
+        stbtt_fontinfo info;
+        // vertical metrics in font units
+        int ascent, descent;
+    };
+
+    // The loaded fonts (a font is looked up while another one is added from
+    // another thread)
+    std::mutex fontsMutex;
+    std::deque<loaded_font> fonts;
+
+    const loaded_font* findFont(draw::FontId id) {
+        std::lock_guard<std::mutex> lock(fontsMutex);
+        return id < fonts.size() ? &fonts[id] : nullptr;
+    }
+
+
+    std::mutex stringsMutex;
+    std::unordered_set<std::string> strings;
+
+
+    // Decodes the next UTF-8 codepoint (U+FFFD for invalid sequences)
+    int nextCodepoint(const char*& s) {
+        const auto* p = reinterpret_cast<const unsigned char*>(s);
+        const unsigned char c = *p;
+        const int length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 0;
+        if (length == 0) {
+            ++s;
+            return 0xfffd;
+        }
+        int cp = length == 1 ? c : c & (0x7f >> length);
+        for (int i = 1; i < length; ++i) {
+            if ((p[i] & 0xc0) != 0x80) {
+                s += i;
+                return 0xfffd;
+            }
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        s += length;
+        return cp;
+    }
+
+
+    Hash hashString(const char* s) {
+        Hash h = 0;
+        for (; *s != '\0'; ++s) {
+            h = combineHashes(h, (Hash) (unsigned char) *s);
+        }
+        return h;
+    }
+
+
+    // Glyphs are 1 pixel apart in the atlas so the coverage does not bleed
+    const int glyphPadding = 1;
+}
+
+
+namespace elfw {
+
+    namespace text {
+
+        draw::FontId addFont(std::vector<unsigned char> ttf) {
+            std::lock_guard<std::mutex> lock(fontsMutex);
+            fonts.emplace_back();
+            auto& f = fonts.back();
+            f.data = std::move(ttf);
+
+            const int offset = f.data.empty() ? -1 : stbtt_GetFontOffsetForIndex(f.data.data(), 0);
+            if (offset < 0 || !stbtt_InitFont(&f.info, f.data.data(), offset)) {
+                fonts.pop_back();
+                return noFont;
+            }
+            int lineGap;
+            stbtt_GetFontVMetrics(&f.info, &f.ascent, &f.descent, &lineGap);
+            return (draw::FontId) (fonts.size() - 1);
+        }
+
+
+        draw::FontId loadFont(const std::string& file) {
+            FILE* f = fopen(file.c_str(), "rb");
+            if (f == nullptr) {
+                return noFont;
+            }
+            std::vector<unsigned char> bytes;
+            unsigned char buffer[4096];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+                bytes.insert(bytes.end(), buffer, buffer + n);
+            }
+            fclose(f);
+            return addFont(std::move(bytes));
+        }
+
+
+        const char* intern(const std::string& s) {
+            std::lock_guard<std::mutex> lock(stringsMutex);
+            return strings.insert(s).first->c_str();
+        }
+
+
+        TextCache& sharedCache() {
+            static TextCache cache(TextCacheOptions{512, 4 * 512 * 512, 1024});
+            return cache;
+        }
+    }
+
+
+    // Text cache
+    // ==========
+
+    TextCache::TextCache(const TextCacheOptions& options) : options(options) {}
+
+
+    Hash TextCache::KeyHash::operator()(const ShapeKey& k) const {
+        return combineHashes(combineHashes(std::hash<uint32_t>()(k.font), std::hash<double>()(k.size)), k.text);
+    }
+
+    Hash TextCache::KeyHash::operator()(const GlyphKey& k) const {
+        return combineHashes(combineHashes(std::hash<uint32_t>()(k.font), std::hash<int>()(k.glyph)),
+                             std::hash<double>()(k.pixelSize));
+    }
+
+
+    const ShapedText& TextCache::shape(draw::FontId font, double size, const char* text) {
+        const ShapeKey key = {font, size, hashString(text)};
+        auto it = shaped.find(key);
+        if (it != shaped.end() && it->second.text == text) {
+            shapeLru.splice(shapeLru.begin(), shapeLru, it->second.lru);
+            ++stats.shapeHits;
+            return it->second.shaped;
+        }
+        ++stats.shapeMisses;
+
+        ShapedText run = {{}, 0, 0, 0};
+        if (const loaded_font* f = findFont(font)) {
+            const double scale = stbtt_ScaleForPixelHeight(&f->info, (float) size);
+            run.ascent = f->ascent * scale;
+            run.descent = -f->descent * scale;
+
+            int pen = 0, previous = -1;
+            for (const char* s = text; *s != '\0';) {
+                const int g = stbtt_FindGlyphIndex(&f->info, nextCodepoint(s));
+                if (previous >= 0) {
+                    pen += stbtt_GetGlyphKernAdvance(&f->info, previous, g);
+                }
+                int advance, bearing;
+                stbtt_GetGlyphHMetrics(&f->info, g, &advance, &bearing);
+                run.glyphs.push_back(ShapedGlyph{g, pen * scale});
+                pen += advance;
+                previous = g;
+            }
+            run.width = pen * scale;
+        }
+
+        if (it != shaped.end()) {
+            // another string with the same hash
+            it->second.text = text;
+            it->second.shaped = std::move(run);
+            shapeLru.splice(shapeLru.begin(), shapeLru, it->second.lru);
+            return it->second.shaped;
+        }
+
+        while (shaped.size() >= std::max<size_t>(options.shapedRuns, 1)) {
+            shaped.erase(shapeLru.back());
+            shapeLru.pop_back();
+        }
+        shapeLru.push_front(key);
+        return shaped.emplace(key, ShapeEntry{text, std::move(run), shapeLru.begin()}).first->second.shaped;
+    }
+
+
+    bool TextCache::place(Page& p, int w, int h, Vec2<int>& pos) {
+        const int side = options.pageSize;
+        for (auto& shelf : p.shelves) {
+            // shelves much higher than the glyph waste too much space
+            if (h <= shelf.height && h * 2 >= shelf.height && shelf.x + w <= side) {
+                pos = {shelf.x, shelf.y};
+                shelf.x += w + glyphPadding;
+                return true;
+            }
+        }
+        const int top = p.shelves.empty() ? 0 : p.shelves.back().y + p.shelves.back().height + glyphPadding;
+        if (top + h > side || w > side) {
+            return false;
+        }
+        p.shelves.push_back(Shelf{top, h, w + glyphPadding});
+        pos = {0, top};
+        return true;
+    }
+
+
+    bool TextCache::allocate(int w, int h, std::size_t& page, Vec2<int>& pos) {
+        const int side = options.pageSize;
+        if (w > side || h > side) {
+            return false;
+        }
+        for (size_t i = 0; i < pages.size(); ++i) {
+            if (place(pages[i], w, h, pos)) {
+                page = i;
+                return true;
+            }
+        }
+
+        const size_t pageBytes = (size_t) side * side;
+        if (pages.empty() || (pages.size() + 1) * pageBytes <= options.atlasBudgetBytes) {
+            pages.push_back(Page{std::vector<uint8_t>(pageBytes, 0), {}, {}, tick});
+            stats.atlasBytes += pageBytes;
+            page = pages.size() - 1;
+            return place(pages.back(), w, h, pos);
+        }
+
+        // clear the least recently used page
+        page = 0;
+        for (size_t i = 1; i < pages.size(); ++i) {
+            if (pages[i].lastUsed < pages[page].lastUsed) {
+                page = i;
+            }
+        }
+        auto& p = pages[page];
+        for (const auto& k : p.glyphs) {
+            atlasGlyphs.erase(k);
+        }
+        p.glyphs.clear();
+        p.shelves.clear();
+        std::fill(p.pixels.begin(), p.pixels.end(), 0);
+        ++stats.pageEvictions;
+        return place(p, w, h, pos);
+    }
+
+
+    const TextCache::AtlasGlyph* TextCache::glyph(const GlyphKey& key) {
+        auto it = atlasGlyphs.find(key);
+        if (it != atlasGlyphs.end()) {
+            ++stats.glyphHits;
+            if (it->second.size.x > 0 && it->second.size.y > 0) {
+                pages[it->second.page].lastUsed = tick;
+            }
+            return &it->second;
+        }
+        ++stats.glyphMisses;
+
+        const loaded_font* f = findFont(key.font);
+        if (f == nullptr) {
+            return nullptr;
+        }
+        const float scale = stbtt_ScaleForPixelHeight(&f->info, (float) key.pixelSize);
+        int x0, y0, x1, y1;
+        stbtt_GetGlyphBitmapBox(&f->info, key.glyph, scale, scale, &x0, &y0, &x1, &y1);
+
+        AtlasGlyph g = {0, {0, 0}, {x0, y0}, {x1 - x0, y1 - y0}};
+        if (g.size.x > 0 && g.size.y > 0) {
+            if (!allocate(g.size.x, g.size.y, g.page, g.atlasPos)) {
+                return nullptr;
+            }
+            auto& p = pages[g.page];
+            stbtt_MakeGlyphBitmap(&f->info, &p.pixels[(size_t) g.atlasPos.y * options.pageSize + g.atlasPos.x],
+                                  g.size.x, g.size.y, options.pageSize, scale, scale, key.glyph);
+            p.glyphs.push_back(key);
+            p.lastUsed = tick;
+        }
+        return &atlasGlyphs.emplace(key, g).first->second;
+    }
+
+
+    Vec2<double> TextCache::measure(draw::FontId font, double size, const char* text) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto& run = shape(font, size, text);
+        return {run.width, run.ascent + run.descent};
+    }
+
+
+    void TextCache::glyphs(const draw::cmds::Text& t, double devicePixelRatio,
+                           const std::function<void(const GlyphBitmap&, Vec2<int>)>& f) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++tick;
+        const auto& run = shape(t.font, t.size, t.text);
+        const double pixelSize = t.size * devicePixelRatio;
+        const int baseline = (int) std::floor(run.ascent * devicePixelRatio + 0.5);
+
+        for (const auto& sg : run.glyphs) {
+            const AtlasGlyph* g = glyph(GlyphKey{t.font, sg.glyph, pixelSize});
+            if (g == nullptr || g->size.x <= 0 || g->size.y <= 0) {
+                continue;
+            }
+            const auto& p = pages[g->page];
+            const GlyphBitmap bitmap = {
+                    &p.pixels[(size_t) g->atlasPos.y * options.pageSize + g->atlasPos.x], options.pageSize,
+                    g->offset, g->size
+            };
+            f(bitmap, {(int) std::floor(sg.x * devicePixelRatio + 0.5), baseline});
+        }
+    }
+
+
+    TextStats TextCache::getStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+
+    Div label(const char* key, const Frame<Scalar>& frame, draw::FontId font, double size, draw::Color color,
+              const char* text) {
+        const auto m = text::sharedCache().measure(font, size, text);
+        const Div div = {key, frame, {}, {draw::Command{frame::full<Scalar>, draw::cmds::Text{text, font, size, color}}}};
+        return sized(div, {Scalar(std::ceil(m.x)), Scalar(std::ceil(m.y))});
+    }
+
+}
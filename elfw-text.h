@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "elfw-viewtree.h"
+#include "elfw-hashing.h"
+
+namespace elfw {
+
+    // TEXT
+    // ====
+    //
+    // Single line labels (cmds::Text) in TrueType fonts, loaded and rasterized
+    // with stb_truetype (vendor/nanovg/src).
+    //
+    // Drawing a label shapes it (codepoints to glyphs, advances and kerning),
+    // then copies the coverage of its glyphs from an atlas. Both steps are
+    // cached by a TextCache, so a label drawn again is two lookups:
+    //
+    // - the shaped runs are keyed by (font, size, hash of the string) and also
+    //   give the measurements for the layout. The least recently used runs are
+    //   dropped past `shapedRuns`.
+    // - the glyphs are keyed by (font, glyph, size in device pixels) and packed
+    //   into shelves of square 8 bit atlas pages. When a glyph fits in no page
+    //   and the pages use the whole budget, the least recently used page is
+    //   cleared (with all its glyphs) for it.
+    //
+    // The fonts and interned strings are kept for the lifetime of the program.
+
+    namespace text {
+
+        static const draw::FontId noFont = ~0u;
+
+        // Loads a TrueType font file, returns noFont if it cannot be read or is not a font
+        draw::FontId loadFont(const std::string& file);
+
+        // Same from the bytes of the font
+        draw::FontId addFont(std::vector<unsigned char> ttf);
+
+        // A copy of the string that lives as long as the program (for the
+        // labels that are not literals)
+        const char* intern(const std::string& s);
+    }
+
+
+    struct TextCacheOptions {
+        // the side of the atlas pages in pixels
+        int pageSize;
+        // the most atlas bytes (at least one page is kept)
+        std::size_t atlasBudgetBytes;
+        // the most shaped runs kept
+        std::size_t shapedRuns;
+    };
+
+    struct TextStats {
+        // shaped runs found / shaped again, glyphs found in the atlas / rasterized
+        std::size_t shapeHits, shapeMisses, glyphHits, glyphMisses;
+        // atlas pages cleared to stay in the budget, and the bytes of the pages
+        std::size_t pageEvictions, atlasBytes;
+    };
+
+
+    // A glyph of a shaped run, its pen position in pixels from the start of the
+    // run (at a device pixel ratio of 1)
+    struct ShapedGlyph {
+        int glyph;
+        double x;
+    };
+
+    struct ShapedText {
+        std::vector<ShapedGlyph> glyphs;
+        // the advance of the whole run, the extent above and below the baseline
+        double width, ascent, descent;
+    };
+
+    // The coverage of a glyph in the atlas, `pos` is its top left corner in
+    // device pixels from the pen position on the baseline
+    struct GlyphBitmap {
+        const uint8_t* pixels;
+        int stride;
+        Vec2<int> pos, size;
+    };
+
+
+    // Can be used from several threads (the layout measures while the raster draws)
+    class TextCache {
+    public:
+        explicit TextCache(const TextCacheOptions& options);
+
+        // The width of the label and its line height (ascent + descent) in pixels
+        Vec2<double> measure(draw::FontId font, double size, const char* text);
+
+        // Calls `f` with each glyph of the label and its pen position on the
+        // baseline, in whole device pixels from the top left corner of the run.
+        // The bitmaps are only valid in `f`.
+        void glyphs(const draw::cmds::Text& t, double devicePixelRatio,
+                    const std::function<void(const GlyphBitmap&, Vec2<int>)>& f);
+
+        TextStats getStats();
+
+    private:
+        struct ShapeKey {
+            draw::FontId font;
+            double size;
+            Hash text;
+
+            bool operator==(const ShapeKey& o) const { return font == o.font && size == o.size && text == o.text; }
+        };
+
+        struct GlyphKey {
+            draw::FontId font;
+            int glyph;
+            double pixelSize;
+
+            bool operator==(const GlyphKey& o) const {
+                return font == o.font && glyph == o.glyph && pixelSize == o.pixelSize;
+            }
+        };
+
+        struct KeyHash {
+            Hash operator()(const ShapeKey& k) const;
+            Hash operator()(const GlyphKey& k) const;
+        };
+
+        struct ShapeEntry {
+            // to tell strings with the same hash apart
+            std::string text;
+            ShapedText shaped;
+            std::list<ShapeKey>::iterator lru;
+        };
+
+        struct AtlasGlyph {
+            std::size_t page;
+            Vec2<int> atlasPos, offset, size;
+        };
+
+        // Glyphs are placed left to right on shelves as high as their first glyph
+        struct Shelf {
+            int y, height, x;
+        };
+
+        struct Page {
+            std::vector<uint8_t> pixels;
+            std::vector<Shelf> shelves;
+            // the glyphs on the page, to remove when it is cleared
+            std::vector<GlyphKey> glyphs;
+            std::uint64_t lastUsed;
+        };
+
+        const ShapedText& shape(draw::FontId font, double size, const char* text);
+
+        // Returns the glyph, rasterizing it if needed, or nullptr if it does not fit in a page
+        const AtlasGlyph* glyph(const GlyphKey& key);
+
+        // Finds room for a w x h bitmap, clearing the least recently used page if needed
+        bool allocate(int w, int h, std::size_t& page, Vec2<int>& pos);
+
+        bool place(Page& p, int w, int h, Vec2<int>& pos);
+
+        TextCacheOptions options;
+        std::mutex mutex;
+
+        std::unordered_map<ShapeKey, ShapeEntry, KeyHash> shaped;
+        // the keys of the shaped runs, most recently used first
+        std::list<ShapeKey> shapeLru;
+
+        std::unordered_map<GlyphKey, AtlasGlyph, KeyHash> atlasGlyphs;
+        std::vector<Page> pages;
+        std::uint64_t tick = 0;
+
+        TextStats stats = {0, 0, 0, 0, 0, 0};
+    };
+
+
+    namespace text {
+
+        // The cache the raster draws with and label() measures with
+        TextCache& sharedCache();
+    }
+
+
+    // A div with a single Text command, sized to the label for stacks (see elfw-layout.h)
+    Div label(const char* key, const Frame<Scalar>& frame, draw::FontId font, double size, draw::Color color,
+              const char* text);
+
+}
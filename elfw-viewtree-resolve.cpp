@@ -1,42 +1,294 @@
 #include "elfw-viewtree-resolve.h"
+#include "elfw-lazy.h"
+#include "elfw-framebatch.h"
+#include "elfw-virtuallist.h"
+#include "elfw-layout.h"
 
 
 
 namespace {
     using namespace elfw;
 
-    draw::ResolvedCommand resolveCommand(Rect<double> viewRect, const draw::Command& cmd) {
-        return { frame::resolve(cmd.frame, viewRect), cmd.cmd };
+    // Appends the commands of a div to the list, resolving their frames in one batch
+    mkz::index_slice<draw::ResolvedCommand> resolveCommands(
+            Rect<Scalar> viewRect,
+            const decltype(Div::drawCommands)& cmds,
+            draw::ResolvedCommandList& commandList,
+            FrameBatch<Scalar>& batch
+    ) {
+        const size_t start = commandList.size();
+        if (cmds.empty()) {
+            return {start, start};
+        }
+
+        batch.clear();
+        for (const auto& cmd : cmds) {
+            batch.push_back(cmd.frame);
+            // the frame is filled in below
+            commandList.emplace_back(draw::ResolvedCommand{rect::none<Scalar>, cmd.cmd});
+        }
+
+        frame::resolve(batch, viewRect, &commandList[start].frame, sizeof(draw::ResolvedCommand));
+        return {start, commandList.size()};
+    }
+
+
+    // Shifts a slice starting at `from` to start at `to`
+    template<typename T>
+    mkz::index_slice<T> shiftSlice(const mkz::index_slice<T>& s, size_t from, size_t to) {
+        return {s.start - from + to, s.start - from + to + s.size()};
+    }
+
+
+    // A lazy subtree resolved in this frame, to be stored in its node after hashing
+    struct lazy_record {
+        LazyNode* node;
+        Rect<Scalar> viewRect;
+        ResolvedDiv root;
+        // the descendants and the commands of the subtree
+        size_t divStart, divEnd, cmdStart, cmdEnd;
+        bool movable;
+    };
+
+    struct lazy_state {
+        std::vector<CachedHashes> cachedHashes;
+        std::vector<lazy_record> records;
+    };
+
+
+    // Appends the resolved subtree of the node from the last frame and returns its root
+    ResolvedDiv spliceLazy(
+            const LazyNode& node,
+            draw::ResolvedCommandList& commandList,
+            std::vector<ResolvedDiv>& divList,
+            lazy_state& lazyState
+    ) {
+        const auto& tree = node.tree;
+        const size_t divBase = divList.size(), cmdBase = commandList.size();
+
+        commandList.insert(commandList.end(), tree.drawCommands.begin(), tree.drawCommands.end());
+        auto shifted = [&](const ResolvedDiv& d) {
+            ResolvedDiv r = d;
+            r.drawCommands = shiftSlice(d.drawCommands, 0, cmdBase);
+            r.children = shiftSlice(d.children, 1, divBase);
+            return r;
+        };
+        for (size_t i = 1; i < tree.divs.size(); ++i) {
+            divList.emplace_back(shifted(tree.divs[i]));
+        }
+
+        lazyState.cachedHashes.emplace_back(CachedHashes{
+                &tree.hashStore,
+                1, divBase, tree.divs.size() - 1,
+                0, cmdBase, tree.drawCommands.size()
+        });
+
+        return shifted(tree.divs[0]);
+    }
+
+
+    // Same as spliceLazy, but moves the subtree by `delta` (its hashes cover the
+    // old positions, so they are not reused)
+    ResolvedDiv spliceMovedLazy(
+            const LazyNode& node,
+            Vec2<Scalar> delta,
+            draw::ResolvedCommandList& commandList,
+            std::vector<ResolvedDiv>& divList
+    ) {
+        const auto& tree = node.tree;
+        const size_t divBase = divList.size(), cmdBase = commandList.size();
+
+        commandList.insert(commandList.end(), tree.drawCommands.begin(), tree.drawCommands.end());
+        for (size_t i = cmdBase; i < commandList.size(); ++i) {
+            commandList[i].frame.pos = commandList[i].frame.pos + delta;
+        }
+        auto moved = [&](const ResolvedDiv& d) {
+            ResolvedDiv r = d;
+            r.frame.pos = r.frame.pos + delta;
+            if (r.layer) {
+                r.layerOrigin = r.layerOrigin + delta;
+            }
+            r.drawCommands = shiftSlice(d.drawCommands, 0, cmdBase);
+            r.children = shiftSlice(d.children, 1, divBase);
+            return r;
+        };
+        for (size_t i = 1; i < tree.divs.size(); ++i) {
+            divList.emplace_back(moved(tree.divs[i]));
+        }
+
+        return moved(tree.divs[0]);
+    }
+
+
+    // Stores the resolved subtree and its hashes in the lazy node
+    void recordLazy(const lazy_record& r, const Rect<Scalar>& viewport, const ViewTreeWithHashes& v) {
+        auto& tree = r.node->tree;
+        const auto& hashes = v.hashStore;
+
+        tree.drawCommands.assign(v.drawCommands.begin() + r.cmdStart, v.drawCommands.begin() + r.cmdEnd);
+
+        auto toLocal = [&](const ResolvedDiv& d) {
+            ResolvedDiv local = d;
+            local.drawCommands = shiftSlice(d.drawCommands, r.cmdStart, 0);
+            local.children = shiftSlice(d.children, r.divStart, 1);
+            return local;
+        };
+
+        tree.divs.clear();
+        tree.divs.emplace_back(toLocal(r.root));
+        for (size_t i = r.divStart; i < r.divEnd; ++i) {
+            tree.divs.emplace_back(toLocal(v.divs[i]));
+        }
+
+        // the root (at 0) is re-hashed by its parent every frame
+        auto copyDivHashes = [&](const HashVector& src, HashVector& dst) {
+            dst.assign(1, 0);
+            dst.insert(dst.end(), src.begin() + r.divStart, src.begin() + r.divEnd);
+        };
+        copyDivHashes(hashes.divHeaders, tree.hashStore.divHeaders);
+        copyDivHashes(hashes.divProps, tree.hashStore.divProps);
+        copyDivHashes(hashes.divCommands, tree.hashStore.divCommands);
+        copyDivHashes(hashes.divRecursive, tree.hashStore.divRecursive);
+        tree.hashStore.divBounds.assign(1, rect::none<Scalar>);
+        tree.hashStore.divBounds.insert(tree.hashStore.divBounds.end(), hashes.divBounds.begin() + r.divStart,
+                                        hashes.divBounds.begin() + r.divEnd);
+        tree.hashStore.divCommandBounds.assign(1, rect::none<Scalar>);
+        tree.hashStore.divCommandBounds.insert(tree.hashStore.divCommandBounds.end(),
+                                               hashes.divCommandBounds.begin() + r.divStart,
+                                               hashes.divCommandBounds.begin() + r.divEnd);
+        tree.hashStore.divCommandRanges.assign(1, scatteredCommands);
+        tree.hashStore.divCommandRanges.insert(tree.hashStore.divCommandRanges.end(),
+                                               hashes.divCommandRanges.begin() + r.divStart,
+                                               hashes.divCommandRanges.begin() + r.divEnd);
+        tree.hashStore.drawCommands.assign(hashes.drawCommands.begin() + r.cmdStart,
+                                           hashes.drawCommands.begin() + r.cmdEnd);
+        tree.hashStore.drawContents.assign(hashes.drawContents.begin() + r.cmdStart,
+                                           hashes.drawContents.begin() + r.cmdEnd);
+
+        r.node->viewRect = r.viewRect;
+        r.node->resolved = true;
+        r.node->movable = r.movable;
+        r.node->viewport = viewport;
     }
 
 
+    // Layers remember where their children are resolved (see elfw-layers.h)
+    ResolvedDiv withLayer(ResolvedDiv r, bool layer, const Rect<Scalar>& childRect) {
+        r.layer = layer;
+        r.layerOrigin = layer ? childRect.pos : Vec2<Scalar>{0, 0};
+        return r;
+    }
+
+
+    // The slots of the children of a stack container being resolved
+    struct placement {
+        const Div* children;
+        size_t count;
+        std::vector<Rect<Scalar>> rects;
+    };
+
+    struct layout_state {
+        // the viewRect of the whole tree (for virtualized lists)
+        Rect<Scalar> viewport;
+        // the number of virtual lists resolved so far
+        size_t virtualLists;
+        // the stack containers on the path to the div being resolved
+        std::vector<placement> placements;
+    };
+
+
     template<typename Divs>
     void resolveRec(
-            Rect<double> viewRect,
+            Rect<Scalar> viewRect,
             Divs&& divs,
             draw::ResolvedCommandList& commandList,
-            std::vector<ResolvedDiv>& divList
+            std::vector<ResolvedDiv>& divList,
+            lazy_state& lazyState,
+            layout_state& layoutState,
+            FrameBatch<Scalar>& batch
     ) {
         mkz::tree_to_linear_map<ResolvedDiv>(
                 divs, divList, viewRect,
-                [&](auto&& frameRect, const Div& div, auto&& recurse) {
-
-                    // resolve commands
-                    auto cmds_slice = mkz::indexed_slice_from_append<draw::ResolvedCommand>(
-                            div.drawCommands.begin(), div.drawCommands.end(),
-                            commandList,
-                            [&](auto&& cmd) {
-                                return resolveCommand(frameRect, cmd);
-                            }).slice();
-
-                    // resolve divs
-                    return ResolvedDiv{
-                            div.key,
-                            frameRect,
-                            cmds_slice,
-                            // children indices
-                            recurse(frame::resolve(div.frame, frameRect), div.childDivs)
+                [&](auto&& parentRect, const Div& div, auto&& recurse) {
+
+                    // the children of stack containers are resolved in their slot
+                    Rect<Scalar> frameRect = parentRect;
+                    if (!layoutState.placements.empty()) {
+                        const auto& p = layoutState.placements.back();
+                        const std::less<const Div*> less;
+                        if (!less(&div, p.children) && less(&div, p.children + p.count)) {
+                            frameRect = p.rects[&div - p.children];
+                        }
+                    }
+
+                    // a lazy placeholder can be made a layer, or return one
+                    const bool isLayer = div.layer;
+
+                    auto resolveContents = [&](const Div& div) {
+                        const bool layer = isLayer || div.layer;
+                        // resolve commands
+                        auto cmds_slice = resolveCommands(frameRect, div.drawCommands, commandList, batch);
+
+                        const auto childRect = frame::resolve(div.frame, frameRect);
+                        if (div.virtualList) {
+                            // only the visible rows exist (the recursion is done with them
+                            // before returning)
+                            const auto rows = virtual_list::visibleRows(*div.virtualList, childRect, layoutState.viewport);
+                            ++layoutState.virtualLists;
+                            return withLayer(ResolvedDiv{div.key, frameRect, cmds_slice, recurse(childRect, rows)},
+                                             layer, childRect);
+                        }
+
+                        if (div.layout && div.layout->direction != layout::Direction::None) {
+                            layoutState.placements.emplace_back(placement{div.childDivs.data(), div.childDivs.size(), {}});
+                            layout::place(div, childRect, layoutState.placements.back().rects);
+                            const auto children = recurse(childRect, div.childDivs);
+                            layoutState.placements.pop_back();
+                            return withLayer(ResolvedDiv{div.key, frameRect, cmds_slice, children}, layer, childRect);
+                        }
+
+                        // resolve divs
+                        return withLayer(ResolvedDiv{
+                                div.key,
+                                frameRect,
+                                cmds_slice,
+                                // children indices
+                                recurse(childRect, div.childDivs)
+                        }, layer, childRect);
                     };
+
+                    if (!div.lazy) {
+                        return resolveContents(div);
+                    }
+
+                    // lazy nodes resolved into the same rect (and still a layer or not) can reuse the last
+                    // frame, the ones with virtual lists only in the same viewport (it picks their rows)
+                    auto& node = *div.lazy;
+                    const bool reusable = node.resolved && node.tree.divs[0].layer == (isLayer || node.source.layer);
+                    if (reusable && node.viewRect == frameRect && (node.movable || node.viewport == layoutState.viewport)) {
+                        // the lazy nodes around it depend on the viewport as well
+                        if (!node.movable) {
+                            ++layoutState.virtualLists;
+                        }
+                        return spliceLazy(node, commandList, divList, lazyState);
+                    }
+
+                    const size_t divStart = divList.size(), cmdStart = commandList.size();
+                    if (reusable && node.movable && node.viewRect.size == frameRect.size) {
+                        auto root = spliceMovedLazy(node, frameRect.pos - node.viewRect.pos, commandList, divList);
+                        lazyState.records.emplace_back(lazy_record{
+                                &node, frameRect, root, divStart, divList.size(), cmdStart, commandList.size(), true
+                        });
+                        return root;
+                    }
+
+                    const size_t virtualLists = layoutState.virtualLists;
+                    auto root = resolveContents(node.source);
+                    lazyState.records.emplace_back(lazy_record{
+                            &node, frameRect, root, divStart, divList.size(), cmdStart, commandList.size(),
+                            layoutState.virtualLists == virtualLists
+                    });
+                    return root;
                 }
         );
     }
@@ -46,11 +298,28 @@ namespace {
 
 namespace elfw {
 // Converts a Div tree to ResolvedDivs and hashes all data in the tree
-    ViewTreeWithHashes resolveDiv(Rect<double> viewRect, const Div& div) {
+    ViewTreeWithHashes resolveDiv(Rect<Scalar> viewRect, const Div& div) {
         auto v = ViewTreeWithHashes { };
-        resolveRec(viewRect, std::vector<Div>{div}, v.drawCommands, v.divs);
-        updateViewTreeHashes(v.divs[0], v.hashStore, v.drawCommands, v.divs);
+        resolveDiv(viewRect, div, v);
         return v;
     }
 
+    // Converts a Div tree to ResolvedDivs reusing the storage of `out`
+    void resolveDiv(Rect<Scalar> viewRect, const Div& div, ViewTreeWithHashes& out) {
+        out.drawCommands.clear();
+        out.divs.clear();
+        lazy_state lazyState;
+        layout_state layoutState = {viewRect, 0, {}};
+        FrameBatch<Scalar> batch;
+        resolveRec(viewRect, std::vector<Div>{div}, out.drawCommands, out.divs, lazyState, layoutState, batch);
+        // diff never compares the root to anything, so it cannot be a layer
+        out.divs[0].layer = false;
+        out.divs[0].layerOrigin = {0, 0};
+        updateViewTreeHashes(out.divs[0], out.hashStore, out.drawCommands, out.divs, lazyState.cachedHashes);
+
+        for (const auto& r : lazyState.records) {
+            recordLazy(r, viewRect, out);
+        }
+    }
+
 }
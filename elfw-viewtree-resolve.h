@@ -19,7 +19,11 @@ namespace elfw {
     };
 
     // Converts a Div tree to ResolvedDivs and hashes all data in the tree
-    ViewTreeWithHashes resolveDiv(Rect<double> viewRect, const Div& div);
+    ViewTreeWithHashes resolveDiv(Rect<Scalar> viewRect, const Div& div);
+
+    // Same as above, but reuses the storage of an existing tree (so recycled
+    // frame buffers do not have to re-allocate their vectors every frame)
+    void resolveDiv(Rect<Scalar> viewRect, const Div& div, ViewTreeWithHashes& out);
 
 
 
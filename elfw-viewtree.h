@@ -1,4 +1,5 @@
 #pragma once
+#include <memory>
 #include <vector>
 #include "elfw-draw.h"
 #include "elfw-base.h"
@@ -7,27 +8,53 @@
 
 namespace elfw {
 
+    // A memoized subtree (see elfw-lazy.h)
+    struct LazyNode;
+
+    // Rows built at resolve time (see elfw-virtuallist.h)
+    struct VirtualList;
+
+    // Stack container and item properties (see elfw-layout.h)
+    struct Layout;
+
     // Represents a box wrapping relative coordinates
     struct Div {
 
         const char* key;
-        const Frame<double> frame;
+        const Frame<Scalar> frame;
 
         std::vector<Div> childDivs;
         std::vector<const draw::Command> drawCommands;
+
+        // Set for lazy placeholders: the actual contents are in the LazyNode
+        std::shared_ptr<LazyNode> lazy;
+
+        // Set for virtualized lists: the children are built by the resolver
+        std::shared_ptr<const VirtualList> virtualList;
+
+        // Set for stack containers and sized items: the layout pass places them
+        std::shared_ptr<const Layout> layout;
+
+        // The children are composited as a layer (see elfw-layers.h)
+        bool layer;
     };
 
 
     // A Div as used by the inner application
     struct ResolvedDiv {
         const char* key;
-        Rect<double> frame;
+        Rect<Scalar> frame;
 
         // position of the first and last draw command in the draw command list
         mkz::index_slice<draw::ResolvedCommand> drawCommands;
 
         // index of the hashes in the resolved div hash list
         mkz::index_slice<ResolvedDiv> children;
+
+        // Set for layers: the origin of the rect the children are resolved in.
+        // Everything below a layer is hashed relative to it.
+        bool layer;
+        Vec2<Scalar> layerOrigin;
     };
 
 
@@ -0,0 +1,78 @@
+#include "elfw-virtuallist.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace {
+    using namespace elfw;
+
+    // The interned index keys (resolve may run on the pipeline thread)
+    std::mutex indexKeysMutex;
+    std::deque<std::string> indexKeys;
+}
+
+
+namespace elfw {
+
+    Div virtualList(const char* key, const Frame<Scalar>& frame, VirtualList list,
+                    std::vector<draw::Command> drawCommands) {
+        return Div{key, frame, {}, {drawCommands.begin(), drawCommands.end()}, nullptr,
+                   std::make_shared<const VirtualList>(std::move(list))};
+    }
+
+
+    namespace virtual_list {
+
+        const char* indexKey(size_t idx) {
+            std::lock_guard<std::mutex> lock(indexKeysMutex);
+            while (indexKeys.size() <= idx) {
+                indexKeys.emplace_back(std::to_string(indexKeys.size()));
+            }
+            return indexKeys[idx].c_str();
+        }
+
+
+        std::vector<Div> visibleRows(const VirtualList& list, const Rect<Scalar>& listRect, const Rect<Scalar>& viewport) {
+            const double extent = (double) list.rowExtent;
+            const double top = std::max((double) listRect.pos.y, (double) viewport.pos.y);
+            const double bottom = std::min((double) rect::bottom(listRect), (double) rect::bottom(viewport));
+            if (list.count == 0 || extent <= 0 || bottom <= top) {
+                return {};
+            }
+
+            // the window has the same size wherever the list is scrolled (apart
+            // from its ends), so the slots of the rows stay put
+            const auto window = (size_t) std::ceil((bottom - top) / extent) + 1 + 2 * list.overscan;
+            const double firstVisible = std::floor((top - (double) listRect.pos.y + (double) list.offset) / extent);
+            const size_t first = (size_t) std::max(0.0, firstVisible - (double) list.overscan);
+            if (first >= list.count) {
+                return {};
+            }
+            const size_t last = std::min(list.count, first + window);
+
+            std::vector<size_t> indices;
+            for (size_t i = first; i < last; ++i) {
+                indices.push_back(i);
+            }
+            std::sort(indices.begin(), indices.end(), [&](size_t a, size_t b) { return a % window < b % window; });
+
+            std::vector<Div> rows;
+            rows.reserve(indices.size());
+            for (const auto i : indices) {
+                const Scalar y = Scalar((double) i * extent) - list.offset;
+                rows.push_back(Div{
+                        indexKey(i),
+                        {rect::make<Scalar>(0, y, 0, list.rowExtent), rect::make<Scalar>(0, 0, 1, 0)},
+                        {list.row(i)},
+                        {}
+                });
+            }
+            return rows;
+        }
+
+    }
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "elfw-viewtree.h"
+
+namespace elfw {
+
+    // VIRTUALIZED LISTS
+    // =================
+    //
+    // A list of `count` rows of `rowExtent` height that only builds the rows
+    // visible in the viewRect given to resolveDiv (plus `overscan` rows on each
+    // side), so a 100k row list costs about as much as the rows on screen.
+    //
+    // The rows are built while resolving, once the rect of the list is known:
+    // row(i) returns the contents of row i, which the list places in a div
+    // covering the row (full width, `rowExtent` high, scrolled up by `offset`).
+    //
+    // The row divs are keyed by their index and kept in the order of their slot
+    // (index modulo the window size) rather than their index, so while scrolling
+    // a row keeps its key and position among the children: diff only adds and
+    // removes the rows at the edges (the rows that moved still get UpdateProps,
+    // as their rect changed).
+
+    struct VirtualList {
+        size_t count;
+        Scalar rowExtent;
+        // how far the list is scrolled, in view units
+        Scalar offset;
+        size_t overscan;
+        std::function<Div(size_t)> row;
+    };
+
+
+    // Creates a virtualized list div. Its draw commands (a background for example)
+    // are resolved in the parent's rect as usual.
+    Div virtualList(const char* key, const Frame<Scalar>& frame, VirtualList list,
+                    std::vector<draw::Command> drawCommands = {});
+
+
+    namespace virtual_list {
+
+        // A key for each index, valid for the lifetime of the program
+        const char* indexKey(size_t idx);
+
+        // Builds the row divs of the list visible in `viewport` when the list
+        // covers `listRect` (called by resolveDiv)
+        std::vector<Div> visibleRows(const VirtualList& list, const Rect<Scalar>& listRect, const Rect<Scalar>& viewport);
+    }
+
+}
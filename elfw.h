@@ -9,6 +9,19 @@
 #include "elfw-viewtree-resolve.h"
 #include "elfw-diffing.h"
 #include "elfw-culling.h"
+#include "elfw-displaylist.h"
+#include "elfw-pipeline.h"
+#include "elfw-inbox.h"
+#include "elfw-lazy.h"
+#include "elfw-virtuallist.h"
+#include "elfw-layout.h"
+#include "elfw-layers.h"
+#include "elfw-text.h"
+#include "elfw-images.h"
+#include "elfw-paths.h"
+#include "elfw-framebatch.h"
+#include "elfw-snapshot.h"
+#include "elfw-retained.h"
 
 // C++ stream IO sucks, so disable it this way if needed
 #ifndef ELFW_NO_DEBUG_STREAMS
@@ -1,6 +1,8 @@
+#include <cstring>
 #include <vector>
 
 #include "elfw.h"
+#include "elfw-recording.h"
 
 namespace {
 
@@ -21,66 +23,107 @@ namespace {
         struct MouseDown { double x,y; };
         struct MouseUp { double x,y; };
         struct MouseMove { double x,y; };
+        struct Resize { double w,h; };
     }
 
     using Msg = mkz::variant<
             msg::None,
             msg::MouseUp,
             msg::MouseDown,
-            msg::MouseMove
+            msg::MouseMove,
+            msg::Resize
                     >;
 
 
+    // Checks if a Msg holds a T
+    template <typename T>
+    struct msgIs_t {
+        bool operator()(const T&) const { return true; }
+        template <typename U> bool operator()(const U&) const { return false; }
+    };
+
+
+    // Folds `next` into `last` if only the latest of the two matters
+    // (consecutive mouse moves or resizes)
+    bool coalesce(Msg& last, const Msg& next) {
+        const bool bothMoves = last.match(msgIs_t<msg::MouseMove>{}) && next.match(msgIs_t<msg::MouseMove>{});
+        const bool bothResizes = last.match(msgIs_t<msg::Resize>{}) && next.match(msgIs_t<msg::Resize>{});
+        if (bothMoves || bothResizes) {
+            last = next;
+            return true;
+        }
+        return false;
+    }
+
+
+
+    // The recorded form of a Msg (the variant itself is not trivially copyable)
+    struct RecordedMsg {
+        uint32_t type;
+        double x, y;
+    };
+
+    RecordedMsg toRecorded(const Msg& msg) {
+        return msg.match(
+                [](const msg::None&) { return RecordedMsg{0, 0, 0}; },
+                [](const msg::MouseUp& m) { return RecordedMsg{1, m.x, m.y}; },
+                [](const msg::MouseDown& m) { return RecordedMsg{2, m.x, m.y}; },
+                [](const msg::MouseMove& m) { return RecordedMsg{3, m.x, m.y}; },
+                [](const msg::Resize& m) { return RecordedMsg{4, m.w, m.h}; }
+        );
+    }
+
+
 
     void update(Msg& msg, Model& model) {
         msg.match(
                 [](msg::None){ std::cout << "None" << "\n"; },
                 [](msg::MouseDown){ std::cout << "MouseDown" << "\n"; },
                 [](msg::MouseUp){ std::cout << "MosueUp" << "\n"; },
-                [](msg::MouseMove){ std::cout << "MouseMove" << "\n"; }
+                [](msg::MouseMove){ std::cout << "MouseMove" << "\n"; },
+                [](msg::Resize){ std::cout << "Resize" << "\n"; }
         );
     }
 
 
-    Div view(Model& model) {
+    Div view(Model& model, LazyCache& lazyCache) {
         using namespace elfw::draw;
         using namespace elfw::draw::cmds;
 
+        const bool dragging = model.mouseState.match(
+                [](const std::nullptr_t& _) { return false; },
+                [](const MouseDragged& m) { return true; }
+        );
 
-        auto baseRect = [&](){
-            double strokeWidth = model.mouseState.match(
-                    [](const std::nullptr_t& _) { return 1.0; },
-                    [](const MouseDragged& m) { return 4.0; }
-            );
+        // only depends on its arguments, so it can be lazy
+        auto baseRect = [](bool dragging, Scalar ballX){
+            double strokeWidth = dragging ? 4.0 : 1.0;
             return Div{
                     "base",
-                    frame::full<double>,
+                    frame::full<Scalar>,
                     {},
                     {
                             {
-                                    frame::full<double>,
+                                    frame::full<Scalar>,
                                     Rectangle{
                                             color::hex(0xff333333),
                                             stroke::None{}
                                     }
                             },
                             {
-                                    {rect::make<double>(5,5,-5, -5), rect::unit<double>},
+                                    {rect::make<Scalar>(5,5,-5, -5), rect::unit<Scalar>},
                                     RoundedRectangle{
                                             5.0,
                                             color::hex(0xff222222),
-                                            model.mouseState.match(
-                                                    [](const std::nullptr_t& _) -> draw::Stroke { return stroke::none(); },
-                                                    [](const MouseDragged& m) -> draw::Stroke {
-                                                        return stroke::none();
-//                                                        return stroke::Solid{ 4.0, color::hex(0x66ffffff) };
-                                                    }
-                                            )
+                                            dragging
+                                            ? draw::Stroke{ stroke::none() }
+//                                            ? draw::Stroke{ stroke::Solid{ 4.0, color::hex(0x66ffffff) } }
+                                            : draw::Stroke{ stroke::none() }
                                     }
 
                             },
                             {
-                                    {{{-2, 0}, {4, 0}}, {{model.ballX, 0}, {0, 1}}},
+                                    {{{-2, 0}, {4, 0}}, {{ballX, 0}, {0, 1}}},
                                     Rectangle{color::hex(0xff555555), stroke::None{}}
                             },
 //                            {
@@ -92,27 +135,36 @@ namespace {
         };
 
 
-        auto pluck = [&](){
+        // a layer, so following the mouse only moves it (diff reports an
+        // UpdateProps for the pluck, nothing for the ball)
+        auto pluck = [](Scalar ballX, Scalar ballY){
             const auto r = 8;
-            return Div{
+            return layer(Div{
                     "pluck",
                     {
                             // use absolute for the pluck size
-                            rect::centered<double>(r),
+                            rect::centered<Scalar>(r),
                             // use the relative for positioning
-                            rect::make<double>(model.ballX, model.ballY, 0, 0)
+                            rect::make<Scalar>(ballX, ballY, 0, 0)
                     },
-                    {},
                     {
-                            {
-                                    frame::full<double>,
-                                    Ellipse{
-                                            color::hex(0xff333333),
-                                            stroke::none(),
-                                    },
+                            Div{
+                                    "ball",
+                                    frame::full<Scalar>,
+                                    {},
+                                    {
+                                            {
+                                                    frame::full<Scalar>,
+                                                    Ellipse{
+                                                            color::hex(0xff333333),
+                                                            stroke::none(),
+                                                    },
+                                            }
+                                    }
                             }
-                    }
-            };
+                    },
+                    {}
+            });
         };
 
         return {
@@ -121,10 +173,10 @@ namespace {
                 {
                         Div {
                                 "test",
-                                { rect::centered(-5.0), {{0,0}, {1,1}}  },
+                                { rect::centered<Scalar>(-5), {{0,0}, {1,1}}  },
                                 {
-                                        baseRect(),
-                                        pluck(),
+                                        lazy(lazyCache, "base", baseRect, dragging, model.ballX),
+                                        lazy(lazyCache, "pluck", pluck, model.ballX, model.ballY),
                                 },
                                 {
                                 }
@@ -132,7 +184,7 @@ namespace {
                 },
                 {
                         {
-                                frame::full<double>,
+                                frame::full<Scalar>,
                                 Rectangle{
                                         color::hex(0xff555555),
                                         stroke::none(),
@@ -145,25 +197,48 @@ namespace {
     }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    // --record FILE logs the messages and views for elfw-replay
+    const bool record = argc == 3 && strcmp(argv[1], "--record") == 0;
+    elfw::Recorder recorder(record ? argv[2] : "");
+
     auto m = Model{};
 //    Msg msg_ = msg::MouseDown{ 0.0, 1.0 };
 //    update( msg_ , m);
-    const auto v0 = view(m);
+
+    // a burst of input for a single frame
+    elfw::Inbox<Msg> inbox;
+    inbox.post(msg::MouseDown{ 0.0, 1.0 });
+    for (int i = 0; i < 16; ++i) {
+        inbox.post(msg::MouseMove{ i * 0.01, 1.0 });
+    }
+    inbox.post(msg::MouseUp{ 0.16, 1.0 });
+
+    inbox.drain(coalesce, [&](Msg& msg) {
+        recorder.message(toRecorded(msg));
+        update(msg, m);
+    });
+    std::cout << "=== Inbox: received=" << inbox.stats().received << " applied=" << inbox.stats().applied << "\n\n";
+    LazyCache lazyCache;
+    const auto v0 = view(m, lazyCache);
 //    std::cout << v0;
 
     m.ballX = 0.435;
     m.ballY = 0.23;
     m.mouseState = MouseDragged { {0,0} };
-    const auto v1 = view(m);
+    lazyCache.nextFrame();
+    const auto v1 = view(m, lazyCache);
+    std::cout << "=== Lazy: hits=" << lazyCache.getStats().hits << " misses=" << lazyCache.getStats().misses << "\n\n";
 //    std::cout << v1;
 
 
 
     // resolve the tree 1
-    auto viewRect = Rect<double>{{100, 200}, {640, 480}};
+    auto viewRect = Rect<Scalar>{{100, 200}, {640, 480}};
     auto v0resolved = elfw::resolveDiv(viewRect, v0);
     auto v1resolved = elfw::resolveDiv(viewRect, v1);
+    recorder.frame(v0, viewRect, v0resolved);
+    recorder.frame(v1, viewRect, v1resolved);
 
 //    for (auto& d : v0resolved.divs) {
 //
@@ -197,7 +272,7 @@ int main() {
 //    std::vector<size_t> rectIndices = {};
 //    elfw::culling::getDrawCommandsFor( v1resolved.drawCommands, changedRects, cmds, rectIndices );
 
-    auto culledCommands = elfw::cullDrawCommands( v1resolved.drawCommands, cmdDiff );
+    auto culledCommands = elfw::cullDrawCommands( v1resolved, cmdDiff, divDiff );
 
     std::cout << "=== cmd changes ====\n\n";
     for (int i = 0; i < culledCommands.changedRects.size(); ++i) {
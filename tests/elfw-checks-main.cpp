@@ -0,0 +1,668 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../elfw.h"
+#include "../elfw-raster.h"
+#include "../elfw-patchwire.h"
+
+// Regression checks
+// =================
+//
+// Runs each check on small hand built trees and exits with an error at the
+// first one that fails (see `ctest`).
+
+namespace {
+
+    using namespace elfw;
+
+    [[noreturn]] void fail(const char* check, const char* msg) {
+        fprintf(stderr, "[Check] %s: %s\n", check, msg);
+        exit(-1);
+    }
+
+
+    CulledDrawCommands everything(const ViewTreeWithHashes& tree) {
+        CulledDrawCommands c;
+        c.changedRects = {tree.divs[0].frame};
+        c.drawCommands = tree.drawCommands;
+        c.rectIndices = {0, tree.drawCommands.size()};
+        return c;
+    }
+
+
+    uint32_t pixelAt(const Surface& s, int x, int y) {
+        return s.pixels[(size_t) y * s.width + x];
+    }
+
+
+    // Images
+    // ======
+
+    // A binary PPM of a single color, which stb_image decodes
+    std::vector<unsigned char> solidImage(int w, int h, uint32_t rgb) {
+        const std::string header = "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+        std::vector<unsigned char> bytes(header.begin(), header.end());
+        for (int i = 0; i < w * h; ++i) {
+            bytes.push_back((unsigned char) (rgb >> 16));
+            bytes.push_back((unsigned char) (rgb >> 8));
+            bytes.push_back((unsigned char) rgb);
+        }
+        return bytes;
+    }
+
+
+    // A cached bitmap or layer drawn with a placeholder is redrawn once the image is decoded
+    void checkImagesInCachedSurfaces() {
+        using namespace elfw::draw;
+        const char* name = "images in cached surfaces";
+        const Color placeholder = color::hex(0xffff0000);
+
+        // the decodes wait until both surfaces were drawn with the placeholders
+        std::atomic<bool> drawn(false);
+        ImageCache cache(ImageCacheOptions{1 << 20, 1}, [&](ImageId, std::vector<unsigned char>& encoded) {
+            while (!drawn) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            encoded = solidImage(4, 4, 0x00ff00);
+            return true;
+        });
+        images::use(&cache);
+
+        // image 0 is drawn through the raster cache, image 1 in a layer
+        auto picture = [&](const char* key, double x, ImageId id) {
+            return Div{key, frame::absolute<Scalar>(Scalar(x), 0, 40, 40), {
+                    Div{"in", frame::full<Scalar>, {}, {
+                            {frame::full<Scalar>, cmds::Rectangle{color::hex(0xff000000), stroke::none()}},
+                            {frame::absolute<Scalar>(10, 10, 20, 20), cmds::Image{id, placeholder}}
+                    }}
+            }, {}};
+        };
+        const auto tree = resolveDiv(rect::make<Scalar>(0, 0, 100, 40), Div{"root", frame::full<Scalar>, {
+                picture("cached", 0, 0), layer(picture("layer", 50, 1))
+        }, {}});
+
+        RasterCache rasterCache(RasterCacheOptions{1, 1, 1 << 20});
+        LayerCompositor compositor;
+        Surface cached(100, 40), composited(100, 40);
+        rasterCache.rasterize(tree, everything(tree), 1.0, cached);
+        compositor.compose(tree, everything(tree), 1.0, composited);
+        if (pixelAt(cached, 20, 20) != 0xffff0000 || pixelAt(composited, 70, 20) != 0xffff0000) {
+            fail(name, "the placeholders are not drawn before the decode");
+        }
+        drawn = true;
+
+        for (int i = 0; i < 200 && cache.getStats().decoded < 2; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (cache.getStats().decoded < 2) {
+            fail(name, "the images were not decoded");
+        }
+
+        std::vector<CommandPatch> redraws;
+        imageRedraws(tree, cache.takeReady(), redraws);
+        const auto culled = cullDrawCommands(tree, redraws);
+        rasterCache.rasterize(tree, culled, 1.0, cached);
+        compositor.compose(tree, culled, 1.0, composited);
+        if (pixelAt(cached, 20, 20) != 0xff00ff00) {
+            fail(name, "the raster cache blits the bitmap drawn with the placeholder");
+        }
+        if (pixelAt(composited, 70, 20) != 0xff00ff00) {
+            fail(name, "the layer keeps the surface drawn with the placeholder");
+        }
+
+        images::use(nullptr);
+    }
+
+
+
+    // Layers
+    // ======
+
+    // The damage of a moved layer covers its old and new place, for the patches
+    // of diff and the decoded ones
+    void checkMovedLayerDamage() {
+        using namespace elfw::draw;
+        const char* name = "moved layer damage";
+
+        auto view = [](Scalar x) {
+            return Div{"root", frame::full<Scalar>, {
+                    Div{"background", frame::full<Scalar>, {}, {
+                            {frame::full<Scalar>, cmds::Rectangle{color::hex(0xff202020), stroke::none()}}
+                    }},
+                    layer(Div{"ball", frame::absolute<Scalar>(x, 10, 20, 20), {
+                            Div{"in", frame::full<Scalar>, {}, {
+                                    {frame::full<Scalar>, cmds::Ellipse{color::hex(0xffffffff), stroke::none()}}
+                            }}
+                    }, {}})
+            }, {}};
+        };
+        const auto viewRect = rect::make<Scalar>(0, 0, 100, 40);
+        const auto before = resolveDiv(viewRect, view(10));
+        const auto after = resolveDiv(viewRect, view(60));
+
+        std::vector<CommandPatch> patches;
+        std::vector<DivPatch> divPatches;
+        diff(before, after, patches, divPatches);
+
+        Surface expected(100, 40);
+        rasterize(everything(after), 1.0, expected);
+
+        Surface surface(100, 40);
+        rasterize(everything(before), 1.0, surface);
+        rasterize(cullDrawCommands(after, patches, divPatches), 1.0, surface);
+        if (surface.pixels != expected.pixels) {
+            fail(name, "the old or new place of the layer is not redrawn");
+        }
+
+        std::vector<char> bytes;
+        encodePatches(after, patches, divPatches, bytes);
+        PatchDecoder decoder;
+        if (decoder.decode(bytes.data(), bytes.size()) != PatchDecoder::Ok) {
+            fail(name, "the patches do not decode");
+        }
+        rasterize(everything(before), 1.0, surface);
+        rasterize(cullDrawCommands(after, decoder.patches(), decoder.divPatches()), 1.0, surface);
+        if (surface.pixels != expected.pixels) {
+            fail(name, "the decoded patches do not damage the old or new place of the layer");
+        }
+    }
+
+
+
+    // Display lists
+    // =============
+
+    // Culling through display lists draws the same pixels as culling every
+    // command, with and without pixel snapping, also for a moved layer and
+    // with a budget that drops lists
+    void checkDisplayLists() {
+        using namespace elfw::draw;
+        const char* name = "display lists";
+
+        auto view = [](size_t frame) {
+            std::vector<Div> rows;
+            for (size_t i = 0; i < 12; ++i) {
+                std::vector<Command> cells;
+                cells.push_back({frame::full<Scalar>,
+                                 cmds::Rectangle{color::hex(i == frame % 12 ? 0xff3366aa : 0xff333333), stroke::none()}});
+                for (int c = 0; c < 8; ++c) {
+                    cells.push_back({frame::absolute<Scalar>(Scalar(4 + 12 * c), 2, 10, 6),
+                                     cmds::Ellipse{color::hex(0xff55aa55), stroke::none()}});
+                }
+                rows.push_back(Div{virtual_list::indexKey(i), frame::absolute<Scalar>(0, Scalar(10 * (int) i), 100, 10), {
+                        Div{"in", frame::full<Scalar>, {}, {cells.begin(), cells.end()}}
+                }, {}});
+            }
+
+            std::vector<Command> ball;
+            for (int c = 0; c < 8; ++c) {
+                ball.push_back({frame::absolute<Scalar>(Scalar(2 * c), Scalar(2 * c), 6, 6),
+                                cmds::Rectangle{color::hex(0xffeeeeee), stroke::none()}});
+            }
+            rows.push_back(layer(Div{"ball", frame::absolute<Scalar>(Scalar((int) (frame % 5) * 7), 30, 24, 24), {
+                    Div{"in", frame::full<Scalar>, {}, {ball.begin(), ball.end()}}
+            }, {}}));
+            return Div{"root", frame::full<Scalar>, {Div{"list", frame::full<Scalar>, rows, {}}}, {}};
+        };
+        const auto viewRect = rect::make<Scalar>(0, 0, 100, 120);
+
+        ViewTreeWithHashes trees[2];
+        resolveDiv(viewRect, view(0), trees[0]);
+        DisplayListCache lists(DisplayListOptions{2, 4, 1024}), snappedLists(DisplayListOptions{2, 4, 1024}),
+                smallLists(DisplayListOptions{2, 4, 20});
+        Surface expected(100, 120), surface(100, 120), snapped(100, 120), small(100, 120);
+        rasterize(everything(trees[0]), 1.0, expected);
+        rasterize(everything(trees[0]), 1.0, surface);
+        rasterize(everything(trees[0]), 1.0, snapped);
+        rasterize(everything(trees[0]), 1.0, small);
+
+        size_t refs = 0, wholeLists = 0;
+        for (size_t f = 1; f <= 20; ++f) {
+            const auto& prev = trees[(f - 1) % 2];
+            auto& next = trees[f % 2];
+            resolveDiv(viewRect, view(f), next);
+
+            std::vector<CommandPatch> patches;
+            std::vector<DivPatch> divPatches;
+            diff(prev, next, patches, divPatches);
+
+            rasterize(cullDrawCommands(next, patches, divPatches), 1.0, expected);
+
+            const auto culled = cullDrawCommands(next, patches, divPatches, lists);
+            rasterize(culled, lists, 1.0, surface);
+
+            const auto culledSnapped = cullDrawCommands(next, patches, divPatches, DamageOptions{1.0, 4}, snappedLists);
+            rasterize(culledSnapped, snappedLists, 1.0, snapped);
+
+            rasterize(cullDrawCommands(next, patches, divPatches, smallLists), smallLists, 1.0, small);
+
+            if (surface.pixels != expected.pixels || snapped.pixels != expected.pixels ||
+                small.pixels != expected.pixels) {
+                fail(name, "the culled display lists draw other pixels");
+            }
+            refs += culled.displayListRefs.size() + culledSnapped.displayListRefs.size();
+            for (const auto& r : culled.displayListRefs) {
+                wholeLists += r.offset == 0 && r.count == lists.list(r.list)->commands.size() ? 1 : 0;
+            }
+        }
+        if (refs == 0 || wholeLists == 0) {
+            fail(name, "no subtree is culled as a display list");
+        }
+        if (smallLists.getStats().evictions == 0 || smallLists.getStats().commands > 20) {
+            fail(name, "the lists are not dropped to stay in the budget");
+        }
+    }
+
+
+    // Lazy nodes
+    // ==========
+
+    // A lazy subtree with a virtual list resolved into the same rect gets the
+    // rows of the new viewport, also inside another lazy subtree (the root has
+    // a fixed size, so only the viewport changes)
+    void checkLazyVirtualList() {
+        using namespace elfw::draw;
+        const char* name = "lazy virtual list";
+
+        auto rows = []() {
+            return virtualList("rows", frame::absolute<Scalar>(0, 0, 100, 1000), VirtualList{100, 10, 0, 0, [](size_t) {
+                return Div{"row", frame::full<Scalar>, {}, {
+                        {frame::full<Scalar>, cmds::Rectangle{color::hex(0xff808080), stroke::none()}}
+                }};
+            }});
+        };
+
+        LazyCache cache;
+        auto lazyView = [&]() {
+            return Div{"root", frame::absolute<Scalar>(0, 0, 100, 1000), {
+                    lazy(cache, "outer", [&]() {
+                        return Div{"outer", frame::full<Scalar>, {lazy(cache, "inner", rows)}, {}};
+                    })
+            }, {}};
+        };
+        const auto plainView = Div{"root", frame::absolute<Scalar>(0, 0, 100, 1000), {
+                Div{"outer", frame::full<Scalar>, {rows()}, {}}
+        }, {}};
+
+        for (const Scalar height : {Scalar(100), Scalar(400), Scalar(400), Scalar(200)}) {
+            const auto viewRect = rect::make<Scalar>(0, 0, 100, height);
+            const auto expected = resolveDiv(viewRect, plainView);
+            const auto resolved = resolveDiv(viewRect, lazyView());
+            cache.nextFrame();
+            if (resolved.divs.size() != expected.divs.size() ||
+                resolved.hashStore.divRecursive[0] != expected.hashStore.divRecursive[0]) {
+                fail(name, "the rows of the last viewport are reused");
+            }
+        }
+    }
+
+
+    // Patch wire
+    // ==========
+
+    // Rows of text in a layer. Each frame replaces row 1, swaps rows 2 and 3,
+    // changes the text of row 4 and moves the layer. The last rows are replaced
+    // every few frames, so some added rows outlive the frame that sent them.
+    // All the keys and texts are strings of their own (the decoder interns them).
+    struct rows_view {
+        std::vector<std::unique_ptr<std::string>> strings;
+
+        const char* string(const std::string& s) {
+            strings.emplace_back(new std::string(s));
+            return strings.back()->c_str();
+        }
+
+        Div at(size_t frame, size_t rows) {
+            using namespace elfw::draw;
+            std::vector<Div> children;
+            for (size_t i = 0; i < rows; ++i) {
+                const size_t id = i == 1 ? rows + frame
+                                  : (i == 2 || i == 3) && frame % 2 == 1 ? 5 - i
+                                  : i >= 6 ? 1000 * i + (frame + i) / 4
+                                  : i;
+                const std::string text = "row " + std::to_string(id) + (i == 4 ? " @" + std::to_string(frame) : "");
+                children.push_back(Div{string("row-" + std::to_string(id)),
+                                       frame::absolute<Scalar>(0, Scalar(20 * (int) i), 200, 20), {
+                        Div{string("in"), frame::full<Scalar>, {}, {
+                                {frame::full<Scalar>, cmds::Rectangle{color::hex(0xff303030), stroke::none()}},
+                                {frame::absolute<Scalar>(Scalar(4 + (int) (frame % 3)), 2, 150, 16),
+                                 cmds::Text{string(text), 0, 12, color::hex(0xffffffff)}}
+                        }}
+                }, {}});
+            }
+            return Div{string("root"), frame::full<Scalar>, {
+                    layer(Div{string("list"), frame::absolute<Scalar>(Scalar((int) (frame % 2) * 10), 0, 200, 400),
+                              children, {}})
+            }, {}};
+        }
+    };
+
+
+    // Encoded patches applied to a retained tree on the other side give the
+    // target, bad paths or indices are refused without touching the tree, and
+    // released keys do not leave the retained divs dangling
+    void checkPatchWireRoundTrip() {
+        const char* name = "patch wire round trip";
+        const auto viewRect = rect::make<Scalar>(0, 0, 200, 400);
+
+        rows_view views;
+        ViewTreeWithHashes trees[2];
+        resolveDiv(viewRect, views.at(0, 12), trees[0]);
+        RetainedTree tree(trees[0]);
+        PatchDecoder decoder;
+
+        // enough frames for the decoder to release keys a few times
+        for (size_t f = 1; f <= 500; ++f) {
+            const auto& prev = trees[(f - 1) % 2];
+            auto& next = trees[f % 2];
+            resolveDiv(viewRect, views.at(f, 12), next);
+
+            std::vector<CommandPatch> patches;
+            std::vector<DivPatch> divPatches;
+            diff(prev, next, patches, divPatches);
+            std::vector<char> bytes;
+            encodePatches(next, patches, divPatches, bytes);
+
+            if (decoder.decode(bytes.data(), bytes.size() - 1) != PatchDecoder::Truncated) {
+                fail(name, "a truncated frame decodes");
+            }
+            if (decoder.decode(bytes.data(), bytes.size()) != PatchDecoder::Ok) {
+                fail(name, "the patches do not decode");
+            }
+            if (!tree.apply(decoder.target(), decoder.patches(), decoder.divPatches(), true)) {
+                fail(name, "the retained tree differs from the target");
+            }
+            decoder.releaseKeys(tree);
+        }
+
+        ViewTreeWithHashes flat;
+        tree.flatten(flat);
+        const Hash before = flat.hashStore.divRecursive[0];
+        if (before != trees[0].hashStore.divRecursive[0]) {
+            fail(name, "the retained tree differs from the target after releasing keys");
+        }
+
+        // a path past the children, an index past the list, a removal twice
+        // and a reorder onto an element that stays
+        using draw::ResolvedCommand;
+        const std::vector<std::vector<DivPatch>> badDivPatches = {
+                {patch::Remove<ResolvedDiv>{{{0, 7}, nullptr, nullptr, 0}}},
+                {patch::Remove<ResolvedDiv>{{{0, 0}, nullptr, nullptr, 12}}},
+                {patch::Remove<ResolvedDiv>{{{0, 0}, nullptr, nullptr, 3}},
+                 patch::Remove<ResolvedDiv>{{{0, 0}, nullptr, nullptr, 3}}},
+                {patch::Reorder<ResolvedDiv>{{{0, 0}, nullptr, nullptr, 3}, {{0, 0}, nullptr, nullptr, 4}}},
+        };
+        for (const auto& bad : badDivPatches) {
+            if (tree.apply(decoder.target(), {}, bad)) {
+                fail(name, "patches that do not fit the tree are applied");
+            }
+        }
+        const std::vector<CommandPatch> badPatches = {
+                patch::Remove<ResolvedCommand>{{{0, 0, 1, 0, 0}, nullptr, nullptr, 0}},
+        };
+        if (tree.apply(decoder.target(), badPatches, {})) {
+            fail(name, "a command patch with a path past the children is applied");
+        }
+
+        tree.flatten(flat);
+        if (flat.hashStore.divRecursive[0] != before) {
+            fail(name, "refused patches changed the tree");
+        }
+
+        // equal commands in the same div (two separators around a box)
+        using namespace elfw::draw;
+        const Command sep = {frame::absolute<Scalar>(0, 0, 200, 1), cmds::Rectangle{color::hex(0xff808080), stroke::none()}};
+        const Command box = {frame::absolute<Scalar>(0, 2, 200, 40), cmds::Rectangle{color::hex(0xff303030), stroke::none()}};
+        const std::vector<std::pair<std::vector<Command>, std::vector<Command>>> duplicates = {
+                {{sep, box, sep}, {box}},
+                {{box}, {sep, box, sep}},
+                {{sep, sep, box}, {box, sep, sep}},
+                {{sep, box, sep, box}, {box, sep}},
+        };
+        for (const auto& d : duplicates) {
+            const auto a = resolveDiv(viewRect, Div{"root", frame::full<Scalar>, {}, {d.first.begin(), d.first.end()}});
+            const auto b = resolveDiv(viewRect, Div{"root", frame::full<Scalar>, {}, {d.second.begin(), d.second.end()}});
+            RetainedTree mirror(a);
+
+            std::vector<CommandPatch> patches;
+            std::vector<DivPatch> divPatches;
+            diff(a, b, patches, divPatches);
+            std::vector<char> bytes;
+            encodePatches(b, patches, divPatches, bytes);
+            if (decoder.decode(bytes.data(), bytes.size()) != PatchDecoder::Ok ||
+                !mirror.apply(decoder.target(), decoder.patches(), decoder.divPatches(), true)) {
+                fail(name, "the retained tree differs from the target with repeated commands");
+            }
+        }
+    }
+
+
+
+    // Snapshots
+    // =========
+
+    // A written snapshot opens and loads back to the same tree, with the
+    // segments of a path before or after the other commands
+    void checkSnapshotRoundTrip() {
+        const char* name = "snapshot round trip";
+        const auto viewRect = rect::make<Scalar>(0, 0, 200, 400);
+        const std::string file = "elfw-checks.snapshot";
+
+        using namespace elfw::draw;
+        const Command path = pathCommand(PathBuilder().moveTo(0, 0).cubicTo(10, 0, 20, 30, 40, 40).build(),
+                                         color::hex(0xff3366aa), stroke::none());
+        const Command label = {frame::absolute<Scalar>(0, 50, 200, 20), cmds::Text{"label", 0, 12, color::hex(0xffffffff)}};
+        const Command box = {frame::absolute<Scalar>(0, 80, 200, 40), cmds::Rectangle{color::hex(0xff303030), stroke::none()}};
+        const std::vector<std::vector<Command>> commandLists = {{path, label, box}, {label, box, path}};
+
+        for (const auto& commands : commandLists) {
+            const auto tree = resolveDiv(viewRect, Div{"root", frame::full<Scalar>,
+                                                       {Div{"child", frame::full<Scalar>, {}, {commands.begin(), commands.end()}}},
+                                                       {}});
+            if (!writeSnapshot(file, tree)) {
+                fail(name, "the snapshot cannot be written");
+            }
+
+            Snapshot snapshot;
+            if (snapshot.open(file) != Snapshot::Ok) {
+                fail(name, "the snapshot does not open");
+            }
+            ViewTreeWithHashes loaded;
+            snapshot.load(loaded);
+            // hashed again from the loaded commands, not the stored hashes
+            updateViewTreeHashes(loaded.divs[0], loaded.hashStore, loaded.drawCommands, loaded.divs);
+            if (loaded.drawCommands.size() != tree.drawCommands.size() ||
+                loaded.hashStore.divRecursive[0] != tree.hashStore.divRecursive[0]) {
+                fail(name, "the loaded tree differs from the written one");
+            }
+        }
+        remove(file.c_str());
+    }
+
+
+
+    // Pipeline
+    // ========
+
+    // The back stage gets every frame the front stage built, once and in
+    // order, with the tree built for its index
+    void checkPipelineOrder() {
+        using namespace elfw::draw;
+        const char* name = "pipeline order";
+        const size_t frameCount = 200;
+        const auto viewRect = rect::make<Scalar>(0, 0, 100, 100);
+
+        auto view = [](size_t frame) {
+            return Div{"root", frame::full<Scalar>, {
+                    Div{"row", frame::absolute<Scalar>(0, Scalar((int) (frame % 50)), 100, 10), {}, {
+                            {frame::full<Scalar>, cmds::Rectangle{color::hex(0xff000000 | (uint32_t) frame), stroke::none()}}
+                    }}
+            }, {}};
+        };
+
+        for (const size_t inFlight : {1, 2, 4}) {
+            Pipeline pipeline(PipelineConfig{inFlight}, [&](size_t frame, ViewTreeWithHashes& tree) {
+                if (frame >= frameCount) {
+                    return false;
+                }
+                resolveDiv(viewRect, view(frame), tree);
+                return true;
+            });
+
+            size_t next = 0;
+            while (pipeline.consumeBlocking([&](const PipelineFrame& f) {
+                if (f.frameIndex != next ||
+                    f.tree.hashStore.divRecursive[0] != resolveDiv(viewRect, view(next)).hashStore.divRecursive[0]) {
+                    fail(name, "a frame is skipped, repeated or out of order");
+                }
+                ++next;
+            })) {}
+            if (next != frameCount) {
+                fail(name, "not every frame is consumed");
+            }
+        }
+    }
+
+
+
+    // Parallel diff
+    // =============
+
+    // Random trees, and changed copies of them: `changes` decides where children
+    // are dropped, added or reversed and commands recolored, the rest comes from
+    // `shape` in the same order for both
+    struct random_trees {
+        std::mt19937 shape, changes;
+        bool changed;
+
+        bool chance(int percent) { return changed && (int) (changes() % 100) < percent; }
+
+        Div div(const char* key, int depth) {
+            using namespace elfw::draw;
+            static const char* keys[] = {"a", "b", "c", "d", "e", "f", "g", "added"};
+
+            std::vector<Command> commands;
+            for (size_t i = 0, n = shape() % 4; i < n; ++i) {
+                const uint32_t rgb = chance(5) ? changes() : shape();
+                commands.push_back({frame::relative<Scalar>(0, Scalar(0.25 * (double) i), 1, Scalar(0.25)),
+                                    cmds::Rectangle{color::hex(0xff000000 | rgb), stroke::none()}});
+            }
+
+            std::vector<Div> children;
+            for (size_t i = 0, n = depth > 0 ? shape() % 6 : 0; i < n; ++i) {
+                // the subtree is built either way, so `shape` stays in step
+                auto child = div(keys[i], depth - 1);
+                if (!chance(10)) {
+                    children.push_back(std::move(child));
+                }
+            }
+            if (chance(10)) {
+                const bool wasChanged = changed;
+                changed = false;
+                children.push_back(div(keys[7], depth - 1));
+                changed = wasChanged;
+            }
+            if (chance(5)) {
+                children = std::vector<Div>(children.rbegin(), children.rend());
+            }
+            return Div{key, frame::relative<Scalar>(0, 0, 1, 1), children, {commands.begin(), commands.end()}};
+        }
+    };
+
+
+    // The parallel diff encodes to the same bytes as the serial one, even with
+    // every subtree on a task of its own
+    void checkParallelDiff() {
+        const char* name = "parallel diff";
+        const auto viewRect = rect::make<Scalar>(0, 0, 400, 400);
+
+        for (unsigned seed = 0; seed < 300; ++seed) {
+            random_trees before = {std::mt19937(seed), std::mt19937(seed), false};
+            random_trees after = {std::mt19937(seed), std::mt19937(seed + 1000), true};
+            const auto a = resolveDiv(viewRect, before.div("root", 4));
+            const auto b = resolveDiv(viewRect, after.div("root", 4));
+
+            std::vector<char> bytes[2];
+            for (const size_t threshold : {0, 1}) {
+                std::vector<CommandPatch> patches;
+                std::vector<DivPatch> divPatches;
+                diff(a, b, patches, divPatches, ParallelDiffOptions{threshold, 4});
+                encodePatches(b, patches, divPatches, bytes[threshold]);
+            }
+            if (bytes[0] != bytes[1]) {
+                fail(name, "the patches differ from the serial diff");
+            }
+        }
+    }
+
+
+
+    // Frame batches
+    // =============
+
+    // The SIMD lanes of frame::resolve give the same bits as resolving each frame
+    // on its own, for any length (so for every tail) and for packed and strided
+    // output. Built a second time with AVX (elfw-checks-avx) for the AVX lanes.
+    template <typename T>
+    void checkFrameBatchOf(const char* name) {
+        std::mt19937 random(7);
+        const auto uniform = [&](double lo, double hi) {
+            return T(std::uniform_real_distribution<double>(lo, hi)(random));
+        };
+
+        for (const size_t stride : {sizeof(Rect<T>), sizeof(Rect<T>) + sizeof(double)}) {
+            for (size_t length = 0; length < 20; ++length) {
+                for (int round = 0; round < 50; ++round) {
+                    const auto viewRect = rect::make<T>(uniform(-100, 100), uniform(-100, 100),
+                                                        uniform(1, 2000), uniform(1, 2000));
+                    FrameBatch<T> batch;
+                    std::vector<Frame<T>> frames;
+                    for (size_t i = 0; i < length; ++i) {
+                        frames.push_back({{{uniform(-500, 500), uniform(-500, 500)}, {uniform(1, 100), uniform(1, 100)}},
+                                          {{uniform(-1, 1), uniform(-1, 1)}, {uniform(0, 1), uniform(0, 1)}}});
+                        batch.push_back(frames.back());
+                    }
+
+                    std::vector<char> out(length * stride + 1, 0), expected(length * stride + 1, 0);
+                    frame::resolve(batch, viewRect, reinterpret_cast<Rect<T>*>(out.data()), stride);
+                    for (size_t i = 0; i < length; ++i) {
+                        const Rect<T> r = frame::resolve(frames[i], viewRect);
+                        memcpy(expected.data() + i * stride, &r, sizeof(r));
+                    }
+                    if (memcmp(out.data(), expected.data(), out.size()) != 0) {
+                        fail(name, "a batch resolves to other bits than frame by frame");
+                    }
+                }
+            }
+        }
+    }
+
+    void checkFrameBatches() {
+        checkFrameBatchOf<double>("frame batches (double)");
+        checkFrameBatchOf<float>("frame batches (float)");
+    }
+
+}
+
+
+int main() {
+    checkImagesInCachedSurfaces();
+    checkMovedLayerDamage();
+    checkDisplayLists();
+    checkLazyVirtualList();
+    checkPatchWireRoundTrip();
+    checkSnapshotRoundTrip();
+    checkPipelineOrder();
+    checkParallelDiff();
+    checkFrameBatches();
+    puts("[Check] all passed");
+    return 0;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace elfw {
+
+    // LZ COMPRESSION
+    // ==============
+    //
+    // A small LZ77 block codec in the style of LZ4, used for resource packs.
+    //
+    // A block is a list of sequences: [token][literal length+][literals][offset:16][match length+]
+    // where the high nibble of the token is the literal length and the low one is
+    // the match length - 4 (15 means more length bytes follow, each 255 means
+    // another byte). The last sequence has only literals.
+
+    namespace lz {
+
+        static const std::size_t minMatch = 4;
+        static const std::size_t maxOffset = 0xffff;
+        static const int hashBits = 12;
+
+        // A block decompresses to at most this many bytes per compressed byte: a
+        // length byte adds at most 255 to a match, and the token and offset of a
+        // sequence add less than 3 * 255 between them
+        static const std::size_t maxExpansion = 255;
+
+        namespace detail {
+            inline uint32_t read32(const uint8_t* p) {
+                uint32_t v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+
+            inline uint32_t hash(uint32_t v) {
+                return (v * 2654435761u) >> (32 - hashBits);
+            }
+
+            inline void writeLength(std::vector<char>& out, std::size_t len) {
+                while (len >= 255) {
+                    out.push_back((char) 255);
+                    len -= 255;
+                }
+                out.push_back((char) len);
+            }
+
+            inline void writeSequence(std::vector<char>& out, const uint8_t* literals, std::size_t literalCount,
+                                      std::size_t offset, std::size_t matchLength) {
+                const bool hasMatch = matchLength >= minMatch;
+                const std::size_t m = hasMatch ? matchLength - minMatch : 0;
+
+                out.push_back((char) (((literalCount < 15 ? literalCount : 15) << 4) | (m < 15 ? m : 15)));
+                if (literalCount >= 15) writeLength(out, literalCount - 15);
+
+                out.insert(out.end(), literals, literals + literalCount);
+
+                if (!hasMatch) return;
+
+                out.push_back((char) (offset & 0xff));
+                out.push_back((char) (offset >> 8));
+                if (m >= 15) writeLength(out, m - 15);
+            }
+
+            // Returns false on a truncated length
+            inline bool readLength(const uint8_t*& ip, const uint8_t* end, std::size_t& len) {
+                uint8_t b;
+                do {
+                    if (ip >= end) return false;
+                    b = *ip++;
+                    len += b;
+                } while (b == 255);
+                return true;
+            }
+        }
+
+
+        // Appends the compressed form of [src, src+size) to out
+        inline void compress(const char* src, std::size_t size, std::vector<char>& out) {
+            using namespace detail;
+
+            const auto in = reinterpret_cast<const uint8_t*>(src);
+            // positions + 1 of the last occurance of each hash (0: none)
+            std::vector<uint32_t> table(std::size_t(1) << hashBits, 0);
+
+            std::size_t ip = 0, anchor = 0;
+            // leave some literals at the end so the matcher never reads past the input
+            const std::size_t matchLimit = size > 8 ? size - 8 : 0;
+
+            while (ip < matchLimit) {
+                const uint32_t seq = read32(in + ip);
+                const auto h = hash(seq);
+                const std::size_t ref = table[h];
+                table[h] = (uint32_t) (ip + 1);
+
+                if (ref == 0 || ip - (ref - 1) > maxOffset || read32(in + ref - 1) != seq) {
+                    ++ip;
+                    continue;
+                }
+
+                const std::size_t matchPos = ref - 1;
+                std::size_t len = minMatch;
+                while (ip + len < size && in[matchPos + len] == in[ip + len]) ++len;
+
+                writeSequence(out, in + anchor, ip - anchor, ip - matchPos, len);
+                ip += len;
+                anchor = ip;
+            }
+
+            if (anchor < size) {
+                writeSequence(out, in + anchor, size - anchor, 0, 0);
+            }
+        }
+
+
+        // Decompresses exactly `dstSize` bytes. Returns false on corrupt input.
+        inline bool decompress(const char* src, std::size_t srcSize, char* dst, std::size_t dstSize) {
+            using namespace detail;
+
+            auto ip = reinterpret_cast<const uint8_t*>(src);
+            const auto end = ip + srcSize;
+            auto op = reinterpret_cast<uint8_t*>(dst);
+            const auto opStart = op, opEnd = op + dstSize;
+
+            while (ip < end) {
+                const uint8_t token = *ip++;
+
+                std::size_t literalCount = token >> 4;
+                if (literalCount == 15 && !readLength(ip, end, literalCount)) return false;
+                if (literalCount > (std::size_t) (end - ip) || literalCount > (std::size_t) (opEnd - op)) return false;
+
+                memcpy(op, ip, literalCount);
+                ip += literalCount;
+                op += literalCount;
+
+                // the last sequence has no match
+                if (ip == end) break;
+
+                if (end - ip < 2) return false;
+                const std::size_t offset = ip[0] | (std::size_t(ip[1]) << 8);
+                ip += 2;
+
+                std::size_t matchLength = token & 0x0f;
+                if (matchLength == 15 && !readLength(ip, end, matchLength)) return false;
+                matchLength += minMatch;
+
+                if (offset == 0 || offset > (std::size_t) (op - opStart)) return false;
+                if (matchLength > (std::size_t) (opEnd - op)) return false;
+
+                // byte by byte, as the match may overlap the output
+                const uint8_t* match = op - offset;
+                for (std::size_t i = 0; i < matchLength; ++i) {
+                    op[i] = match[i];
+                }
+                op += matchLength;
+            }
+
+            return op == opEnd;
+        }
+
+    }
+}
@@ -4,9 +4,16 @@
 
 
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <vector>
 #include <map>
+#include <set>
 #include <fstream>
+#include <sys/stat.h>
 
 #if _WIN32
 #define getcwd _getcwd
@@ -34,7 +41,7 @@ namespace {
         Data d = {};
 
         for (const auto& file : files) {
-            std::ifstream f(file, std::ios::in);
+            std::ifstream f(file, std::ios::in | std::ios::binary);
 
             // get length of file:
             f.seekg (0, f.end);
@@ -84,27 +91,190 @@ namespace {
         });
     }
 
-//    std::vector<char> metaToHeader(const Data& data) {
-//        static const auto isValidChar = [](const auto c){
-//              return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '-';
-//        };
-//
-//        const auto names = "";
-//        return stringBuffer([&](auto& o){
-//            o << "enum {\n"
-//            for (auto it = data.buffers.begin(); it != data.buffers.end(); ++it) {
-//
-//                auto f = std::string(it->first.c_str());
-//                std::replace_if( f.begin(), f.end(), isValidChar, '_');
-//                o << "  " << f << ",\n";
-//            }
-//            o << "}; // enum\n"
-//        });
-//    }
+
+    // EMBEDDED RESOURCES
+    // ==================
+    //
+    // Generates a header + source pair: the data goes into static arrays, and
+    // the header gets an enum of the resource ids and a constexpr perfect hash
+    // lookup from path to id, so lookups are compile-time constants and there
+    // is no file I/O at startup.
+
+    // Converts a path to a valid C++ identifier
+    std::string toIdentifier(const std::string& path) {
+        static const auto isValidChar = [](const char c){
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        };
+
+        auto f = path;
+        std::replace_if(f.begin(), f.end(), [](char c) { return !isValidChar(c); }, '_');
+        if (f.empty() || (f[0] >= '0' && f[0] <= '9')) {
+            f = "_" + f;
+        }
+        return f;
+    }
+
+
+    // Escapes a path for a C++ string literal
+    std::string toStringLiteral(const std::string& path) {
+        std::string o = "\"";
+        for (const auto c : path) {
+            if (c == '"' || c == '\\') o += '\\';
+            o += c;
+        }
+        return o + "\"";
+    }
+
+
+    // The seeded FNV-1a used for the perfect hash (has to match the generated code)
+    uint64_t seededHash(const std::string& s, uint64_t seed) {
+        uint64_t h = 0xcbf29ce484222325ull ^ seed;
+        for (const auto c : s) {
+            h ^= (uint8_t) c;
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+
+
+    struct PerfectHash {
+        uint64_t seed;
+        // resource index for each slot, or the resource count for empty slots
+        std::vector<size_t> slots;
+    };
+
+    // Finds a seed that maps every name to a different slot
+    PerfectHash findPerfectHash(const std::vector<std::string>& names) {
+        size_t tableSize = 1;
+        while (tableSize < names.size() * 2) tableSize <<= 1;
+
+        for (uint64_t seed = 0;; ++seed) {
+            PerfectHash p = { seed, std::vector<size_t>(tableSize, names.size()) };
+            bool collision = false;
+            for (size_t i = 0; i < names.size() && !collision; ++i) {
+                auto& slot = p.slots[seededHash(names[i], seed) & (tableSize - 1)];
+                collision = (slot != names.size());
+                slot = i;
+            }
+            if (!collision) return p;
+            // too crowded, try a larger table
+            if (seed > 0 && seed % 1024 == 0) {
+                tableSize <<= 1;
+            }
+        }
+    }
+
+
+    std::vector<char> embeddedHeader(const Data& data, const std::string& ns) {
+        std::vector<std::string> names;
+        for (const auto& b : data.buffers) names.push_back(b.first);
+        const auto hash = findPerfectHash(names);
+
+        return stringBuffer([&](auto& o){
+            o << "// Generated by elfw-resources --embed, do not edit\n"
+              << "#pragma once\n\n"
+              << "#include <cstddef>\n"
+              << "#include <cstdint>\n\n"
+              << "namespace " << ns << " {\n\n"
+              << "    struct Data {\n"
+              << "        const char* ptr;\n"
+              << "        std::size_t size;\n"
+              << "    };\n\n"
+              << "    enum class Resource : uint32_t {\n";
+
+            // paths differing only in special characters get a suffix, checked
+            // against every enumerator (a/b, a_b and a_b_1 make a_b, a_b_1, a_b_1_1)
+            std::set<std::string> usedIds = {"Invalid"};
+            for (size_t i = 0; i < names.size(); ++i) {
+                const auto base = toIdentifier(names[i]);
+                auto id = base;
+                for (int n = 1; !usedIds.insert(id).second; ++n) {
+                    id = base + "_" + std::to_string(n);
+                }
+                o << "        " << id << " = " << i << ",  // " << names[i] << "\n";
+            }
+
+            o << "        Invalid = " << names.size() << "\n"
+              << "    };\n\n"
+              << "    constexpr std::size_t resourceCount = " << names.size() << ";\n\n"
+              << "    // Defined in the generated source\n"
+              << "    extern const char* const resourceData[resourceCount];\n"
+              << "    extern const std::size_t resourceSizes[resourceCount];\n\n"
+              << "    inline Data get(Resource r) {\n"
+              << "        return { resourceData[(std::size_t) r], resourceSizes[(std::size_t) r] };\n"
+              << "    }\n\n"
+              << "    namespace detail {\n"
+              << "        constexpr uint64_t seed = " << hash.seed << "ull;\n"
+              << "        constexpr const char* paths[] = {\n";
+            for (const auto& n : names) o << "                " << toStringLiteral(n) << ",\n";
+            o << "        };\n"
+              << "        constexpr uint32_t slots[] = {";
+            for (size_t i = 0; i < hash.slots.size(); ++i) o << (i % 16 == 0 ? "\n                " : " ") << hash.slots[i] << ",";
+            o << "\n        };\n\n"
+              << "        constexpr uint64_t hash(const char* s) {\n"
+              << "            uint64_t h = 0xcbf29ce484222325ull ^ seed;\n"
+              << "            for (; *s != 0; ++s) {\n"
+              << "                h ^= (uint8_t) *s;\n"
+              << "                h *= 0x100000001b3ull;\n"
+              << "            }\n"
+              << "            return h;\n"
+              << "        }\n\n"
+              << "        constexpr bool equals(const char* a, const char* b) {\n"
+              << "            for (; *a != 0 && *a == *b; ++a, ++b) {}\n"
+              << "            return *a == *b;\n"
+              << "        }\n"
+              << "    }\n\n"
+              << "    // Looks up the id of a path (Resource::Invalid if there is no such resource)\n"
+              << "    constexpr Resource resourceId(const char* path) {\n"
+              << "        const uint32_t slot = detail::slots[detail::hash(path) & " << (hash.slots.size() - 1) << "];\n"
+              << "        return (slot < resourceCount && detail::equals(detail::paths[slot], path))\n"
+              << "               ? (Resource) slot : Resource::Invalid;\n"
+              << "    }\n\n"
+              << "}\n";
+        });
+    }
+
+
+    std::vector<char> embeddedSource(const Data& data, const std::string& ns, const std::string& headerName) {
+        return stringBuffer([&](auto& o){
+            o << "// Generated by elfw-resources --embed, do not edit\n"
+              << "#include \"" << headerName << "\"\n\n"
+              << "namespace {\n";
+
+            size_t i = 0;
+            for (const auto& b : data.buffers) {
+                o << "    // " << b.first << "\n"
+                  << "    const char data" << i++ << "[] = {";
+                // including the '\0' terminator
+                for (size_t j = 0; j <= b.second.second; ++j) {
+                    o << (j % 16 == 0 ? "\n            " : " ") << (int) (signed char) data.binary[b.second.first + j] << ",";
+                }
+                o << "\n    };\n\n";
+            }
+
+            o << "}\n\n"
+              << "namespace " << ns << " {\n\n"
+              << "    const char* const resourceData[resourceCount] = {\n";
+            for (size_t j = 0; j < data.buffers.size(); ++j) o << "            data" << j << ",\n";
+            o << "    };\n\n"
+              << "    const std::size_t resourceSizes[resourceCount] = {\n";
+            for (const auto& b : data.buffers) o << "            " << b.second.second << ",\n";
+            o << "    };\n\n"
+              << "}\n";
+        });
+    }
+
 
     // Help
     void usage(const char* argv0) {
-        printf("USAGE:\n\n\t%s OUTPUT_FILE_NAME INPUT_FILES...\n", argv0);
+        printf("USAGE:\n\n\t%s [--pack [--compress] [--align N] [--bench]] OUTPUT_FILE_NAME INPUT_FILES...\n", argv0);
+        printf("\t%s --embed NAMESPACE OUTPUT_BASE_NAME INPUT_FILES...\n", argv0);
+        printf("\n\t--pack\t\twrite a single memory mappable binary pack instead of a .meta file\n");
+        printf("\t\t\t(unchanged files are copied over from an existing pack)\n");
+        printf("\t--compress\tLZ compress the entries of the pack\n");
+        printf("\t--align N\talign the data of each entry to N bytes (default: 16)\n");
+        printf("\t--embed NS\tgenerate OUTPUT_BASE_NAME.h/.cpp with the data and a constexpr lookup in namespace NS\n");
+        printf("\t--bench\t\tbenchmark loading and accessing the written pack\n");
     }
 
 
@@ -129,6 +299,267 @@ namespace {
     }
 
 
+    // INCREMENTAL PACKING
+    // ===================
+    //
+    // Entries whose source file has the same size and modification time as the
+    // one recorded in the existing pack are copied over without reading the file.
+    // Changed files are read, hashed and compressed on all cores. Entries with the
+    // same contents share their data, and every entry's data is aligned for direct
+    // use from the mapped pack.
+
+    struct PackOptions {
+        bool compress;
+        std::size_t alignment;
+    };
+
+    struct PackInput {
+        std::string path;
+        elfw::resources::PackEntry entry;
+        // the bytes to store: either taken from the previous pack or owned
+        const char* stored;
+        std::vector<char> owned;
+        bool reused;
+        // set instead of failing on the worker thread
+        std::string error;
+    };
+
+
+    // Returns the modification time in nanoseconds and the size of the file
+    bool statFile(const std::string& path, int64_t& mtime, uint64_t& size) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            return false;
+        }
+#if defined(__APPLE__)
+        mtime = (int64_t) st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+        mtime = (int64_t) st.st_mtime * 1000000000;
+#else
+        mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+        size = (uint64_t) st.st_size;
+        return true;
+    }
+
+
+    // Calls fn(i) for every i in [0, n) using all cores
+    template <typename Fn>
+    void parallelFor(size_t n, Fn&& fn) {
+        std::atomic<size_t> next(0);
+        const size_t workerCount = std::max<size_t>(1, std::min<size_t>(n, std::thread::hardware_concurrency()));
+
+        std::vector<std::thread> workers;
+        for (size_t w = 0; w < workerCount; ++w) {
+            workers.emplace_back([&] {
+                for (size_t i = next++; i < n; i = next++) {
+                    fn(i);
+                }
+            });
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+
+    // Fills the entry and the stored bytes of the input, reusing the previous pack if possible.
+    // Runs on the workers, so errors are left in `in.error`.
+    void prepareInput(PackInput& in, const elfw::resources::PackFile& previous, const PackOptions& options) {
+        using namespace elfw::resources;
+
+        int64_t mtime = 0;
+        uint64_t size = 0;
+        if (!statFile(in.path, mtime, size)) {
+            in.error = "Cannot find file: " + in.path;
+            return;
+        }
+
+        // a Raw entry only stands for a compressed one if LZ did not help it
+        const auto prev = previous.isOpen() ? previous.find(in.path.c_str(), in.path.size()) : nullptr;
+        const bool sameCodec = prev != nullptr && (options.compress
+                                                   ? prev->codec == Lz || (prev->flags & Incompressible) != 0
+                                                   : prev->codec == Raw);
+        if (prev != nullptr && prev->sourceMtime == mtime && prev->size == size && sameCodec) {
+            in.entry = *prev;
+            in.stored = previous.bytes(*prev);
+            in.reused = true;
+            return;
+        }
+
+        std::vector<char> bytes(size);
+        std::ifstream f(in.path, std::ios::in | std::ios::binary);
+        if (!f.read(bytes.data(), bytes.size())) {
+            in.error = "Cannot read file: " + in.path;
+            return;
+        }
+
+        in.entry = {
+                hashPath(in.path.c_str(), in.path.size()),
+                0,
+                size,
+                size,
+                hashBytes(bytes.data(), bytes.size()),
+                mtime,
+                0,
+                (uint32_t) in.path.size(),
+                Raw,
+                0
+        };
+
+        if (options.compress) {
+            std::vector<char> compressed;
+            elfw::lz::compress(bytes.data(), bytes.size(), compressed);
+            if (compressed.size() < bytes.size()) {
+                in.entry.codec = Lz;
+                in.entry.storedSize = compressed.size();
+                bytes.swap(compressed);
+            } else {
+                in.entry.flags = Incompressible;
+            }
+        }
+
+        in.owned.swap(bytes);
+        in.stored = in.owned.data();
+        in.reused = false;
+    }
+
+
+    // Builds the pack for the files, reusing the unchanged entries of the previous pack
+    std::vector<char> buildPack(std::vector<std::string> files, const elfw::resources::PackFile& previous,
+                                const PackOptions& options) {
+        using namespace elfw::resources;
+
+        std::sort(files.begin(), files.end());
+        files.erase(std::unique(files.begin(), files.end()), files.end());
+
+        std::vector<PackInput> inputs(files.size());
+        for (size_t i = 0; i < files.size(); ++i) {
+            inputs[i].path = files[i];
+        }
+
+        parallelFor(inputs.size(), [&](size_t i) { prepareInput(inputs[i], previous, options); });
+        for (const auto& in : inputs) {
+            if (!in.error.empty()) {
+                fail("%s", in.error.c_str());
+            }
+        }
+
+        // lay out the data, storing identical contents only once
+        const auto align = [&](size_t v) { return (v + options.alignment - 1) / options.alignment * options.alignment; };
+
+        std::vector<char> stored;
+        std::multimap<uint64_t, const PackInput*> byContent;
+        std::string names;
+        std::vector<PackEntry> entries;
+        size_t reused = 0, deduplicated = 0;
+
+        for (auto& in : inputs) {
+            auto& e = in.entry;
+            reused += in.reused ? 1 : 0;
+
+            const PackInput* same = nullptr;
+            const auto range = byContent.equal_range(e.contentHash);
+            for (auto it = range.first; it != range.second && same == nullptr; ++it) {
+                const auto& o = it->second->entry;
+                if (o.size == e.size && o.codec == e.codec && o.storedSize == e.storedSize
+                    && memcmp(it->second->stored, in.stored, e.storedSize) == 0) {
+                    same = it->second;
+                }
+            }
+
+            if (same != nullptr) {
+                e.offset = same->entry.offset;
+                ++deduplicated;
+            } else {
+                e.offset = align(stored.size());
+                stored.resize(e.offset);
+                stored.insert(stored.end(), in.stored, in.stored + e.storedSize);
+                // raw entries are followed by a '\0'
+                if (e.codec == Raw) stored.push_back('\0');
+                byContent.emplace(e.contentHash, &in);
+            }
+
+            e.nameOffset = (uint32_t) names.size();
+            e.nameSize = (uint32_t) in.path.size();
+            names += in.path;
+            entries.push_back(e);
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const PackEntry& a, const PackEntry& b) {
+            return a.pathHash < b.pathHash;
+        });
+
+        const size_t namesOffset = sizeof(PackHeader) + entries.size() * sizeof(PackEntry);
+        const size_t dataOffset = align(namesOffset + names.size());
+
+        for (auto& e : entries) {
+            e.offset += dataOffset;
+        }
+
+        PackHeader header = {};
+        memcpy(header.magic, packMagic, sizeof(packMagic));
+        header.version = packVersion;
+        header.entryCount = (uint32_t) entries.size();
+        header.namesOffset = namesOffset;
+        header.alignment = (uint32_t) options.alignment;
+
+        std::vector<char> o(dataOffset + stored.size(), '\0');
+        memcpy(&o[0], &header, sizeof(header));
+        if (!entries.empty()) {
+            memcpy(&o[sizeof(header)], entries.data(), entries.size() * sizeof(PackEntry));
+        }
+        std::copy(names.begin(), names.end(), o.begin() + namesOffset);
+        std::copy(stored.begin(), stored.end(), o.begin() + dataOffset);
+
+        printf("[Pack] %zd entries: %zd reused, %zd (re)packed, %zd deduplicated\n",
+               entries.size(), reused, entries.size() - reused, deduplicated);
+        return o;
+    }
+
+
+    // Benchmarks loading the pack: cold load time and the latency of the
+    // first (decompressing) and second (cached) access of each entry
+    void benchmarkPack(const std::string& file) {
+        using clock = std::chrono::high_resolution_clock;
+        const auto us = [](clock::duration d) {
+            return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / 1000.0;
+        };
+
+        // only used for the list of entries and verification
+        elfw::resources::PackFile index;
+        index.open(file);
+
+        const auto t0 = clock::now();
+        elfw::ResourceLoader l(file);
+        const auto t1 = clock::now();
+
+        double firstAccess = 0, secondAccess = 0;
+        size_t size = 0;
+        for (const auto& e : index) {
+            const auto name = index.name(e);
+            const auto a = clock::now();
+            const auto first = l.get(name);
+            const auto m = clock::now();
+            const auto second = l.get(name);
+            const auto z = clock::now();
+
+            if (first.size != e.size || second.ptr != first.ptr
+                || elfw::resources::hashBytes(first.ptr, first.size) != e.contentHash) {
+                fail("Pack check failed for '%s'", name.c_str());
+            }
+            firstAccess += us(m - a);
+            secondAccess += us(z - m);
+            size += first.size;
+        }
+
+        const auto n = (double) std::max<size_t>(index.size(), 1);
+        printf("[Bench] resources: %zd  contents: %zd bytes\n", index.size(), size);
+        printf("[Bench] cold load: %.1f us  first access: %.2f us/entry  cached access: %.2f us/entry\n",
+               us(t1 - t0), firstAccess / n, secondAccess / n);
+    }
+
+
     std::string getWorkingDirectory() {
         const size_t chunkSize=255;
         const int maxChunks=10240; // 2550 KiBs of current path are more than enough
@@ -162,7 +593,7 @@ namespace {
 
 
     bool writeFile(const std::string& fn, const std::vector<char>& data) {
-        std::ofstream binary(fn, std::ios::out);
+        std::ofstream binary(fn, std::ios::out | std::ios::binary);
         if (!binary.good()) {
             fprintf(stderr, "[Error while writing '%s']", fn.c_str());
             return false;
@@ -172,6 +603,21 @@ namespace {
         printf("[Written] %s\n", fn.c_str());
         return true;
     }
+
+
+    // Writes a temporary file and renames it over the target, so readers that
+    // still map the old file keep seeing valid data
+    bool writeFileAtomic(const std::string& fn, const std::vector<char>& data) {
+        const auto tmp = fn + ".tmp";
+        if (!writeFile(tmp, data)) {
+            return false;
+        }
+        if (rename(tmp.c_str(), fn.c_str()) != 0) {
+            fprintf(stderr, "[Error while renaming '%s' to '%s']", tmp.c_str(), fn.c_str());
+            return false;
+        }
+        return true;
+    }
 }
 
 
@@ -182,33 +628,97 @@ int main(const int argc, const char** argv) {
 
 
 
-    if (argc < 3) {
+    bool pack = false, bench = false;
+    std::string embedNamespace;
+    PackOptions options = { false, 16 };
+    int firstArg = 1;
+    for (; firstArg < argc && strncmp(argv[firstArg], "--", 2) == 0; ++firstArg) {
+        const auto opt = std::string(argv[firstArg]);
+        if (opt == "--pack") pack = true;
+        else if (opt == "--compress") options.compress = true;
+        else if (opt == "--bench") bench = true;
+        else if (opt == "--align" && firstArg + 1 < argc) options.alignment = (size_t) atoi(argv[++firstArg]);
+        else if (opt == "--embed" && firstArg + 1 < argc) embedNamespace = argv[++firstArg];
+        else {
+            usage(argv[0]);
+            fail("Unknown option: '%s'", argv[firstArg]);
+        }
+    }
+
+    if ((options.compress || bench) && !pack) {
         usage(argv[0]);
-        fail("Not enough arguments (got [%d])", argc - 1);
+        fail("--compress, --align and --bench need --pack");
+    }
+    if (options.alignment == 0 || (options.alignment & (options.alignment - 1)) != 0) {
+        fail("--align has to be a power of two");
     }
 
-    const auto dataFile = std::string(argv[1]);
+    if (argc < firstArg + 2) {
+        usage(argv[0]);
+        fail("Not enough arguments (got [%d])", argc - 1);
+    }
 
-    const auto data = fileListToData(
-            mapv(
-                    mkz::make_slice(&argv[2], (size_t)(argc - 2)),
-                    [](const char* s) { return std::string(s); }
-            )
+    const auto dataFile = std::string(argv[firstArg]);
+    const auto inputFiles = mapv(
+            mkz::make_slice(&argv[firstArg + 1], (size_t)(argc - firstArg - 1)),
+            [](const char* s) { return std::string(s); }
     );
 
-    puts("===========\n");
+    if (!embedNamespace.empty()) {
+        const auto data = fileListToData(inputFiles);
+        // the source includes the header next to it
+        const auto slash = dataFile.find_last_of("/\\");
+        const auto headerName = (slash == std::string::npos ? dataFile : dataFile.substr(slash + 1)) + ".h";
+
+        if (!writeFile(dataFile + ".h", embeddedHeader(data, embedNamespace))
+            || !writeFile(dataFile + ".cpp", embeddedSource(data, embedNamespace, headerName))) {
+            exit(-11);
+        }
+        // nothing to load
+        return 0;
+    }
+
+    if (pack) {
+        std::vector<char> packData;
+        bool unchanged = false;
+        {
+            // the previous pack has to be closed before it is replaced
+            elfw::resources::PackFile previous;
+            previous.open(dataFile);
+            packData = buildPack(inputFiles, previous, options);
+
+            unchanged = previous.isOpen() && previous.fileSize() == packData.size()
+                        && memcmp(previous.fileBytes(), packData.data(), packData.size()) == 0;
+        }
+
+        // keep the timestamp of the pack if nothing changed, so dependents are not rebuilt
+        // (the build checks a stamp file touched after this instead)
+        if (unchanged) {
+            printf("[Unchanged] %s\n", dataFile.c_str());
+        } else if (!writeFileAtomic(dataFile, packData)) {
+            exit(-11);
+        }
+    } else {
+        const auto data = fileListToData(inputFiles);
+
+        puts("===========\n");
 
-    const auto metadata = metaToBinary(data);
-    if (!writeFile(dataFile, data.binary)
-        || !writeFile(dataFile + ".meta", metadata))
-    {
-        exit(-11);
+        const auto metadata = metaToBinary(data);
+        if (!writeFile(dataFile, data.binary)
+            || !writeFile(dataFile + ".meta", metadata))
+        {
+            exit(-11);
+        }
     }
 
     puts("== Packing done, checking load \n");
 
     // test
-    elfw::ResourceLoader l(dataFile);
+    if (bench) {
+        benchmarkPack(dataFile);
+    } else {
+        elfw::ResourceLoader l(dataFile);
+    }
 
 
 }
@@ -2,10 +2,27 @@
 
 
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
 #include <vector>
 #include <fstream>
+#include <iterator>
+#include <list>
 #include <unordered_map>
 
+#include "elfw-lz.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace elfw {
 
     struct Data {
@@ -14,10 +31,249 @@ namespace elfw {
     };
 
 
+    // BINARY PACK FORMAT
+    // ==================
+    //
+    // [PackHeader][PackEntry x entryCount][names][data]
+    //
+    // The entries are sorted by the hash of their path, so a lookup is a binary
+    // search + a name compare directly on the mapped file. Every resource is
+    // followed by a '\0' (not included in its size) so text can be used as a C string.
+    //
+    // Entries may be compressed one by one (see elfw-lz.h), these are decompressed
+    // on first access into an LRU cache.
+
+    namespace resources {
+
+        static const char packMagic[8] = {'E', 'L', 'F', 'W', 'P', 'A', 'C', 'K'};
+        static const uint32_t packVersion = 1;
+
+        enum Codec : uint32_t {
+            Raw = 0,
+            Lz = 1,
+        };
+
+        enum EntryFlags : uint32_t {
+            // stored Raw because LZ did not make it smaller, so repacking with
+            // compression can reuse it
+            Incompressible = 1,
+        };
+
+        struct PackHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t entryCount;
+            // offset of the name table from the start of the file
+            uint64_t namesOffset;
+            // every entry's data starts at a multiple of this
+            uint32_t alignment;
+            uint32_t reserved;
+        };
+
+        struct PackEntry {
+            uint64_t pathHash;
+            // offset of the data from the start of the file
+            uint64_t offset;
+            // the size of the resource
+            uint64_t size;
+            // the number of bytes stored in the file (same as size for Raw)
+            uint64_t storedSize;
+            // hash of the (uncompressed) contents, entries with the same contents share their data
+            uint64_t contentHash;
+            // modification time of the source file (ns), used for incremental packing
+            int64_t sourceMtime;
+            // offset of the path in the name table
+            uint32_t nameOffset;
+            uint32_t nameSize;
+            uint32_t codec;
+            uint32_t flags;
+        };
+
+        // FNV-1a, so the hashes are stable across compilers and platforms
+        inline uint64_t hashBytes(const char* bytes, std::size_t len) {
+            uint64_t h = 0xcbf29ce484222325ull;
+            for (std::size_t i = 0; i < len; ++i) {
+                h ^= (uint8_t) bytes[i];
+                h *= 0x100000001b3ull;
+            }
+            return h;
+        }
+
+        inline uint64_t hashPath(const char* path, std::size_t len) { return hashBytes(path, len); }
+
+        inline bool isPack(const char* bytes, std::size_t size) {
+            return size >= sizeof(PackHeader) && memcmp(bytes, packMagic, sizeof(packMagic)) == 0;
+        }
+
+
+        // A read-only, memory mapped pack file
+        class PackFile {
+        public:
+            enum OpenResult { Ok, NotAPack, BadVersion };
+
+            PackFile() = default;
+
+            ~PackFile() {
+#ifndef _WIN32
+                if (mapped != nullptr) {
+                    munmap(const_cast<char*>(mapped), mappedSize);
+                }
+#endif
+            }
+
+            PackFile(const PackFile&) = delete;
+            PackFile& operator=(const PackFile&) = delete;
+
+
+            OpenResult open(const std::string& file) {
+#ifndef _WIN32
+                const int fd = ::open(file.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    return NotAPack;
+                }
+
+                struct stat st;
+                if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(PackHeader)) {
+                    close(fd);
+                    return NotAPack;
+                }
+
+                void* p = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (p == MAP_FAILED) {
+                    return NotAPack;
+                }
+
+                const auto result = use(static_cast<const char*>(p), (size_t) st.st_size);
+                if (result != Ok) {
+                    munmap(p, (size_t) st.st_size);
+                    return result;
+                }
+
+                mapped = static_cast<const char*>(p);
+                mappedSize = (size_t) st.st_size;
+                return Ok;
+#else
+                // no mmap here, read the pack into memory instead
+                std::ifstream f(file, std::ios::in | std::ios::binary);
+                if (!f.good()) {
+                    return NotAPack;
+                }
+                copy.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+                return use(copy.data(), copy.size());
+#endif
+            }
+
+
+            // Binary search on the sorted entries
+            const PackEntry* find(const char* path, std::size_t len) const {
+                const auto hash = hashPath(path, len);
+                auto it = std::lower_bound(begin(), end(), hash, [](const PackEntry& e, uint64_t h) {
+                    return e.pathHash < h;
+                });
+
+                for (; it != end() && it->pathHash == hash; ++it) {
+                    if (it->nameSize == len && memcmp(names + it->nameOffset, path, len) == 0) {
+                        return it;
+                    }
+                }
+                return nullptr;
+            }
+
+            bool isOpen() const { return entries != nullptr; }
+
+            const PackEntry* begin() const { return entries; }
+            const PackEntry* end() const { return entries + entryCount; }
+            std::size_t size() const { return entryCount; }
+
+            // The stored bytes of the entry
+            const char* bytes(const PackEntry& e) const { return base + e.offset; }
+
+            std::string name(const PackEntry& e) const { return std::string(names + e.nameOffset, e.nameSize); }
+
+            // The whole file
+            const char* fileBytes() const { return base; }
+            std::size_t fileSize() const { return baseSize; }
+
+        private:
+            // Sets up the entry table if the bytes are a valid pack. Every table,
+            // name and data range has to be inside the file, so a truncated or
+            // corrupt pack is never read past its end.
+            OpenResult use(const char* bytes, std::size_t size) {
+                if (!isPack(bytes, size)) {
+                    return NotAPack;
+                }
+
+                PackHeader header;
+                memcpy(&header, bytes, sizeof(header));
+                if (header.version != packVersion) {
+                    return BadVersion;
+                }
+
+                const std::size_t tableEnd = sizeof(PackHeader) + (std::size_t) header.entryCount * sizeof(PackEntry);
+                if (header.entryCount > (size - sizeof(PackHeader)) / sizeof(PackEntry)
+                    || header.namesOffset < tableEnd || header.namesOffset > size) {
+                    return NotAPack;
+                }
+
+                const auto table = reinterpret_cast<const PackEntry*>(bytes + sizeof(PackHeader));
+                const uint64_t namesSize = size - header.namesOffset;
+                for (std::size_t i = 0; i < header.entryCount; ++i) {
+                    const auto& e = table[i];
+                    const bool validData = e.offset <= size && e.storedSize <= size - e.offset
+                                           // the size is allocated when read, so no more than
+                                           // the block can hold (storedSize is inside the file)
+                                           && ((e.codec == Lz && e.size <= e.storedSize * lz::maxExpansion)
+                                               || (e.codec == Raw && e.storedSize == e.size
+                                                   // followed by a '\0'
+                                                   && e.storedSize < size - e.offset
+                                                   && bytes[e.offset + e.storedSize] == '\0'));
+                    if (!validData || e.nameOffset > namesSize || e.nameSize > namesSize - e.nameOffset) {
+                        return NotAPack;
+                    }
+                }
+
+                base = bytes;
+                baseSize = size;
+                entries = table;
+                entryCount = header.entryCount;
+                names = bytes + header.namesOffset;
+                return Ok;
+            }
+
+            const char* base = nullptr;
+            std::size_t baseSize = 0;
+            const PackEntry* entries = nullptr;
+            std::size_t entryCount = 0;
+            const char* names = nullptr;
+
+            const char* mapped = nullptr;
+            std::size_t mappedSize = 0;
+#ifdef _WIN32
+            std::vector<char> copy;
+#endif
+        };
+    }
+
+
     class ResourceLoader {
 
     public:
-        ResourceLoader(const std::string& file) : data() {
+        // Loads a binary pack (memory mapped) or a legacy data + .meta file pair.
+        // Decompressed entries are kept in an LRU cache of at most `cacheBudget` bytes.
+        ResourceLoader(const std::string& file, std::size_t cacheBudget = 64 * 1024 * 1024)
+                : data(), cacheBudget(cacheBudget) {
+            switch (pack.open(file)) {
+                case resources::PackFile::Ok:
+                    printf("[Resources] Mapped %zd resources from pack '%s'\n", pack.size(), file.c_str());
+                    return;
+                case resources::PackFile::BadVersion:
+                    fprintf(stderr, "Unsupported pack version: '%s'", file.c_str());
+                    exit(-11);
+                case resources::PackFile::NotAPack:
+                    break;
+            }
+
             if (!readBinary(file, data)) {
                 fprintf(stderr, "Cannot load binary: '%s'", file.c_str());
                 exit(-11);
@@ -34,23 +290,83 @@ namespace elfw {
             }
 
         }
+
         ~ResourceLoader() {}
 
-        Data get(const std::string& path) {
-            if (meta.count(path) == 0) {
-                fprintf(stderr, "Cannot find resource with path: '%s'", path.c_str());
-                exit(-12);
+        ResourceLoader(const ResourceLoader&) = delete;
+        ResourceLoader& operator=(const ResourceLoader&) = delete;
+
+        Data get(const std::string& path) { return get(path.c_str(), path.size()); }
+
+        Data get(const char* path) { return get(path, strlen(path)); }
+
+        // Does not allocate for uncompressed pack entries: the result points into
+        // the mapped file. Compressed entries point into the cache, and are only
+        // valid until evicted from it.
+        Data get(const char* path, std::size_t len) {
+            if (pack.isOpen()) {
+                const auto e = pack.find(path, len);
+                if (e == nullptr) {
+                    notFound(path);
+                }
+                if (e->codec == resources::Raw) {
+                    return { pack.bytes(*e), (std::size_t) e->size };
+                }
+                return getCompressed(*e);
+            }
+
+            auto it = meta.find(std::string(path, len));
+            if (it == meta.end()) {
+                notFound(path);
             }
 
-            auto m = meta[path];
-            return { &data[m.first], m.second };
+            return { &data[it->second.first], it->second.second };
         }
 
     private:
         using MetaMap = std::unordered_map<std::string, std::pair<size_t, size_t>>;
 
+        static void notFound(const char* path) {
+            fprintf(stderr, "Cannot find resource with path: '%s'", path);
+            exit(-12);
+        }
+
+        // Returns the cached copy of the entry, decompressing it if needed
+        Data getCompressed(const resources::PackEntry& e) {
+            const auto idx = (std::size_t) (&e - pack.begin());
+
+            auto it = cache.find(idx);
+            if (it != cache.end()) {
+                // move to the front of the LRU list
+                lru.splice(lru.begin(), lru, it->second.lruPos);
+                return { it->second.bytes.data(), (std::size_t) e.size };
+            }
+
+            CacheEntry c = { std::vector<char>((std::size_t) e.size + 1, '\0'), {} };
+            if (!lz::decompress(pack.bytes(e), (std::size_t) e.storedSize, c.bytes.data(), (std::size_t) e.size)) {
+                fprintf(stderr, "Corrupt resource: '%s'", pack.name(e).c_str());
+                exit(-13);
+            }
+
+            lru.push_front(idx);
+            c.lruPos = lru.begin();
+            cacheSize += c.bytes.size();
+            auto inserted = cache.emplace(idx, std::move(c)).first;
+
+            // never evict the entry we are returning
+            while (cacheSize > cacheBudget && lru.size() > 1) {
+                auto victim = cache.find(lru.back());
+                cacheSize -= victim->second.bytes.size();
+                cache.erase(victim);
+                lru.pop_back();
+            }
+
+            return { inserted->second.bytes.data(), (std::size_t) e.size };
+        }
+
+
         static bool readBinary(const std::string& file, std::vector<char>& data) {
-            std::ifstream f(file, std::ios::in);
+            std::ifstream f(file, std::ios::in | std::ios::binary);
             if (!f.good()) {
                 return false;
             }
@@ -77,7 +393,6 @@ namespace elfw {
                 std::string filename;
                 std::size_t offset, size;
 
-                auto nextChar = f.peek();
                 f >> filename;
                 f >> offset;
                 f >> size;
@@ -91,9 +406,24 @@ namespace elfw {
             return true;
         }
 
+        // legacy data + .meta
         std::vector<char> data;
         MetaMap meta;
 
+        // binary packs
+        resources::PackFile pack;
+
+        // decompressed entries keyed by their index in the entry table
+        struct CacheEntry {
+            std::vector<char> bytes;
+            std::list<std::size_t>::iterator lruPos;
+        };
+
+        std::unordered_map<std::size_t, CacheEntry> cache;
+        // most recently used first
+        std::list<std::size_t> lru;
+        std::size_t cacheSize = 0;
+        std::size_t cacheBudget;
 
     };
 